@@ -0,0 +1,89 @@
+#ifndef AABB_H
+#define AABB_H
+
+#include "utility.h"
+
+#include <algorithm>
+
+/*
+    Axis-Aligned Bounding Box, 轴对齐包围盒.
+    一个aabb由两个对角点minimum和maximum表示, 包围盒内的点满足 minimum[a] <= p[a] <= maximum[a], a = x, y, z.
+    默认构造的包围盒是"空盒": minimum = +inf, maximum = -inf, 任何点与它求并集都会得到只包含这个点的包围盒.
+
+    射线与包围盒相交检测使用slab method: 包围盒在每个轴上都是两个平行平面夹住的一个slab, 射线P(t) = O + t*d与第a个slab的交点区间为
+        t0 = (minimum[a] - O[a]) / d[a],   t1 = (maximum[a] - O[a]) / d[a],   如果d[a] < 0则交换t0和t1.
+    三个轴的区间与(t_min, t_max)求交集, 交集非空则射线与包围盒相交.
+*/
+class aabb {
+    public:
+        // default and parameter constructor.
+        aabb() : minimum(infinity, infinity, infinity), maximum(-infinity, -infinity, -infinity) {}
+        aabb(const point3& a, const point3& b) : minimum{a}, maximum{b} {}
+
+    public:
+        point3 min() const { return minimum; }
+        point3 max() const { return maximum; }
+
+        bool empty() const { return maximum.x() < minimum.x() || maximum.y() < minimum.y() || maximum.z() < minimum.z(); }
+
+        point3 centroid() const { return 0.5 * (minimum + maximum); }
+
+        // 包围盒表面积, SAH(surface area heuristic)使用表面积来估计射线击中包围盒的概率.
+        double surface_area() const {
+            if(empty()) return 0.0;
+            vec3 d = maximum - minimum;
+            return 2.0 * (d.x()*d.y() + d.y()*d.z() + d.z()*d.x());
+        }
+
+        // 返回包围盒最长的轴, 0 -> x, 1 -> y, 2 -> z.
+        int longest_axis() const {
+            vec3 d = maximum - minimum;
+            if(d.x() > d.y() && d.x() > d.z()) return 0;
+            return d.y() > d.z() ? 1 : 2;
+        }
+
+        void expand(const point3& p) {
+            for(int a = 0; a < 3; ++a) {
+                minimum[a] = std::min(minimum[a], p[a]);
+                maximum[a] = std::max(maximum[a], p[a]);
+            }
+        }
+        void expand(const aabb& box) {
+            for(int a = 0; a < 3; ++a) {
+                minimum[a] = std::min(minimum[a], box.minimum[a]);
+                maximum[a] = std::max(maximum[a], box.maximum[a]);
+            }
+        }
+
+        // inv_dir是射线方向每个分量的倒数. BVH遍历时一条射线要测试很多包围盒, 因此倒数只在遍历开始时计算一次, 把除法变成乘法.
+        bool hit(const ray& r, const vec3& inv_dir, double t_min, double t_max) const {
+            const point3 orig = r.origin();
+            for(int a = 0; a < 3; ++a) {
+                double t0 = (minimum[a] - orig[a]) * inv_dir[a];
+                double t1 = (maximum[a] - orig[a]) * inv_dir[a];
+                if(inv_dir[a] < 0.0) std::swap(t0, t1);
+                t_min = t0 > t_min ? t0 : t_min;
+                t_max = t1 < t_max ? t1 : t_max;
+                if(t_max < t_min) return false;
+            }
+            return true;
+        }
+
+        bool hit(const ray& r, double t_min, double t_max) const {
+            const vec3 d = r.direcion();
+            return hit(r, vec3(1.0/d.x(), 1.0/d.y(), 1.0/d.z()), t_min, t_max);
+        }
+
+    private:
+        point3 minimum;
+        point3 maximum;
+};
+
+// 返回同时包围两个包围盒的最小包围盒.
+inline aabb surrounding_box(const aabb& box0, const aabb& box1) {
+    aabb box = box0;
+    box.expand(box1);
+    return box;
+}
+
+#endif
@@ -0,0 +1,103 @@
+#ifndef ADAPTIVE_SAMPLING_H
+#define ADAPTIVE_SAMPLING_H
+
+#include "utility.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <iostream>
+
+/*
+    pixel_estimator: 一个像素的在线统计量.
+    除了累加采样颜色之外, 还用Welford算法在线计算每个颜色分量的均值和方差, 不需要保存所有采样值, 数值上也比 E[x^2] - E[x]^2 稳定.
+
+    像素均值的标准误差为 sqrt(var / n). 输出时做了gamma = 2.0的校正 v = sqrt(x), 而 dv/dx = 1 / (2 sqrt(x)),
+    所以输出图像上的误差约为 sqrt(var / n) / (2 sqrt(mean)). 暗处同样大小的误差在校正之后更明显, 这正好符合人眼的感受.
+    取三个分量中最大的误差, 只看亮度的话偏红或者偏蓝的彩色噪声会被低估.
+*/
+class pixel_estimator {
+    public:
+        void add(const color& c) {
+            color_sum += c;
+            ++n;
+            const vec3 delta = c - mean;
+            mean += delta / n;
+            m2 += delta * (c - mean);
+        }
+
+        int count() const { return n; }
+        const color& sum() const { return color_sum; }
+        const color& running_mean() const { return mean; }
+        const color& squared_deviations() const { return m2; }
+
+        // 恢复保存下来的全部统计量(见checkpoint.h). 之后继续add()得到的结果与从未中断过逐位相同.
+        void restore(const color& saved_sum, const int saved_count, const color& saved_mean, const color& saved_m2) {
+            color_sum = saved_sum;
+            n = saved_count;
+            mean = saved_mean;
+            m2 = saved_m2;
+        }
+
+        // 像素均值每个分量的方差估计 var / n. 少于两个采样时返回0.
+        color mean_variance() const {
+            if(n < 2) return color(0.0, 0.0, 0.0);
+            return m2 / (static_cast<double>(n - 1) * n);
+        }
+
+        // 输出图像(gamma校正之后, [0,1]范围)上像素值的估计误差. 少于两个采样时无法估计方差, 返回无穷大.
+        double error() const {
+            if(n < 2) return infinity;
+            double err = 0.0;
+            for(int a = 0; a < 3; ++a)
+                err = std::max(err, std::sqrt(m2[a] / (n - 1) / n) / (2.0 * std::sqrt(std::max<double>(mean[a], 1e-3))));
+            return err;
+        }
+
+    private:
+        color color_sum{0.0, 0.0, 0.0};
+        int n = 0;
+        color mean{0.0, 0.0, 0.0};
+        color m2{0.0, 0.0, 0.0};       // 与均值之差的平方和.
+};
+
+/*
+    sampling_stats: 统计实际花费的采样数. 每个tile先在局部统计, 渲染完一个tile再合并到全局, 原子操作的次数与tile数目相同.
+*/
+struct sampling_stats {
+    std::atomic<long long> total_samples{0};
+    std::atomic<long long> pixels{0};
+    std::atomic<long long> converged_pixels{0};     // 在达到最大采样数之前就满足误差要求而停止的像素.
+    std::atomic<int> min_samples{1 << 30};
+    std::atomic<int> max_samples{0};
+
+    // 清零, 重新统计. 分多轮渲染时每一轮都统计全部像素, 所以每轮开始之前清零, 最后一轮的结果就是整幅图像的统计.
+    void reset() {
+        total_samples = 0;
+        pixels = 0;
+        converged_pixels = 0;
+        min_samples = 1 << 30;
+        max_samples = 0;
+    }
+
+    void merge(const long long tile_samples, const long long tile_pixels, const long long tile_converged, const int tile_min, const int tile_max) {
+        total_samples += tile_samples;
+        pixels += tile_pixels;
+        converged_pixels += tile_converged;
+        int current = min_samples.load();
+        while(tile_min < current && !min_samples.compare_exchange_weak(current, tile_min)) {}
+        current = max_samples.load();
+        while(tile_max > current && !max_samples.compare_exchange_weak(current, tile_max)) {}
+    }
+
+    // 打印采样统计, 并与每个像素固定采样fixed_spp次的总采样数比较.
+    void report(std::ostream& out, const int fixed_spp) const {
+        const double average = pixels > 0 ? static_cast<double>(total_samples) / pixels : 0.0;
+        out << "Samples: " << total_samples << " total, " << average << " per pixel on average"
+            << " (min " << min_samples << ", max " << max_samples << "), "
+            << 100.0 * average / fixed_spp << "% of " << fixed_spp << " spp fixed budget\n"
+            << "Converged pixels: " << converged_pixels << " of " << pixels << '\n';
+    }
+};
+
+#endif
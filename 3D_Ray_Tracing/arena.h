@@ -0,0 +1,153 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/*
+    scene_arena: 单调递增(monotonic)的bump分配器, 场景中的物体和材质都放在它里面.
+
+    每个对象单独new或make_shared时, 上千个小对象散落在堆的各处, 每个还带着shared_ptr的控制块, 遍历场景时顺着指针访问的几乎都是冷的cache line.
+    arena一次向系统申请一大块内存(chunk), 之后每次分配只是把游标往后移动并对齐, 先后创建的对象在内存中紧挨在一起.
+    对象不能单独释放, arena销毁(或release())时按照与创建相反的顺序统一调用析构函数, 再一次性释放所有块.
+
+    需要析构的对象在arena中额外记录一个析构记录(链表节点, 同样分配在arena里); 平凡析构的类型(例如只有几个double的材质)没有任何额外开销.
+    返回的指针在arena销毁之前一直有效, 移动arena也不会使它们失效. arena本身不是线程安全的, 只在单线程构建场景时分配, 渲染时只读.
+*/
+class scene_arena {
+    public:
+        // default and parameter constructor. chunk_size是每次向系统申请的块大小, 大于它的对象单独占用一个刚好放得下的块.
+        explicit scene_arena(const size_t chunk_size = 64 * 1024) : chunk_size{chunk_size} {}
+        ~scene_arena() { release(); }
+
+        scene_arena(const scene_arena&) = delete;
+        scene_arena& operator=(const scene_arena&) = delete;
+        scene_arena(scene_arena&& other) noexcept { swap(other); }
+        scene_arena& operator=(scene_arena&& other) noexcept {
+            if(this != &other) {
+                release();
+                swap(other);
+            }
+            return *this;
+        }
+
+    public:
+        // 在arena中构造一个T类型的对象, 返回指向它的指针. 例如: auto s = arena.create<sphere_set>();
+        template<typename T, typename... Args>
+        T* create(Args&&... args);
+        // 连续构造count个默认值的T类型对象, 返回第一个的地址. count为0时返回nullptr.
+        template<typename T>
+        T* create_array(const size_t count);
+
+        // 分配bytes字节, 按照alignment对齐的未初始化内存. alignment必须是2的幂.
+        void* allocate(const size_t bytes, const size_t alignment);
+
+        // 按照与创建相反的顺序析构所有对象, 并释放所有块. 之后arena可以继续使用.
+        void release();
+
+        size_t bytes_used() const { return used; }              // 已经分配出去的字节数, 包括对齐填充和析构记录.
+        size_t chunk_count() const { return chunks.size(); }
+
+    private:
+        struct destructor_record {
+            void (*destroy)(void* objects, size_t count);
+            void* objects;
+            size_t count;
+            destructor_record* next;
+        };
+
+        template<typename T>
+        static void destroy_objects(void* objects, const size_t count) {
+            T* typed = static_cast<T*>(objects);
+            for(size_t k = count; k > 0; --k) typed[k - 1].~T();
+        }
+
+        void swap(scene_arena& other) noexcept;
+
+    private:
+        std::vector<std::unique_ptr<unsigned char[]>> chunks;
+        unsigned char* cursor = nullptr;
+        unsigned char* chunk_end = nullptr;
+        size_t chunk_size = 64 * 1024;
+        size_t used = 0;
+        destructor_record* destructors = nullptr;           // 最后创建的对象在链表头, 所以沿着链表析构就是逆序.
+};
+
+template<typename T, typename... Args>
+T* scene_arena::create(Args&&... args) {
+    void* memory = allocate(sizeof(T), alignof(T));
+    if(std::is_trivially_destructible<T>::value)
+        return new(memory) T(std::forward<Args>(args)...);
+
+    // 先分配析构记录再构造对象: 构造函数抛出异常时记录还没有链入, 不会析构一个没有构造完成的对象.
+    destructor_record* record = static_cast<destructor_record*>(allocate(sizeof(destructor_record), alignof(destructor_record)));
+    T* object = new(memory) T(std::forward<Args>(args)...);
+    *record = {&destroy_objects<T>, object, 1, destructors};
+    destructors = record;
+    return object;
+}
+
+template<typename T>
+T* scene_arena::create_array(const size_t count) {
+    if(count == 0) return nullptr;
+    T* objects = static_cast<T*>(allocate(sizeof(T) * count, alignof(T)));
+    destructor_record* record = nullptr;
+    if(!std::is_trivially_destructible<T>::value)
+        record = static_cast<destructor_record*>(allocate(sizeof(destructor_record), alignof(destructor_record)));
+
+    size_t constructed = 0;
+    try {
+        for(; constructed < count; ++constructed) new(objects + constructed) T();
+    }
+    catch(...) {
+        destroy_objects<T>(objects, constructed);
+        throw;
+    }
+    if(record) {
+        *record = {&destroy_objects<T>, objects, count, destructors};
+        destructors = record;
+    }
+    return objects;
+}
+
+void* scene_arena::allocate(const size_t bytes, const size_t alignment) {
+    uintptr_t aligned = (reinterpret_cast<uintptr_t>(cursor) + alignment - 1) & ~static_cast<uintptr_t>(alignment - 1);
+    if(cursor == nullptr || aligned + bytes > reinterpret_cast<uintptr_t>(chunk_end)) {
+        // 当前块放不下, 申请新块. 多申请alignment字节, 保证对齐之后一定放得下. 当前块剩下的空间不再使用.
+        const size_t size = std::max(chunk_size, bytes + alignment);
+        chunks.emplace_back(new unsigned char[size]);
+        cursor = chunks.back().get();
+        chunk_end = cursor + size;
+        aligned = (reinterpret_cast<uintptr_t>(cursor) + alignment - 1) & ~static_cast<uintptr_t>(alignment - 1);
+    }
+    unsigned char* result = reinterpret_cast<unsigned char*>(aligned);
+    used += static_cast<size_t>(result + bytes - cursor);
+    cursor = result + bytes;
+    return result;
+}
+
+void scene_arena::release() {
+    for(destructor_record* record = destructors; record != nullptr; record = record->next)
+        record->destroy(record->objects, record->count);
+    destructors = nullptr;
+    chunks.clear();
+    cursor = chunk_end = nullptr;
+    used = 0;
+}
+
+void scene_arena::swap(scene_arena& other) noexcept {
+    std::swap(chunks, other.chunks);
+    std::swap(cursor, other.cursor);
+    std::swap(chunk_end, other.chunk_end);
+    std::swap(chunk_size, other.chunk_size);
+    std::swap(used, other.used);
+    std::swap(destructors, other.destructors);
+}
+
+#endif
@@ -0,0 +1,279 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include "aabb.h"
+#include "render_stats.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <vector>
+
+/*
+    层次包围体Bounding Volume Hierarchy的通用实现, 只依赖每个图元(primitive)的包围盒, 不关心图元本身是什么.
+    bvh_node(任意surface对象的集合)以及后续其他需要加速结构的几何体都可以复用这一实现.
+
+    构建: 使用分桶(binned)的表面积启发式SAH(surface area heuristic).
+        一条随机射线击中子包围盒B的条件概率约等于 SA(B) / SA(parent), 所以把一个节点划分为左右两个子节点的期望代价为
+            cost = C_trav + SA(L)/SA(P) * N_L * C_isect + SA(R)/SA(P) * N_R * C_isect
+        在中心点分布最广的轴上把图元按照包围盒中心点分到若干个桶中, 在桶的边界处计算划分代价, 选取代价最小的划分.
+        如果最小划分代价比直接把所有图元放进一个叶子节点的代价还大, 并且图元数目不超过max_leaf_size, 那么就生成叶子节点.
+
+    存储: 所有节点按照深度优先顺序存放在一个数组中(linear BVH), 节点的左孩子紧跟在它自己后面, 只需记录右孩子的下标.
+          图元的下标也按照叶子节点的顺序重新排列, 一个叶子节点对应primitive_order中连续的一段[offset, offset + count).
+
+    遍历: 使用显式栈代替递归. 根据射线在划分轴上的方向先访问近的孩子, 再访问远的孩子.
+          每找到一个更近的交点就缩小t_max, 于是远处孩子的包围盒测试就会失败而被直接跳过(closest-hit early-out).
+*/
+struct bvh_linear_node {
+    aabb box;
+    int offset;         // 叶子节点: 第一个图元在primitive_order中的下标; 内部节点: 右孩子节点的下标.
+    int count;          // 叶子节点: 图元个数(> 0); 内部节点: 0.
+    int axis;           // 内部节点的划分轴, 遍历时决定先访问哪个孩子.
+};
+
+class bvh_tree {
+    public:
+        // 使用图元的包围盒构建BVH. 构建完成后primitive_order()[k]是第k个叶子图元在原数组中的下标.
+        // primitives_per_test是叶子中一次相交测试能同时处理的图元个数, 例如SIMD一次测试8个球时为8, SAH按照测试次数而不是图元个数计算代价.
+        void build(const std::vector<aabb>& primitive_boxes, const int max_leaf_size = 4, const int primitives_per_test = 1);
+
+        bool empty() const { return tree_nodes.empty(); }
+        aabb bounds() const { return tree_nodes.empty() ? aabb() : tree_nodes[0].box; }
+
+        const std::vector<bvh_linear_node>& nodes() const { return tree_nodes; }
+        const std::vector<int>& primitive_order() const { return order; }
+        // 使用者按照primitive_order()重排自己的图元数组之后, 这一数组就不再需要了, 可以释放以节省内存.
+        void release_primitive_order() { std::vector<int>().swap(order); }
+
+        /*
+            遍历BVH. hit_leaf是一个可调用对象, 签名为bool(int offset, int count, double& t_max),
+            负责测试叶子节点中的图元[offset, offset + count), 如果找到更近的交点则更新t_max并返回true.
+            只要有任何一个叶子返回true, 函数就返回true, 此时t_max是最近交点的参数t.
+        */
+        template<typename LeafFunction>
+        bool traverse(const ray& r, const double t_min, double& t_max, LeafFunction&& hit_leaf) const;
+
+        /*
+            任意交点(any-hit)遍历, 用于shadow ray. hit_leaf的签名为bool(int offset, int count), 叶子中有任何图元在[t_min, t_max]内与射线相交时返回true.
+            第一个返回true的叶子就结束遍历, t_max始终不变.
+        */
+        template<typename LeafFunction>
+        bool any_hit(const ray& r, const double t_min, const double t_max, LeafFunction&& hit_leaf) const;
+
+    private:
+        struct build_primitive {
+            aabb box;
+            point3 centroid;
+            int index;
+        };
+
+        int build_recursive(std::vector<build_primitive>& prims, const int begin, const int end, const int depth);
+
+        // 测试count个图元所需的相交测试次数.
+        double test_count(const int count) const { return static_cast<double>((count + batch_size - 1) / batch_size); }
+
+    private:
+        // SAH划分的最大深度. 超过之后使用对半划分, 对半划分最多再增加31层, 所以遍历栈大小128足够.
+        static const int max_sah_depth = 64;
+        static const int max_stack_size = 128;
+
+        std::vector<bvh_linear_node> tree_nodes;
+        std::vector<int> order;
+        int leaf_size = 4;
+        int batch_size = 1;
+};
+
+void bvh_tree::build(const std::vector<aabb>& primitive_boxes, const int max_leaf_size, const int primitives_per_test) {
+    trace_scope trace("build BVH", "primitives", static_cast<int64_t>(primitive_boxes.size()));
+    leaf_size = std::max(1, max_leaf_size);
+    batch_size = std::max(1, primitives_per_test);
+    tree_nodes.clear();
+    order.clear();
+    if(primitive_boxes.empty()) return;
+
+    std::vector<build_primitive> prims(primitive_boxes.size());
+    for(size_t k = 0; k < prims.size(); ++k)
+        prims[k] = {primitive_boxes[k], primitive_boxes[k].centroid(), static_cast<int>(k)};
+
+    tree_nodes.reserve(2 * prims.size());
+    order.reserve(prims.size());
+    build_recursive(prims, 0, static_cast<int>(prims.size()), 0);
+}
+
+int bvh_tree::build_recursive(std::vector<build_primitive>& prims, const int begin, const int end, const int depth) {
+    const int node_index = static_cast<int>(tree_nodes.size());
+    tree_nodes.push_back(bvh_linear_node());
+
+    aabb box, centroid_box;
+    for(int k = begin; k < end; ++k) {
+        box.expand(prims[k].box);
+        centroid_box.expand(prims[k].centroid);
+    }
+    const int n = end - begin;
+
+    auto make_leaf = [&]() {
+        tree_nodes[node_index] = {box, static_cast<int>(order.size()), n, 0};
+        for(int k = begin; k < end; ++k)
+            order.push_back(prims[k].index);
+        return node_index;
+    };
+
+    if(n == 1) return make_leaf();
+
+    const int axis = centroid_box.longest_axis();
+    const double axis_min = centroid_box.min()[axis];
+    const double axis_extent = centroid_box.max()[axis] - axis_min;
+
+    // 对半划分: 按中心点在划分轴上的中位数把图元分成数目相同的两半.
+    auto median_split = [&]() {
+        const int mid = begin + n/2;
+        std::nth_element(&prims[begin], &prims[mid], &prims[begin] + n,
+                         [axis](const build_primitive& a, const build_primitive& b) { return a.centroid[axis] < b.centroid[axis]; });
+        build_recursive(prims, begin, mid, depth + 1);
+        const int right = build_recursive(prims, mid, end, depth + 1);
+        tree_nodes[node_index] = {box, right, 0, axis};
+        return node_index;
+    };
+
+    // 所有图元中心点重合时SAH无法再划分. 图元太多时对半划分, 避免生成超大叶子节点.
+    if(axis_extent <= 0.0)
+        return n <= leaf_size ? make_leaf() : median_split();
+    // SAH在极端分布下可能每次只分出很少几个图元, 树太深时改为对半划分, 保证遍历栈不会溢出.
+    if(depth >= max_sah_depth)
+        return median_split();
+
+    // 分桶SAH. 这里只在中心点包围盒的最长轴上分桶, 对于大多数场景这与三个轴都尝试的效果相当, 构建却快三倍.
+    const int num_buckets = 16;
+    struct bucket { int count = 0; aabb box; };
+    bucket buckets[num_buckets];
+
+    auto bucket_of = [&](const build_primitive& p) {
+        int b = static_cast<int>(num_buckets * ((p.centroid[axis] - axis_min) / axis_extent));
+        return b < num_buckets ? b : num_buckets - 1;
+    };
+    for(int k = begin; k < end; ++k) {
+        bucket& b = buckets[bucket_of(prims[k])];
+        ++b.count;
+        b.box.expand(prims[k].box);
+    }
+
+    // 从左往右和从右往左各扫描一次, 求出每个桶边界处的划分代价. 代价中省略了共同的常数C_trav和分母SA(parent).
+    double cost[num_buckets - 1];
+    aabb left_box, right_box;
+    int left_count = 0, right_count = 0;
+    for(int b = 0; b < num_buckets - 1; ++b) {
+        left_box.expand(buckets[b].box);
+        left_count += buckets[b].count;
+        cost[b] = test_count(left_count) * left_box.surface_area();
+    }
+    for(int b = num_buckets - 1; b > 0; --b) {
+        right_box.expand(buckets[b].box);
+        right_count += buckets[b].count;
+        cost[b - 1] += test_count(right_count) * right_box.surface_area();
+    }
+
+    int best_split = 0;
+    for(int b = 1; b < num_buckets - 1; ++b)
+        if(cost[b] < cost[best_split]) best_split = b;
+
+    // 叶子节点代价为 N_test * C_isect, 内部节点代价为 C_trav + cost / SA(parent), 取 C_trav = 0.125 C_isect.
+    const double leaf_cost  = test_count(n);
+    const double split_cost = 0.125 + cost[best_split] / box.surface_area();
+    if(n <= leaf_size && leaf_cost <= split_cost) return make_leaf();
+
+    build_primitive* mid_ptr = std::partition(&prims[begin], &prims[begin] + n,
+                                              [&](const build_primitive& p) { return bucket_of(p) <= best_split; });
+    const int mid = static_cast<int>(mid_ptr - &prims[0]);
+    if(mid == begin || mid == end) return median_split();      // 数值原因导致所有图元落在一侧时退化为对半划分.
+
+    build_recursive(prims, begin, mid, depth + 1);
+    const int right = build_recursive(prims, mid, end, depth + 1);
+    tree_nodes[node_index] = {box, right, 0, axis};
+    return node_index;
+}
+
+template<typename LeafFunction>
+bool bvh_tree::traverse(const ray& r, const double t_min, double& t_max, LeafFunction&& hit_leaf) const {
+    if(tree_nodes.empty()) return false;
+
+    const vec3 d = r.direcion();
+    const vec3 inv_dir(1.0/d.x(), 1.0/d.y(), 1.0/d.z());
+    const bool dir_is_neg[3] = {inv_dir.x() < 0.0, inv_dir.y() < 0.0, inv_dir.z() < 0.0};
+
+    bool hit_anything = false;
+    int stack[max_stack_size];
+    int stack_size = 0;
+    int current = 0;
+    uint64_t visited = 0;                   // 访问的节点数, 遍历结束时一次加到线程的计数器上.
+    while(true) {
+        const bvh_linear_node& node = tree_nodes[current];
+        ++visited;
+        if(node.box.hit(r, inv_dir, t_min, t_max)) {
+            if(node.count > 0) {
+                if(hit_leaf(node.offset, node.count, t_max)) hit_anything = true;
+                if(stack_size == 0) break;
+                current = stack[--stack_size];
+            }
+            else if(dir_is_neg[node.axis]) {
+                // 射线沿划分轴负方向传播, 右孩子更近, 先访问右孩子.
+                stack[stack_size++] = current + 1;
+                current = node.offset;
+            }
+            else {
+                stack[stack_size++] = node.offset;
+                current = current + 1;
+            }
+        }
+        else {
+            if(stack_size == 0) break;
+            current = stack[--stack_size];
+        }
+    }
+    thread_counters().bvh_nodes += visited;
+    return hit_anything;
+}
+
+template<typename LeafFunction>
+bool bvh_tree::any_hit(const ray& r, const double t_min, const double t_max, LeafFunction&& hit_leaf) const {
+    if(tree_nodes.empty()) return false;
+
+    const vec3 d = r.direcion();
+    const vec3 inv_dir(1.0/d.x(), 1.0/d.y(), 1.0/d.z());
+    const bool dir_is_neg[3] = {inv_dir.x() < 0.0, inv_dir.y() < 0.0, inv_dir.z() < 0.0};
+
+    // 与traverse()相同的显式栈遍历. 仍然先访问近的孩子: 靠近起点的遮挡物通常更早被找到.
+    int stack[max_stack_size];
+    int stack_size = 0;
+    int current = 0;
+    uint64_t visited = 0;
+    while(true) {
+        const bvh_linear_node& node = tree_nodes[current];
+        ++visited;
+        if(node.box.hit(r, inv_dir, t_min, t_max)) {
+            if(node.count > 0) {
+                if(hit_leaf(node.offset, node.count)) {
+                    thread_counters().bvh_nodes += visited;
+                    return true;
+                }
+                if(stack_size == 0) break;
+                current = stack[--stack_size];
+            }
+            else if(dir_is_neg[node.axis]) {
+                stack[stack_size++] = current + 1;
+                current = node.offset;
+            }
+            else {
+                stack[stack_size++] = node.offset;
+                current = current + 1;
+            }
+        }
+        else {
+            if(stack_size == 0) break;
+            current = stack[--stack_size];
+        }
+    }
+    thread_counters().bvh_nodes += visited;
+    return false;
+}
+
+#endif
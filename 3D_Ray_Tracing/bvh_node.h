@@ -0,0 +1,103 @@
+#ifndef BVH_NODE_H
+#define BVH_NODE_H
+
+#include "bvh.h"
+#include "surface.h"
+#include "surface_list.h"
+
+#include <vector>
+
+/*
+    bvh_node: 使用SAH构建的层次包围体, 它本身也是一个surface, 可以直接替换surface_list作为world传给ray_color().
+
+    surface_list::hit对每条射线都要测试所有物体, 复杂度为O(N). bvh_node把物体按照包围盒组织成二叉树,
+    射线只需测试与其相交的那些包围盒中的物体, 平均复杂度降为O(log N), 十万到百万个球的场景也能在可接受的时间内渲染.
+
+    构建之后整棵树是只读的, 多个渲染线程可以同时遍历.
+    没有有限包围盒的物体无法放进树中, 它们被单独保存下来, 每条射线都直接测试.
+    bvh_node和surface_list一样只保存不拥有所有权的指针, 物体(通常在scene的arena中)必须比bvh_node活得更久.
+*/
+class bvh_node : public surface {
+    public:
+        // parameter constructor. 在一个已有的surface_list之上构建BVH.
+        explicit bvh_node(const surface_list& list, const int max_leaf_size = 4) : bvh_node(list.objects_list(), max_leaf_size) {}
+        explicit bvh_node(const std::vector<const surface*>& src_objects, const int max_leaf_size = 4);
+
+    public:
+        virtual bool intersect(const ray& r, double t_min, double t_max, hit_query& q) const override;
+        virtual bool occluded(const ray& r, double t_min, double t_max) const override;
+        virtual bool bounding_box(aabb& output_box) const override;
+        virtual void collect_lights(light_list& lights) const override {
+            for(const surface* object : unbounded_objects) object->collect_lights(lights);
+            for(const surface* object : objects) object->collect_lights(lights);
+        }
+
+    private:
+        bvh_tree tree;
+        std::vector<const surface*> objects;                // 按照叶子节点顺序重新排列过的物体, 一个叶子节点对应一段连续的物体.
+        std::vector<const surface*> unbounded_objects;    // 没有有限包围盒的物体.
+};
+
+bvh_node::bvh_node(const std::vector<const surface*>& src_objects, const int max_leaf_size) {
+    std::vector<const surface*> bounded_objects;
+    std::vector<aabb> boxes;
+    aabb box;
+    for(const surface* object : src_objects) {
+        if(object->bounding_box(box)) {
+            bounded_objects.push_back(object);
+            boxes.push_back(box);
+        }
+        else
+            unbounded_objects.push_back(object);
+    }
+
+    tree.build(boxes, max_leaf_size);
+    objects.reserve(bounded_objects.size());
+    for(int index : tree.primitive_order())
+        objects.push_back(bounded_objects[index]);
+}
+
+bool bvh_node::intersect(const ray& r, double t_min, double t_max, hit_query& q) const {
+    // 物体只在找到比t_max更近的交点时才会改写q, 所以每次命中之后q都保存着目前为止最近的交点.
+    bool hit_anything = false;
+    for(const surface* object : unbounded_objects) {
+        if(object->intersect(r, t_min, t_max, q)) {
+            hit_anything = true;
+            t_max = q.t;
+        }
+    }
+
+    // 先测试无界物体再遍历树, 这样树的遍历一开始就能用更小的t_max剔除包围盒.
+    auto hit_leaf = [&](const int offset, const int count, double& closest_so_far) {
+        bool hit_leaf_object = false;
+        for(int k = offset; k < offset + count; ++k) {
+            if(objects[k]->intersect(r, t_min, closest_so_far, q)) {
+                hit_leaf_object = true;
+                closest_so_far = q.t;
+            }
+        }
+        return hit_leaf_object;
+    };
+    if(tree.traverse(r, t_min, t_max, hit_leaf)) hit_anything = true;
+
+    return hit_anything;
+}
+
+bool bvh_node::occluded(const ray& r, double t_min, double t_max) const {
+    for(const surface* object : unbounded_objects)
+        if(object->occluded(r, t_min, t_max)) return true;
+
+    return tree.any_hit(r, t_min, t_max, [&](const int offset, const int count) {
+        for(int k = offset; k < offset + count; ++k)
+            if(objects[k]->occluded(r, t_min, t_max)) return true;
+        return false;
+    });
+}
+
+bool bvh_node::bounding_box(aabb& output_box) const {
+    if(!unbounded_objects.empty() || tree.empty()) return false;
+    output_box = tree.bounds();
+    return true;
+}
+
+#endif
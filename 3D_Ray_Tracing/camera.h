@@ -126,7 +126,7 @@ class camera {
             // 如果想要直接在u-v平面以原视点为圆心的圆盘取随机offset偏移量比较困难, 所以我们可以先在标准的世界坐标系下的同半径圆盘上取随机点, 然后再把轴分量值变换成u-v平面的轴分量值.
             //  1. 首先在世界坐标系下, 半径为lens_radius圆心为(0,0,0)的x-y平面上的圆盘内随机取一个点, 这一个随机点向量的x轴和y轴分量非0, 长度小于1.
             //  2. u-v平面有表示坐标系的标准单位基向量u和v, 因此直接把x的分量乘以基向量u就是在u轴上的随机偏移量, 把y的分量乘以基向量v就是在v轴上的随机偏移量. 何在一起就是offset向量.
-            vec3 rd = lens_radius * random_in_unit_disk();      // 如果lens_radius=0.0, 那么就没有偏移量, 即没有散焦模糊效果.
+            vec3 rd = lens_radius * sample_unit_disk(sample_2d());      // 如果lens_radius=0.0, 那么就没有偏移量, 即没有散焦模糊效果.
             vec3 offset = rd.x()*u + rd.y()*v;
             vec3 random_origin = origin + offset;                  // 生成随机视点位置. new_origin和origin处于同一u-v平面.
 
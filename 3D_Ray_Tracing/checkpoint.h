@@ -0,0 +1,240 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include "adaptive_sampling.h"
+#include "integrator.h"
+#include "mapped_file.h"
+#include "render_options.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+/*
+    断点续渲(checkpoint and resume).
+
+    长时间的渲染可能被中途终止(机器被抢占等), 原来所有进度都会丢失. render_checkpoint保存每个像素继续渲染所需要的全部状态:
+        1. 颜色的在线统计量: 采样累加值和采样数目, 以及自适应采样和降噪用到的Welford均值和平方和(见pixel_estimator);
+        2. 降噪时特征(albedo, 法向量, 深度)的累加值;
+        3. 采样器状态. sampler是基于计数器的(见sampler.h), 像素(i,j)的第k个采样只由(种子, i, j, k)决定,
+           所以只需要记录种子和采样器类型, 每个像素下一个采样的编号就是它已有的采样数目.
+    累加值按照渲染时的精度(real)原样保存, 恢复之后按照相同的顺序继续累加, 所以续渲的图像与不中断的渲染逐位相同.
+    续渲时可以给出更大的--spp, 在已有的采样上继续追加.
+
+    文件格式(二进制, 按照写入机器的字节序, 加载时检查):
+        checkpoint_header                           文件头, 记录图像大小和决定采样结果的渲染参数
+        char scene[scene_length]                    场景名字或者场景文件的路径
+        int32_t samples[n]                          每个像素的采样数目, n = width * height, 行优先
+        real sum[3n]                                颜色累加值
+        real mean[3n], m2[3n]                       有checkpoint_variance标志时
+        real albedo[3n], normal[3n], double depth[n]  有checkpoint_features标志时
+    只有自适应采样或者降噪时才保存方差和特征, 普通渲染每个像素只占28字节(双精度).
+*/
+const char checkpoint_magic[8] = {'R', 'T', 'C', 'H', 'K', 'P', 'T', '1'};
+const uint32_t checkpoint_version = 2;                 // 2: 文件头增加了自适应采样的参数.
+const uint32_t checkpoint_byte_order = 0x01020304u;
+const uint32_t checkpoint_variance = 1u;
+const uint32_t checkpoint_features = 2u;
+
+struct checkpoint_header {
+    char magic[8];                              // "RTCHKPT1"
+    uint32_t version;
+    uint32_t byte_order;                        // 0x01020304, 用来识别字节序不同的机器写的文件.
+    uint32_t flags;                             // checkpoint_variance | checkpoint_features
+    uint32_t width;
+    uint32_t height;
+    uint32_t real_size;                         // sizeof(real), 单精度和双精度编译的渲染器不能互相续渲.
+    uint32_t sampler;                           // sampler_type
+    uint32_t seed;
+    int32_t max_depth;
+    int32_t rr_depth;
+    uint32_t light_sampling;
+    uint32_t scene_length;
+    double adaptive_threshold;                  // 自适应采样的参数, 决定每个像素在哪里停止采样. 不是自适应采样时都为0.
+    int32_t min_samples;
+    int32_t max_samples;
+};
+
+static_assert(sizeof(vec3) == 3 * sizeof(real), "checkpoint planes write vec3 as three consecutive reals");
+
+// 一个像素继续渲染所需要的全部状态.
+struct pixel_progress {
+    pixel_estimator estimator;
+    path_features features;                     // 特征的累加值, 不记录特征时为零.
+};
+
+class render_checkpoint {
+    public:
+        // 为opts描述的一次渲染创建检查点, 所有像素都还没有采样.
+        render_checkpoint(const render_options& opts, const int width, const int height);
+
+    public:
+        pixel_progress& at(const int i, const int j) { return pixels[static_cast<size_t>(j) * header.width + i]; }
+        const pixel_progress& at(const int i, const int j) const { return pixels[static_cast<size_t>(j) * header.width + i]; }
+
+        long long total_samples() const;
+        int min_samples() const;                // 采样最少的像素的采样数目.
+
+        /*
+            从path加载. 文件不存在时返回false, error为空, 可以从头开始渲染;
+            文件损坏或者与当前渲染的参数(图像大小, 种子, 场景等)不一致时返回false, 在error中说明原因, 这时不应该覆盖这个文件.
+        */
+        bool load(const std::string& path, std::string& error);
+
+        // 保存到path. 先写入path.tmp再改名, 写到一半被终止时原来的检查点仍然完好.
+        bool save(const std::string& path) const;
+
+    private:
+        checkpoint_header header;               // 当前渲染的参数. flags是保存时写入的内容.
+        std::string scene;
+        std::vector<pixel_progress> pixels;
+};
+
+render_checkpoint::render_checkpoint(const render_options& opts, const int width, const int height)
+    : header{}, scene{opts.scene_path.empty() ? opts.scene_name : opts.scene_path}, pixels(static_cast<size_t>(width) * height) {
+    std::memcpy(header.magic, checkpoint_magic, sizeof(header.magic));
+    header.version = checkpoint_version;
+    header.byte_order = checkpoint_byte_order;
+    if(opts.adaptive_threshold > 0.0 || opts.denoise) header.flags |= checkpoint_variance;
+    if(opts.denoise) header.flags |= checkpoint_features;
+    header.width = static_cast<uint32_t>(width);
+    header.height = static_cast<uint32_t>(height);
+    header.real_size = sizeof(real);
+    header.sampler = static_cast<uint32_t>(opts.sampler_kind);
+    header.seed = opts.seed;
+    header.max_depth = opts.max_depth;
+    header.rr_depth = opts.rr_depth;
+    header.light_sampling = opts.light_sampling ? 1u : 0u;
+    header.scene_length = static_cast<uint32_t>(scene.size());
+    if(opts.adaptive_threshold > 0.0) {
+        header.adaptive_threshold = opts.adaptive_threshold;
+        header.min_samples = opts.min_samples;
+        header.max_samples = opts.max_samples;
+    }
+}
+
+long long render_checkpoint::total_samples() const {
+    long long total = 0;
+    for(const pixel_progress& p : pixels) total += p.estimator.count();
+    return total;
+}
+
+int render_checkpoint::min_samples() const {
+    int result = pixels.empty() ? 0 : pixels[0].estimator.count();
+    for(const pixel_progress& p : pixels) result = std::min(result, p.estimator.count());
+    return result;
+}
+
+bool render_checkpoint::load(const std::string& path, std::string& error) {
+    trace_scope trace("load checkpoint");
+    error.clear();
+    if(!std::ifstream(path, std::ios::binary)) return false;
+    mapped_file file(path);
+    checkpoint_header h;
+    if(!file.is_open() || file.size() < sizeof(h) || std::memcmp(file.data(), checkpoint_magic, sizeof(checkpoint_magic)) != 0) {
+        error = path + " is not a checkpoint";
+        return false;
+    }
+    std::memcpy(&h, file.data(), sizeof(h));
+    if(h.byte_order != checkpoint_byte_order) error = "it was written on a machine with a different byte order";
+    else if(h.version != checkpoint_version) error = "unsupported checkpoint version " + std::to_string(h.version);
+    else if(h.real_size != header.real_size) error = "it was written by a renderer built with a different precision (RT_SINGLE_PRECISION)";
+    else if(h.width != header.width || h.height != header.height)
+        error = "it is " + std::to_string(h.width) + "x" + std::to_string(h.height) + ", not " + std::to_string(header.width) + "x" + std::to_string(header.height);
+    else if(h.seed != header.seed) error = "it was rendered with seed " + std::to_string(h.seed);
+    else if(h.sampler != header.sampler) error = "it was rendered with a different --sampler";
+    else if(h.max_depth != header.max_depth || h.rr_depth != header.rr_depth) error = "it was rendered with a different --max-depth or --rr-depth";
+    else if(h.light_sampling != header.light_sampling) error = "it was rendered with a different light sampling setting";
+    else if(h.adaptive_threshold != header.adaptive_threshold || h.min_samples != header.min_samples)
+        error = "it was rendered with a different --adaptive or --min-spp";
+    else if(h.max_samples > header.max_samples) error = "it was rendered with a larger --max-spp";     // 更大的上限与更大的--spp一样, 只是继续追加采样.
+    else if((header.flags & checkpoint_variance) && !(h.flags & checkpoint_variance)) error = "it has no variance estimates, which --adaptive and --denoise need";
+    else if((header.flags & checkpoint_features) && !(h.flags & checkpoint_features)) error = "it has no feature buffers, which --denoise needs";
+    if(!error.empty()) {
+        error = "Cannot resume from " + path + ": " + error;
+        return false;
+    }
+
+    const size_t n = pixels.size();
+    size_t expected = sizeof(h) + h.scene_length + n * (sizeof(int32_t) + 3 * sizeof(real));
+    if(h.flags & checkpoint_variance) expected += n * 6 * sizeof(real);
+    if(h.flags & checkpoint_features) expected += n * (6 * sizeof(real) + sizeof(double));
+    if(file.size() != expected) {
+        error = path + " is truncated";
+        return false;
+    }
+    const unsigned char* p = file.data() + sizeof(h);
+    const std::string saved_scene(reinterpret_cast<const char*>(p), h.scene_length);
+    if(saved_scene != scene) {
+        error = "Cannot resume from " + path + ": it was rendered from scene " + saved_scene;
+        return false;
+    }
+    p += h.scene_length;
+
+    // 平面的起始位置不一定对齐, 逐个元素用memcpy读取.
+    auto read = [&p](auto& value) {
+        std::memcpy(&value, p, sizeof(value));
+        p += sizeof(value);
+    };
+    auto read_vec3 = [&read](vec3& v) {
+        for(int a = 0; a < 3; ++a) read(v[a]);
+    };
+
+    std::vector<int32_t> counts(n);
+    std::vector<color> sums(n), means(n), m2s(n);
+    for(int32_t& c : counts) read(c);
+    for(color& c : sums) read_vec3(c);
+    if(h.flags & checkpoint_variance) {
+        for(color& c : means) read_vec3(c);
+        for(color& c : m2s) read_vec3(c);
+    }
+    for(size_t k = 0; k < n; ++k)
+        pixels[k].estimator.restore(sums[k], counts[k], means[k], m2s[k]);
+    if(h.flags & checkpoint_features) {
+        for(pixel_progress& px : pixels) read_vec3(px.features.albedo);
+        for(pixel_progress& px : pixels) read_vec3(px.features.normal);
+        for(pixel_progress& px : pixels) read(px.features.depth);
+    }
+    return true;
+}
+
+bool render_checkpoint::save(const std::string& path) const {
+    trace_scope trace("save checkpoint");
+    const std::string temporary = path + ".tmp";
+    {
+        std::ofstream out(temporary, std::ios::binary);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(scene.data(), static_cast<std::streamsize>(scene.size()));
+
+        // 每个平面先复制到连续的缓冲区里再一次写出.
+        auto write_plane = [&out, this](auto value_of) {
+            using value_type = decltype(value_of(pixels[0]));
+            std::vector<value_type> plane(pixels.size());
+            for(size_t k = 0; k < pixels.size(); ++k) plane[k] = value_of(pixels[k]);
+            out.write(reinterpret_cast<const char*>(plane.data()), static_cast<std::streamsize>(plane.size() * sizeof(value_type)));
+        };
+        write_plane([](const pixel_progress& px) { return static_cast<int32_t>(px.estimator.count()); });
+        write_plane([](const pixel_progress& px) { return px.estimator.sum(); });
+        if(header.flags & checkpoint_variance) {
+            write_plane([](const pixel_progress& px) { return px.estimator.running_mean(); });
+            write_plane([](const pixel_progress& px) { return px.estimator.squared_deviations(); });
+        }
+        if(header.flags & checkpoint_features) {
+            write_plane([](const pixel_progress& px) { return px.features.albedo; });
+            write_plane([](const pixel_progress& px) { return px.features.normal; });
+            write_plane([](const pixel_progress& px) { return px.features.depth; });
+        }
+        if(!out.flush()) return false;
+    }
+#ifdef _WIN32
+    std::remove(path.c_str());      // Windows上rename不能覆盖已经存在的文件.
+#endif
+    return std::rename(temporary.c_str(), path.c_str()) == 0;
+}
+
+#endif
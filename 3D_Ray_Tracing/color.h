@@ -3,8 +3,16 @@
 
 #include "utility.h"
 
+#include <cstddef>
+#include <cstdint>
 #include <iostream>
 
+#if defined(__AVX2__)
+    #include <immintrin.h>
+#elif defined(__SSE2__)
+    #include <emmintrin.h>
+#endif
+
 // Using our vec3 class, we'll create a utility function to write a single pixel's color out to the standard output stream.
 // 增加简单的抗锯齿技术, 也就是对每个像素在它的小正方形grid内进行采样. 对所有采样点求均值求得像素值.
 void write_color(std::ostream& out, const color& pixel_color, const int samples_per_pixel) {
@@ -27,4 +35,42 @@ void write_color(std::ostream& out, const color& pixel_color, const int samples_
         << static_cast<int>(256 * clamp(b, 0.0, 0.999)) << '\n';
 }
 
+/*
+    把n个线性颜色分量(已经求过均值)一次性做gamma = 2.0校正, 截断到[0, 0.999]并转换成[0,255]的字节, 与write_color()的计算相同.
+    整幅图像的分量是一个连续的float数组, 每次处理8个分量: 逐分量的sqrt, min, max和截断取整都有对应的SIMD指令,
+    最后把8个32位整数饱和压缩成8个字节. 不支持SIMD的平台使用标量循环.
+    负数和NaN(例如数值误差导致的坏采样)先被max截断为0, 不会因为转换成整数而产生未定义行为.
+*/
+inline void gamma_encode_8bit(const float* linear, uint8_t* out, const size_t n) {
+    size_t k = 0;
+#if defined(__AVX2__)
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 upper = _mm256_set1_ps(0.999f);
+    const __m256 scale = _mm256_set1_ps(256.0f);
+    for(; k + 8 <= n; k += 8) {
+        __m256 v = _mm256_max_ps(_mm256_loadu_ps(linear + k), zero);
+        v = _mm256_mul_ps(_mm256_min_ps(_mm256_sqrt_ps(v), upper), scale);
+        const __m256i q = _mm256_cvttps_epi32(v);
+        const __m128i q16 = _mm_packs_epi32(_mm256_castsi256_si128(q), _mm256_extracti128_si256(q, 1));
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(out + k), _mm_packus_epi16(q16, q16));
+    }
+#elif defined(__SSE2__)
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 upper = _mm_set1_ps(0.999f);
+    const __m128 scale = _mm_set1_ps(256.0f);
+    for(; k + 8 <= n; k += 8) {
+        __m128 v0 = _mm_max_ps(_mm_loadu_ps(linear + k), zero);
+        __m128 v1 = _mm_max_ps(_mm_loadu_ps(linear + k + 4), zero);
+        v0 = _mm_mul_ps(_mm_min_ps(_mm_sqrt_ps(v0), upper), scale);
+        v1 = _mm_mul_ps(_mm_min_ps(_mm_sqrt_ps(v1), upper), scale);
+        const __m128i q16 = _mm_packs_epi32(_mm_cvttps_epi32(v0), _mm_cvttps_epi32(v1));
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(out + k), _mm_packus_epi16(q16, q16));
+    }
+#endif
+    for(; k < n; ++k) {
+        const float v = linear[k] > 0.0f ? std::sqrt(linear[k]) : 0.0f;
+        out[k] = static_cast<uint8_t>(256.0f * (v < 0.999f ? v : 0.999f));
+    }
+}
+
 #endif
\ No newline at end of file
@@ -0,0 +1,262 @@
+#ifndef DENOISER_H
+#define DENOISER_H
+
+#include "framebuffer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#if defined(__AVX2__)
+    #include <immintrin.h>
+#endif
+
+/*
+    denoise: 渲染完成之后的降噪阶段(--denoise), 使用特征引导的edge-avoiding à-trous小波滤波(Dammertz et al. 2010),
+    颜色的权重按照每个像素的方差估计调整(与SVGF, Schied et al. 2017相同).
+
+    蒙特卡洛的像素值是采样的平均, 每像素只有8到16个采样时噪声很大. 相邻像素如果属于同一个表面, 它们的真实颜色往往很接近,
+    把它们加权平均就能去掉大部分噪声; 困难在于不能把不同物体的颜色混到一起, 否则边缘就糊了.
+    渲染时每个像素额外记录第一个非镜面交点的albedo, 法向量和深度(特征缓冲区, 见integrator.h中的path_features), 这些量本身几乎没有噪声,
+    两个像素的特征差别大就说明它们属于不同的表面, 权重随差别指数衰减:
+        w(p, q) = h(q - p) * exp(-|c_p - c_q|^2 / (sigma_c^2 var_p) - |n_p - n_q|^2 / sigma_n^2 - |a_p - a_q|^2 / sigma_a^2 - |z_p - z_q| / (sigma_z * z_p))
+    h是5x5的B3样条核 [1/16, 1/4, 3/8, 1/4, 1/16]. à-trous("带孔")的意思是第k次滤波在核的相邻两个抽头之间空出2^k - 1个像素,
+    5次滤波之后覆盖半径约60像素的范围, 而每次每个像素只看25个邻居.
+    var_p是像素p颜色的方差估计(见pixel_estimator::mean_variance()): 噪声大的像素容许更大的颜色差别, 已经收敛的像素几乎不被改变.
+    每次滤波之后方差也按照 sum(w^2 var) / (sum w)^2 传下去, 于是越往后的滤波只平均越接近的颜色. 固定的sigma_c对暗的场景太松, 对亮的场景又太紧.
+
+    滤波前先把颜色除以albedo(demodulation), 滤波的是照度(irradiance), 之后再乘回albedo. 于是表面的颜色和纹理不会被平均掉, 只有光照的噪声被平均.
+    深度差用相对值, 远处的表面不会因为深度的绝对值大而被误判为边缘.
+
+    每个平面(颜色的每个分量, 方差, 法向量, albedo, 深度)单独存放, 四周填充复制边缘的像素, 于是每个抽头对一行像素的计算是连续的内存访问,
+    AVX2时一次处理8个像素(exp用多项式近似), 否则用标量循环. 图像按行分给num_threads个线程, 每次滤波之间同步一次.
+*/
+struct denoise_options {
+    int iterations = 5;             // 滤波次数. 第k次的抽头间隔为2^k.
+    float sigma_color = 4.0f;       // 照度之差的尺度, 以照度估计的标准差为单位.
+    float sigma_normal = 0.5f;      // 法向量之差的尺度.
+    float sigma_albedo = 0.2f;      // albedo之差的尺度.
+    float sigma_depth = 0.05f;      // 相对深度之差的尺度.
+};
+
+namespace denoise_detail {
+
+    // 平面的编号: 照度三个分量, 照度的方差(三个分量之和), 法向量, albedo, 深度,
+    // 以及每个像素颜色和深度的权重系数 1 / (sigma_c^2 var + eps) 和 1 / (sigma_z * z). 系数只在中心像素上用到.
+    enum plane_index { irr_r, irr_g, irr_b, variance, normal_x, normal_y, normal_z, albedo_r, albedo_g, albedo_b, depth, color_scale, depth_scale, plane_count };
+
+    // exp(-e), e >= 0. 2^x = 2^n * 2^f, f在[0, 1)上用5次多项式近似, 相对误差约1e-5, 作为权重足够.
+    inline float exp_neg(float e) {
+        const float x = -std::min(e, 80.0f) * 1.44269504f;
+        const float n = std::floor(x);
+        const float f = x - n;
+        float p = 1.0f + f*(0.69314718f + f*(0.24022650f + f*(0.05550411f + f*(0.00961813f + f*0.00133336f))));
+        int32_t bits;
+        std::memcpy(&bits, &p, sizeof(bits));
+        bits += static_cast<int32_t>(n) * (1 << 23);
+        std::memcpy(&p, &bits, sizeof(bits));
+        return p;
+    }
+
+#if defined(__AVX2__)
+    inline __m256 exp_neg(const __m256 e) {
+        const __m256 x = _mm256_mul_ps(_mm256_min_ps(e, _mm256_set1_ps(80.0f)), _mm256_set1_ps(-1.44269504f));
+        const __m256 n = _mm256_floor_ps(x);
+        const __m256 f = _mm256_sub_ps(x, n);
+        __m256 p = _mm256_set1_ps(0.00133336f);
+        p = _mm256_add_ps(_mm256_mul_ps(p, f), _mm256_set1_ps(0.00961813f));
+        p = _mm256_add_ps(_mm256_mul_ps(p, f), _mm256_set1_ps(0.05550411f));
+        p = _mm256_add_ps(_mm256_mul_ps(p, f), _mm256_set1_ps(0.24022650f));
+        p = _mm256_add_ps(_mm256_mul_ps(p, f), _mm256_set1_ps(0.69314718f));
+        p = _mm256_add_ps(_mm256_mul_ps(p, f), _mm256_set1_ps(1.0f));
+        const __m256i bits = _mm256_add_epi32(_mm256_castps_si256(p), _mm256_slli_epi32(_mm256_cvtps_epi32(n), 23));
+        return _mm256_castsi256_ps(bits);
+    }
+#endif
+
+    /*
+        一个抽头对一行count个像素的贡献. center[k]是第k个平面上这一行第一个像素的地址, 邻居在center[k] + offset.
+        inv[0], inv[1]分别是1 / sigma_n^2, 1 / sigma_a^2. 结果累加到sum[0..2](照度), sum[3](权重)和sum[4](权重的平方乘方差)中.
+    */
+    inline void accumulate_tap(const float* const* center, const std::ptrdiff_t offset, const int count, const float h, const float* inv, float* const* sum) {
+        int i = 0;
+#if defined(__AVX2__)
+        const __m256 sign_mask = _mm256_set1_ps(-0.0f);
+        const __m256 inv_n = _mm256_set1_ps(inv[0]), inv_a = _mm256_set1_ps(inv[1]);
+        const __m256 kernel = _mm256_set1_ps(h);
+        for(; i + 8 <= count; i += 8) {
+            __m256 q[3];
+            __m256 dc = _mm256_setzero_ps(), dn = _mm256_setzero_ps(), da = _mm256_setzero_ps();
+            for(int k = 0; k < 3; ++k) {
+                q[k] = _mm256_loadu_ps(center[irr_r + k] + i + offset);
+                const __m256 d0 = _mm256_sub_ps(q[k], _mm256_loadu_ps(center[irr_r + k] + i));
+                const __m256 d1 = _mm256_sub_ps(_mm256_loadu_ps(center[normal_x + k] + i + offset), _mm256_loadu_ps(center[normal_x + k] + i));
+                const __m256 d2 = _mm256_sub_ps(_mm256_loadu_ps(center[albedo_r + k] + i + offset), _mm256_loadu_ps(center[albedo_r + k] + i));
+                dc = _mm256_add_ps(dc, _mm256_mul_ps(d0, d0));
+                dn = _mm256_add_ps(dn, _mm256_mul_ps(d1, d1));
+                da = _mm256_add_ps(da, _mm256_mul_ps(d2, d2));
+            }
+            const __m256 dz = _mm256_andnot_ps(sign_mask, _mm256_sub_ps(_mm256_loadu_ps(center[depth] + i + offset), _mm256_loadu_ps(center[depth] + i)));
+            __m256 e = _mm256_add_ps(_mm256_mul_ps(dc, _mm256_loadu_ps(center[color_scale] + i)), _mm256_mul_ps(dn, inv_n));
+            e = _mm256_add_ps(e, _mm256_mul_ps(da, inv_a));
+            e = _mm256_add_ps(e, _mm256_mul_ps(dz, _mm256_loadu_ps(center[depth_scale] + i)));
+            const __m256 w = _mm256_mul_ps(kernel, exp_neg(e));
+            for(int k = 0; k < 3; ++k)
+                _mm256_storeu_ps(sum[k] + i, _mm256_add_ps(_mm256_loadu_ps(sum[k] + i), _mm256_mul_ps(w, q[k])));
+            _mm256_storeu_ps(sum[3] + i, _mm256_add_ps(_mm256_loadu_ps(sum[3] + i), w));
+            const __m256 wv = _mm256_mul_ps(_mm256_mul_ps(w, w), _mm256_loadu_ps(center[variance] + i + offset));
+            _mm256_storeu_ps(sum[4] + i, _mm256_add_ps(_mm256_loadu_ps(sum[4] + i), wv));
+        }
+#endif
+        for(; i < count; ++i) {
+            float dc = 0.0f, dn = 0.0f, da = 0.0f;
+            for(int k = 0; k < 3; ++k) {
+                const float d0 = center[irr_r + k][i + offset] - center[irr_r + k][i];
+                const float d1 = center[normal_x + k][i + offset] - center[normal_x + k][i];
+                const float d2 = center[albedo_r + k][i + offset] - center[albedo_r + k][i];
+                dc += d0 * d0;
+                dn += d1 * d1;
+                da += d2 * d2;
+            }
+            const float dz = std::fabs(center[depth][i + offset] - center[depth][i]);
+            const float w = h * exp_neg(dc * center[color_scale][i] + dn * inv[0] + da * inv[1] + dz * center[depth_scale][i]);
+            for(int k = 0; k < 3; ++k) sum[k][i] += w * center[irr_r + k][i + offset];
+            sum[3][i] += w;
+            sum[4][i] += w * w * center[variance][i + offset];
+        }
+    }
+
+    // 用num_threads个线程对行[0, rows)执行row_function(row, thread_index), 所有行完成后返回.
+    template<typename Function>
+    void parallel_rows(const int num_threads, const int rows, Function&& row_function) {
+        if(num_threads <= 1) {
+            for(int j = 0; j < rows; ++j) row_function(j, 0);
+            return;
+        }
+        std::atomic<int> next_row(0);
+        std::vector<std::thread> workers;
+        for(int t = 0; t < num_threads; ++t) {
+            workers.emplace_back([&, t]() {
+                for(int j = next_row++; j < rows; j = next_row++) row_function(j, t);
+            });
+        }
+        for(std::thread& worker : workers) worker.join();
+    }
+
+}   // namespace denoise_detail
+
+// 对image的颜色降噪, 结果直接写回image. image没有特征缓冲区(没有调用过enable_features())时不做任何事.
+void denoise(framebuffer& image, const int num_threads, const denoise_options& dopts = denoise_options()) {
+    using namespace denoise_detail;
+    if(!image.has_features() || dopts.iterations < 1) return;
+
+    const int width = image.width(), height = image.height();
+    const int pad = 2 << (dopts.iterations - 1);               // 最后一次滤波的抽头最远偏移2 * 2^(iterations-1)个像素.
+    const int stride = width + 2 * pad;
+    const size_t plane_size = static_cast<size_t>(stride) * (height + 2 * pad);
+    std::vector<float> planes(plane_count * plane_size);
+    auto plane = [&](const int k) { return planes.data() + k * plane_size; };
+    auto at = [&](const int k, const int i, const int j) -> float& { return plane(k)[static_cast<size_t>(j + pad) * stride + i + pad]; };
+
+    // 把平面k的内部(已经写好)向四周复制边缘像素.
+    auto fill_border = [&](const int k) {
+        float* p = plane(k);
+        for(int j = pad; j < pad + height; ++j) {
+            float* row = p + static_cast<size_t>(j) * stride;
+            std::fill(row, row + pad, row[pad]);
+            std::fill(row + pad + width, row + stride, row[pad + width - 1]);
+        }
+        for(int j = 0; j < pad; ++j) {
+            std::copy(p + static_cast<size_t>(pad) * stride, p + static_cast<size_t>(pad + 1) * stride, p + static_cast<size_t>(j) * stride);
+            std::copy(p + static_cast<size_t>(pad + height - 1) * stride, p + static_cast<size_t>(pad + height) * stride, p + static_cast<size_t>(pad + height + j) * stride);
+        }
+    };
+
+    // 照度 = 颜色 / albedo, 方差相应地除以albedo^2. albedo很小(例如黑色的表面)时照度没有意义, 限制albedo的下限.
+    const float min_albedo = 0.01f;
+    for(int j = 0; j < height; ++j) {
+        for(int i = 0; i < width; ++i) {
+            const color c = image.average(i, j);
+            const color a = image.albedo(i, j);
+            const color v = image.variance(i, j);
+            const vec3 n = image.normal(i, j);
+            const double z = image.depth(i, j);
+            float var = 0.0f;
+            for(int k = 0; k < 3; ++k) {
+                const float albedo = std::max(min_albedo, static_cast<float>(a[k]));
+                at(albedo_r + k, i, j) = static_cast<float>(a[k]);
+                at(normal_x + k, i, j) = static_cast<float>(n[k]);
+                at(irr_r + k, i, j) = static_cast<float>(c[k]) / albedo;
+                var += static_cast<float>(v[k]) / (albedo * albedo);
+            }
+            at(variance, i, j) = var;
+            at(depth, i, j) = static_cast<float>(z);
+            at(depth_scale, i, j) = 1.0f / (dopts.sigma_depth * std::max(static_cast<float>(z), 1e-3f));
+        }
+    }
+    for(int k = 0; k < plane_count; ++k) fill_border(k);
+
+    const float kernel[5] = {1.0f/16.0f, 1.0f/4.0f, 3.0f/8.0f, 1.0f/4.0f, 1.0f/16.0f};
+    const float inv[2] = {1.0f / (dopts.sigma_normal * dopts.sigma_normal), 1.0f / (dopts.sigma_albedo * dopts.sigma_albedo)};
+    const float sigma_c2 = dopts.sigma_color * dopts.sigma_color;
+    std::vector<float> result(4 * static_cast<size_t>(width) * height);
+    std::vector<std::vector<float>> scratch(std::max(1, num_threads), std::vector<float>(5 * static_cast<size_t>(width)));
+    for(int iteration = 0; iteration < dopts.iterations; ++iteration) {
+        const int step = 1 << iteration;
+        // 16个左右采样的方差估计本身噪声很大, 先用3x3的高斯核平滑一下再用.
+        for(int j = 0; j < height; ++j) {
+            for(int i = 0; i < width; ++i) {
+                float var = 0.0f;
+                for(int dy = -1; dy <= 1; ++dy)
+                    for(int dx = -1; dx <= 1; ++dx)
+                        var += (dx == 0 ? 0.5f : 0.25f) * (dy == 0 ? 0.5f : 0.25f) * at(variance, i + dx, j + dy);
+                at(color_scale, i, j) = 1.0f / (sigma_c2 * var + 1e-6f);
+            }
+        }
+
+        parallel_rows(num_threads, height, [&](const int j, const int thread_index) {
+            std::vector<float>& s = scratch[thread_index];
+            std::fill(s.begin(), s.end(), 0.0f);
+            float* sum[5];
+            for(int k = 0; k < 5; ++k) sum[k] = s.data() + k * static_cast<size_t>(width);
+            const float* center[plane_count];
+            for(int k = 0; k < plane_count; ++k) center[k] = &at(k, 0, j);
+            for(int dy = -2; dy <= 2; ++dy)
+                for(int dx = -2; dx <= 2; ++dx)
+                    accumulate_tap(center, (static_cast<std::ptrdiff_t>(dy) * stride + dx) * step, width, kernel[dx + 2] * kernel[dy + 2], inv, sum);
+            // 中心抽头的权重是h(0) > 0, 所以权重之和不会为0. 加权平均的方差是 sum(w^2 var) / (sum w)^2.
+            float* out = &result[4 * static_cast<size_t>(j) * width];
+            for(int i = 0; i < width; ++i) {
+                const float inv_w = 1.0f / sum[3][i];
+                for(int k = 0; k < 3; ++k) out[4*i + k] = sum[k][i] * inv_w;
+                out[4*i + 3] = sum[4][i] * inv_w * inv_w;
+            }
+        });
+        // 这次的结果作为下一次的输入. 所有行都滤波完之后才能覆盖, 否则其他行读到的邻居就是已经滤波过的值.
+        for(int j = 0; j < height; ++j) {
+            for(int i = 0; i < width; ++i) {
+                const float* r = &result[4 * (static_cast<size_t>(j) * width + i)];
+                for(int k = 0; k < 3; ++k) at(irr_r + k, i, j) = r[k];
+                at(variance, i, j) = r[3];
+            }
+        }
+        for(int k = irr_r; k <= variance; ++k) fill_border(k);
+    }
+
+    // 乘回albedo.
+    for(int j = 0; j < height; ++j) {
+        for(int i = 0; i < width; ++i) {
+            color c;
+            for(int k = 0; k < 3; ++k)
+                c[k] = at(irr_r + k, i, j) * std::max(min_albedo, at(albedo_r + k, i, j));
+            image.set_average(i, j, c);
+        }
+    }
+}
+
+#endif
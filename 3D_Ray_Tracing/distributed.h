@@ -0,0 +1,488 @@
+#ifndef DISTRIBUTED_H
+#define DISTRIBUTED_H
+
+#include "adaptive_sampling.h"
+#include "camera.h"
+#include "checkpoint.h"
+#include "framebuffer.h"
+#include "light.h"
+#include "render_options.h"
+#include "render_stats.h"
+#include "renderer.h"
+#include "surface.h"
+#include "tile_scheduler.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#ifndef _WIN32
+    #include <cerrno>
+    #include <csignal>
+    #include <fcntl.h>
+    #include <poll.h>
+    #include <sys/types.h>
+    #include <sys/wait.h>
+    #include <unistd.h>
+#endif
+
+/*
+    多进程分布式渲染.
+
+    coordinator(--workers N 或者 --worker-command CMD)启动若干个worker进程, 通过管道与它们通信: 向worker的标准输入写入tile任务,
+    从worker的标准输出读回结果. worker就是以--worker参数运行的同一个程序, 它自己加载同一个场景, 用与render_frame相同的render_tile()
+    完整地渲染每个收到的tile, 把tile中每个像素的状态(pixel_progress: 颜色累加值, 采样数, 方差和特征)原样发回.
+    coordinator把它们写入自己的framebuffer. 采样器是基于计数器的, 像素在哪个进程中渲染结果都相同, 所以分布式渲染的图像与单进程渲染逐位相同.
+
+    --worker-command CMD通过/bin/sh启动worker, 在CMD之后追加worker的参数, 例如 --worker-command "ssh render2 ./rayTracerMain"
+    在另一台机器上运行worker(那台机器上要有同一个程序和同样的场景文件), ssh的标准输入输出就是管道.
+
+    容错: 每个worker同时最多有两个tile在途(一个在渲染, 一个在排队, 省掉一次往返的等待).
+        1. worker退出或者管道断开时, 它在途的tile重新放回队列, 交给其他worker;
+        2. worker在opts.worker_timeout秒内既没有完成当前的tile也没有发来握手时, 认为它已经卡死, 杀掉它并重新分配它的tile;
+        3. 队列空了之后, 空闲的worker再领取一份别的worker还在渲染的tile(最多两份), 先返回的结果有效, 慢的worker不会拖住最后几个tile;
+        4. 所有worker都失败时, coordinator自己渲染剩下的tile.
+
+    协议(字节序和real的精度与coordinator相同, 握手时检查):
+        worker -> coordinator: worker_hello, 之后每个tile一个tile_result加上tile中每个像素的pixel_progress
+        coordinator -> worker: 每个tile一个tile_job; 关闭管道表示没有更多任务, worker退出.
+    每个tile的结果最后附带渲染这个tile的render_counters(见render_stats.h), coordinator把收到的每一份(包括重复的tile)都合并到自己的统计中,
+    统计的是实际做过的工作; 被杀掉的worker只丢失在途tile的计数.
+    只在POSIX系统上实现(fork, pipe, poll).
+*/
+const char worker_magic[8] = {'R', 'T', 'W', 'O', 'R', 'K', 'E', 'R'};
+const uint32_t worker_protocol_version = 2;
+
+struct worker_hello {
+    char magic[8];                              // "RTWORKER"
+    uint32_t version;
+    uint32_t byte_order;                        // checkpoint_byte_order
+    uint32_t record_size;                       // sizeof(pixel_progress), 同时检查了real的精度.
+    uint32_t width;
+    uint32_t height;
+    uint32_t reserved;
+};
+
+struct tile_job {
+    int32_t index;
+    int32_t x0, y0;
+    int32_t x1, y1;
+};
+
+struct tile_result {
+    int32_t index;
+    uint32_t pixel_count;                       // 之后是pixel_count个pixel_progress和一个render_counters.
+};
+
+static_assert(std::is_trivially_copyable<pixel_progress>::value, "pixel_progress is sent to the coordinator as raw bytes");
+static_assert(std::is_trivially_copyable<render_counters>::value, "render_counters is sent to the coordinator as raw bytes");
+
+// worker的命令行参数: 决定渲染结果的参数与coordinator相同.
+inline std::vector<std::string> worker_arguments(const render_options& opts) {
+    auto text = [](const double v) {
+        std::ostringstream out;
+        out.precision(17);
+        out << v;
+        return out.str();
+    };
+    std::vector<std::string> args = {"--worker", "--width", std::to_string(opts.image_width), "--seed", std::to_string(opts.seed),
+                                     "--spp", std::to_string(opts.samples_per_pixel), "--max-depth", std::to_string(opts.max_depth),
+                                     "--rr-depth", std::to_string(opts.rr_depth), "--sampler", opts.sampler_kind == sampler_type::sobol ? "sobol" : "independent"};
+    if(opts.scene_path.empty()) args.insert(args.end(), {"--scene", opts.scene_name});
+    else args.insert(args.end(), {"--scene-file", opts.scene_path});
+    if(!opts.light_sampling) args.push_back("--no-light-sampling");
+    if(opts.denoise) args.push_back("--denoise");
+    if(opts.adaptive_threshold > 0.0)
+        args.insert(args.end(), {"--adaptive", text(opts.adaptive_threshold), "--min-spp", std::to_string(opts.min_samples), "--max-spp", std::to_string(opts.max_samples)});
+    return args;
+}
+
+#ifndef _WIN32
+
+// 读满或者写完bytes字节. 对方关闭管道或者出错时返回false.
+inline bool read_fully(const int fd, void* data, size_t bytes) {
+    char* p = static_cast<char*>(data);
+    while(bytes > 0) {
+        const ssize_t n = ::read(fd, p, bytes);
+        if(n < 0 && errno == EINTR) continue;
+        if(n <= 0) return false;
+        p += n;
+        bytes -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+inline bool write_fully(const int fd, const void* data, size_t bytes) {
+    const char* p = static_cast<const char*>(data);
+    while(bytes > 0) {
+        const ssize_t n = ::write(fd, p, bytes);
+        if(n < 0 && errno == EINTR) continue;
+        if(n <= 0) return false;
+        p += n;
+        bytes -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+/*
+    run_worker: worker进程的主循环. 先发送握手, 然后从标准输入逐个读取tile_job, 渲染之后把结果写到标准输出, 直到标准输入被关闭.
+    每个worker单线程渲染, 要用满一台机器的所有核, 就在这台机器上启动与核数相同的worker.
+*/
+int run_worker(const surface& world, const light_list& lights, const camera& cam, const render_options& opts, const int image_width, const int image_height) {
+    worker_hello hello = {};
+    std::memcpy(hello.magic, worker_magic, sizeof(hello.magic));
+    hello.version = worker_protocol_version;
+    hello.byte_order = checkpoint_byte_order;
+    hello.record_size = sizeof(pixel_progress);
+    hello.width = static_cast<uint32_t>(image_width);
+    hello.height = static_cast<uint32_t>(image_height);
+    if(!write_fully(STDOUT_FILENO, &hello, sizeof(hello))) return 1;
+
+    std::vector<pixel_progress> state;
+    tile_job job;
+    while(read_fully(STDIN_FILENO, &job, sizeof(job))) {
+        const tile tl = {job.x0, job.y0, job.x1, job.y1, job.index};
+        state.assign(static_cast<size_t>(tl.x1 - tl.x0) * (tl.y1 - tl.y0), pixel_progress{});
+        global_counters().reset();              // worker单线程渲染, 清零之后的计数就是这个tile的计数.
+        render_tile(world, lights, cam, opts, image_width, image_height, opts.denoise, tl, state.data(), 0);
+        const render_counters counters = global_counters().total();
+
+        const tile_result result = {job.index, static_cast<uint32_t>(state.size())};
+        if(!write_fully(STDOUT_FILENO, &result, sizeof(result)) || !write_fully(STDOUT_FILENO, state.data(), state.size() * sizeof(pixel_progress))
+           || !write_fully(STDOUT_FILENO, &counters, sizeof(counters)))
+            return 1;
+    }
+    return 0;
+}
+
+// coordinator一侧的一个worker进程.
+struct worker_process {
+    pid_t pid = -1;
+    int to_worker = -1;                         // worker的标准输入.
+    int from_worker = -1;                       // worker的标准输出.
+    std::string name;
+    std::vector<unsigned char> received;        // 收到但还没有处理完的字节.
+    bool ready = false;                         // 已经收到握手.
+    std::deque<int> in_flight;                  // 已经发出还没有收到结果的tile, 按照发出的顺序.
+    std::chrono::steady_clock::time_point deadline;     // 握手或者in_flight.front()的结果最晚到达的时间.
+    int32_t track = 0;                          // 开启--trace时这个worker在时间线上的轨道.
+    int64_t busy_since = 0;                     // in_flight.front()开始渲染的时间(trace时钟): 发出时worker空闲, 则是发出的时间, 否则是上一个结果到达的时间.
+};
+
+/*
+    启动一个worker进程. command为空时直接执行program, 否则执行 /bin/sh -c "command 参数...".
+    管道的文件描述符都设置了close-on-exec, 后启动的worker不会继承前面worker的管道, 否则关闭管道时前面的worker收不到EOF.
+    子进程自成一个进程组, 杀掉整个组时/bin/sh包装和它启动的真正的worker(ssh等)一起结束, 不会留下孤儿进程.
+*/
+inline bool spawn_worker(const std::string& program, const std::string& command, const std::vector<std::string>& args, worker_process& w) {
+    int to_child[2], from_child[2];
+    if(::pipe(to_child) != 0) return false;
+    if(::pipe(from_child) != 0) {
+        ::close(to_child[0]);
+        ::close(to_child[1]);
+        return false;
+    }
+    for(const int fd : {to_child[0], to_child[1], from_child[0], from_child[1]})
+        ::fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+    std::string shell_command = command;
+    for(const std::string& a : args) {
+        shell_command += " '";
+        for(const char c : a) shell_command += c == '\'' ? std::string("'\\''") : std::string(1, c);
+        shell_command += '\'';
+    }
+
+    const pid_t pid = ::fork();
+    if(pid == 0) {
+        // 子进程: 把管道接到标准输入输出上(dup2得到的描述符不带close-on-exec), 然后执行worker.
+        ::setpgid(0, 0);
+        ::dup2(to_child[0], STDIN_FILENO);
+        ::dup2(from_child[1], STDOUT_FILENO);
+        if(command.empty()) {
+            std::vector<char*> argv;
+            argv.push_back(const_cast<char*>(program.c_str()));
+            for(const std::string& a : args) argv.push_back(const_cast<char*>(a.c_str()));
+            argv.push_back(nullptr);
+            ::execv(program.c_str(), argv.data());
+        }
+        else
+            ::execl("/bin/sh", "sh", "-c", shell_command.c_str(), static_cast<char*>(nullptr));
+        ::_exit(127);
+    }
+    ::close(to_child[0]);
+    ::close(from_child[1]);
+    if(pid > 0) ::setpgid(pid, pid);            // 父进程也设置一次, 避免在子进程设置之前就要杀掉它的竞争.
+    if(pid < 0) {
+        ::close(to_child[1]);
+        ::close(from_child[0]);
+        return false;
+    }
+    w.pid = pid;
+    w.to_worker = to_child[1];
+    w.from_worker = from_child[0];
+    w.name = command.empty() ? "local worker " + std::to_string(pid) : command + " (" + std::to_string(pid) + ")";
+    return true;
+}
+
+/*
+    关闭worker的管道并等待它退出. kill为true时先杀掉它的整个进程组.
+    不杀的worker读到EOF之后应该立刻退出; 最多等待一秒, 仍然没有退出(例如卡住的ssh)就杀掉, coordinator不会因此卡住.
+*/
+inline void stop_worker(worker_process& w, const bool kill) {
+    if(w.pid < 0) return;
+    if(kill) ::kill(-w.pid, SIGKILL);
+    if(w.to_worker >= 0) ::close(w.to_worker);
+    if(w.from_worker >= 0) ::close(w.from_worker);
+    bool reaped = false;
+    for(int k = 0; k < 100 && !kill && !reaped; ++k) {
+        reaped = ::waitpid(w.pid, nullptr, WNOHANG) != 0;
+        if(!reaped) ::usleep(10000);
+    }
+    if(!reaped) {
+        ::kill(-w.pid, SIGKILL);
+        ::waitpid(w.pid, nullptr, 0);
+    }
+    w.pid = -1;
+    w.to_worker = w.from_worker = -1;
+}
+
+// 当前可执行文件的路径. Linux上读/proc/self/exe, 否则使用argv[0].
+inline std::string current_executable(const char* argv0) {
+    char path[4096];
+    const ssize_t n = ::readlink("/proc/self/exe", path, sizeof(path) - 1);
+    if(n > 0) return std::string(path, static_cast<size_t>(n));
+    return argv0;
+}
+
+/*
+    render_frame_distributed: coordinator. 启动opts.num_workers个本地worker和opts.worker_commands中的每一个命令, 把图像的所有tile分给它们渲染,
+    结果写入image, 采样数统计写入stats. program是argv[0]. 无法启动任何worker时返回false, 错误信息写入error.
+*/
+bool render_frame_distributed(const surface& world, const light_list& lights, const camera& cam, const render_options& opts, const char* program,
+                              framebuffer& image, sampling_stats& stats, std::string& error) {
+    using clock = std::chrono::steady_clock;
+    ::signal(SIGPIPE, SIG_IGN);                 // 向已经退出的worker写任务时得到EPIPE错误, 而不是终止coordinator.
+
+    const tile_scheduler scheduler(image.width(), image.height(), opts.tile_size);
+    const std::vector<tile>& tiles = scheduler.tiles();
+    const auto timeout = std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(opts.worker_timeout));
+    const bool features = image.has_features();
+
+    const std::string executable = current_executable(program);
+    const std::vector<std::string> args = worker_arguments(opts);
+    std::vector<worker_process> workers;
+    std::vector<std::string> commands(static_cast<size_t>(opts.num_workers));
+    commands.insert(commands.end(), opts.worker_commands.begin(), opts.worker_commands.end());
+    for(const std::string& command : commands) {
+        worker_process w;
+        if(spawn_worker(executable, command, args, w)) {
+            w.deadline = clock::now() + timeout;
+            if(global_trace().enabled()) w.track = global_trace().add_track(w.name);
+            workers.push_back(std::move(w));
+        }
+        else
+            std::cerr << "Cannot start worker " << (command.empty() ? executable : command) << ".\n";
+    }
+    if(workers.empty()) {
+        error = "Cannot start any worker";
+        return false;
+    }
+
+    std::deque<int> pending;                    // 还没有分配出去的tile.
+    for(const tile& tl : tiles) pending.push_back(tl.index);
+    std::vector<char> done(tiles.size(), 0);
+    std::vector<int> copies(tiles.size(), 0);   // 每个tile当前在途的份数.
+    int remaining = static_cast<int>(tiles.size());
+
+    // worker失败: 杀掉它, 把它在途而且还没有完成的tile放回队列的前面.
+    auto lose = [&](worker_process& w, const char* reason) {
+        int reissued = 0;
+        for(auto it = w.in_flight.rbegin(); it != w.in_flight.rend(); ++it) {
+            if(--copies[*it] == 0 && !done[*it]) {
+                pending.push_front(*it);
+                ++reissued;
+            }
+        }
+        w.in_flight.clear();
+        std::cerr << "\n" << w.name << ' ' << reason << ", re-issuing " << reissued << " tiles.\n";
+        stop_worker(w, true);
+    };
+
+    auto assign = [&](worker_process& w, const int id) {
+        const tile& tl = tiles[id];
+        const tile_job job = {tl.index, tl.x0, tl.y0, tl.x1, tl.y1};
+        if(w.in_flight.empty()) {
+            w.deadline = clock::now() + timeout;
+            w.busy_since = global_trace().now();
+        }
+        w.in_flight.push_back(id);
+        ++copies[id];
+        if(!write_fully(w.to_worker, &job, sizeof(job))) lose(w, "closed its input");
+    };
+
+    // 处理已经收到的字节: 握手以及完整的tile结果.
+    auto process = [&](worker_process& w) {
+        size_t offset = 0;
+        while(w.pid >= 0) {
+            const size_t available = w.received.size() - offset;
+            const unsigned char* p = w.received.data() + offset;
+            if(!w.ready) {
+                if(available < sizeof(worker_hello)) break;
+                worker_hello hello;
+                std::memcpy(&hello, p, sizeof(hello));
+                if(std::memcmp(hello.magic, worker_magic, sizeof(hello.magic)) != 0 || hello.version != worker_protocol_version || hello.byte_order != checkpoint_byte_order
+                   || hello.record_size != sizeof(pixel_progress) || hello.width != static_cast<uint32_t>(image.width()) || hello.height != static_cast<uint32_t>(image.height())) {
+                    lose(w, "is not a compatible worker");
+                    return;
+                }
+                w.ready = true;
+                offset += sizeof(hello);
+                continue;
+            }
+            if(available < sizeof(tile_result)) break;
+            tile_result result;
+            std::memcpy(&result, p, sizeof(result));
+            if(w.in_flight.empty() || result.index != w.in_flight.front()
+               || result.pixel_count != static_cast<uint32_t>((tiles[result.index].x1 - tiles[result.index].x0) * (tiles[result.index].y1 - tiles[result.index].y0))) {
+                lose(w, "sent an unexpected result");
+                return;
+            }
+            const size_t bytes = sizeof(result) + result.pixel_count * sizeof(pixel_progress) + sizeof(render_counters);
+            if(available < bytes) break;
+
+            const int id = result.index;
+            w.in_flight.pop_front();
+            w.deadline = clock::now() + timeout;
+            --copies[id];
+            render_counters counters;
+            std::memcpy(&counters, p + bytes - sizeof(counters), sizeof(counters));
+            thread_counters().merge(counters);
+            if(w.track > 0) {
+                // worker在另一个进程中, 时间线上的tile由coordinator按照结果到达的时间记录.
+                const int64_t now = global_trace().now();
+                trace_record("tile", w.busy_since, now - w.busy_since, "tile", id, w.track);
+                w.busy_since = now;
+            }
+            if(!done[id]) {             // 同一个tile的多份结果完全相同, 只用先到的那一份.
+                std::vector<pixel_progress> state(result.pixel_count);
+                std::memcpy(state.data(), p + sizeof(result), result.pixel_count * sizeof(pixel_progress));
+                store_tile(opts, tiles[id], state.data(), features, image, stats);
+                done[id] = 1;
+                --remaining;
+                print_tiles_remaining(remaining);
+            }
+            offset += bytes;
+        }
+        w.received.erase(w.received.begin(), w.received.begin() + static_cast<std::ptrdiff_t>(std::min(offset, w.received.size())));
+    };
+
+    while(remaining > 0) {
+        // 分配任务. 队列空了之后, 空闲的worker领取在途最久的tile的第二份.
+        for(worker_process& w : workers) {
+            while(w.pid >= 0 && w.ready && w.in_flight.size() < 2) {
+                while(!pending.empty() && done[pending.front()]) pending.pop_front();
+                if(!pending.empty()) {
+                    const int id = pending.front();
+                    pending.pop_front();
+                    assign(w, id);
+                    continue;
+                }
+                if(!w.in_flight.empty()) break;
+                // 选择最早该交回结果的worker手中还只有一份的tile, 包括它排在后面的那一个.
+                int straggler = -1;
+                clock::time_point earliest = clock::time_point::max();
+                for(const worker_process& other : workers) {
+                    if(other.pid < 0 || other.deadline >= earliest) continue;
+                    for(const int id : other.in_flight) {
+                        if(copies[id] < 2 && !done[id]) {
+                            straggler = id;
+                            earliest = other.deadline;
+                            break;
+                        }
+                    }
+                }
+                if(straggler < 0) break;
+                assign(w, straggler);
+            }
+        }
+
+        std::vector<pollfd> fds;
+        std::vector<worker_process*> polled;
+        for(worker_process& w : workers) {
+            if(w.pid < 0) continue;
+            fds.push_back({w.from_worker, POLLIN, 0});
+            polled.push_back(&w);
+        }
+        if(fds.empty()) break;                  // 所有worker都失败了.
+
+        int ready;
+        {
+            trace_scope trace("wait for workers");
+            ready = ::poll(fds.data(), fds.size(), 100);
+        }
+        if(ready < 0 && errno != EINTR) {
+            error = "poll failed";
+            break;
+        }
+        for(size_t k = 0; k < fds.size(); ++k) {
+            worker_process& w = *polled[k];
+            if(fds[k].revents & (POLLIN | POLLHUP | POLLERR)) {
+                unsigned char buffer[65536];
+                const ssize_t n = ::read(w.from_worker, buffer, sizeof(buffer));
+                if(n <= 0) {
+                    if(n < 0 && errno == EINTR) continue;
+                    lose(w, "exited");
+                    continue;
+                }
+                w.received.insert(w.received.end(), buffer, buffer + n);
+                process(w);
+            }
+            if(w.pid >= 0 && (!w.ready || !w.in_flight.empty()) && clock::now() > w.deadline)
+                lose(w, "timed out");
+        }
+    }
+    // 空闲的worker读到EOF之后自己退出; 还没有完成握手的和手里还有tile的(慢的, 卡死的)直接杀掉, 不等它们.
+    for(worker_process& w : workers) stop_worker(w, !w.ready || !w.in_flight.empty());
+
+    // 所有worker都失败之后, 剩下的tile由coordinator自己渲染.
+    if(remaining > 0 && error.empty()) {
+        std::cerr << "\nNo workers left, rendering the remaining " << remaining << " tiles locally.\n";
+        std::vector<pixel_progress> state;
+        for(const tile& tl : tiles) {
+            if(done[tl.index]) continue;
+            trace_scope trace("tile", "tile", tl.index);
+            state.assign(static_cast<size_t>(tl.x1 - tl.x0) * (tl.y1 - tl.y0), pixel_progress{});
+            render_tile(world, lights, cam, opts, image.width(), image.height(), features, tl, state.data(), 0);
+            store_tile(opts, tl, state.data(), features, image, stats);
+            done[tl.index] = 1;
+            --remaining;
+        }
+    }
+    std::cerr << '\n';
+    return error.empty();
+}
+
+#else
+
+int run_worker(const surface&, const light_list&, const camera&, const render_options&, const int, const int) {
+    std::cerr << "--worker is not supported on Windows.\n";
+    return 1;
+}
+
+bool render_frame_distributed(const surface&, const light_list&, const camera&, const render_options&, const char*, framebuffer&, sampling_stats&, std::string& error) {
+    error = "Distributed rendering is not supported on Windows";
+    return false;
+}
+
+#endif
+
+#endif
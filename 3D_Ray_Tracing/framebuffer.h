@@ -0,0 +1,180 @@
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+#include "color.h"
+
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+// 输出图像的格式. ppm: P6二进制ppm, 8位gamma校正之后的颜色; pfm: 32位浮点的线性颜色(HDR), 不做截断.
+enum class image_format { ppm, pfm };
+
+/*
+    framebuffer: 整幅渲染图像共享的像素缓冲区.
+    多线程渲染时, 每个工作线程只写入自己所领取tile内的像素, 不同tile的像素区域互不重叠, 因此无需加锁.
+    所有tile渲染完成后, 再一次性输出整幅图像.
+
+    像素坐标(i,j)沿用main()中的约定: i是w轴坐标[0, width-1], j是h轴坐标[0, height-1], j = 0 是图像最下面一行.
+    缓冲区保存的是所有采样颜色的累加值以及每个像素实际的采样数目(自适应采样时各像素的采样数不同), 求均值和gamma校正都放在输出时完成.
+
+    累加值以float存放, 每个像素3个分量连续存放, 整幅图像是一个连续的float数组.
+    最初的实现对每个像素调用write_color(), 通过std::ostream格式化输出三个整数(P3文本格式), 4K图像的格式化和IO本身就要花不少时间, 文件也很大.
+    现在先对整个缓冲区求均值, 再用SIMD一次完成gamma校正和截断, 最后一次性写出P6二进制ppm, 或者直接写出保留HDR信息的PFM.
+*/
+class framebuffer {
+    public:
+        // parameter constructor.
+        framebuffer(const int w, const int h) : image_width{w}, image_height{h}, accum(3 * static_cast<size_t>(w) * h, 0.0f), sample_counts(static_cast<size_t>(w) * h, 0) {}
+
+    public:
+        int width() const { return image_width; }
+        int height() const { return image_height; }
+
+        // 写入像素(i,j)的采样累加值和采样数目.
+        void set(const int i, const int j, const color& sum, const int samples) {
+            const size_t k = index(i, j);
+            accum[3*k]     = static_cast<float>(sum.x());
+            accum[3*k + 1] = static_cast<float>(sum.y());
+            accum[3*k + 2] = static_cast<float>(sum.z());
+            sample_counts[k] = samples;
+        }
+
+        color sum(const int i, const int j) const {
+            const size_t k = index(i, j);
+            return color(accum[3*k], accum[3*k + 1], accum[3*k + 2]);
+        }
+        int samples(const int i, const int j) const { return sample_counts[index(i, j)]; }
+
+        /*
+            特征缓冲区(feature buffers): 每个像素所有采样的第一个非镜面交点的albedo, 法向量和深度(见integrator.h中的path_features),
+            以及像素均值的方差估计, 供降噪使用. 只有调用过enable_features()之后才分配和写入.
+            albedo, 法向量和深度与颜色一样保存累加值, 读取时除以采样数目; 方差直接保存.
+        */
+        void enable_features() {
+            const size_t n = static_cast<size_t>(image_width) * image_height;
+            albedo_accum.assign(3 * n, 0.0f);
+            normal_accum.assign(3 * n, 0.0f);
+            depth_accum.assign(n, 0.0f);
+            variances.assign(3 * n, 0.0f);
+        }
+        bool has_features() const { return !depth_accum.empty(); }
+
+        // 写入像素(i,j)特征的累加值和像素均值的方差(见pixel_estimator::mean_variance()), 采样数目与set()写入的相同.
+        void set_features(const int i, const int j, const color& albedo_sum, const vec3& normal_sum, const double depth_sum, const color& variance) {
+            const size_t k = index(i, j);
+            for(int a = 0; a < 3; ++a) {
+                albedo_accum[3*k + a] = static_cast<float>(albedo_sum[a]);
+                normal_accum[3*k + a] = static_cast<float>(normal_sum[a]);
+                variances[3*k + a] = static_cast<float>(variance[a]);
+            }
+            depth_accum[k] = static_cast<float>(depth_sum);
+        }
+
+        color albedo(const int i, const int j) const { return feature_average(albedo_accum, i, j); }
+        vec3 normal(const int i, const int j) const { return feature_average(normal_accum, i, j); }
+        color variance(const int i, const int j) const {
+            const size_t k = index(i, j);
+            return color(variances[3*k], variances[3*k + 1], variances[3*k + 2]);
+        }
+        double depth(const int i, const int j) const {
+            const int n = samples(i, j);
+            return n > 0 ? depth_accum[index(i, j)] / n : 0.0;
+        }
+
+        // 用线性颜色c代替像素(i,j)的颜色, 采样数目不变. 降噪之后写回结果时使用.
+        void set_average(const int i, const int j, const color& c) {
+            const size_t k = index(i, j);
+            const float n = static_cast<float>(sample_counts[k]);
+            accum[3*k]     = static_cast<float>(c.x()) * n;
+            accum[3*k + 1] = static_cast<float>(c.y()) * n;
+            accum[3*k + 2] = static_cast<float>(c.z()) * n;
+        }
+
+        // 像素(i,j)所有采样的均值, 即线性(未做gamma校正)的像素颜色.
+        color average(const int i, const int j) const {
+            const int n = samples(i, j);
+            return n > 0 ? sum(i, j) / n : color(0.0, 0.0, 0.0);
+        }
+
+        // 输出P6格式的二进制ppm图像, 行的顺序与原来的P3输出相同(从上到下, 从左到右), 像素值也与write_color()的计算相同.
+        void write_ppm(std::ostream& out) const {
+            const std::vector<float> linear = averages(true);
+            std::vector<uint8_t> bytes(linear.size());
+            gamma_encode_8bit(linear.data(), bytes.data(), linear.size());
+
+            out << "P6\n" << image_width << ' ' << image_height << "\n255\n";
+            out.write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+        }
+
+        // 输出PFM格式的浮点图像. 比例因子为负表示little-endian; PFM的行顺序是从下到上, 正好与缓冲区的存放顺序一致.
+        void write_pfm(std::ostream& out) const {
+            const std::vector<float> linear = averages(false);
+            std::vector<char> bytes(linear.size() * sizeof(float));
+            if(is_little_endian())
+                std::memcpy(bytes.data(), linear.data(), bytes.size());
+            else {
+                for(size_t k = 0; k < linear.size(); ++k) {
+                    uint32_t v;
+                    std::memcpy(&v, &linear[k], sizeof(v));
+                    for(int b = 0; b < 4; ++b)
+                        bytes[4*k + b] = static_cast<char>((v >> (8*b)) & 0xffu);
+                }
+            }
+
+            out << "PF\n" << image_width << ' ' << image_height << "\n-1.0\n";
+            out.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+        }
+
+        void write(std::ostream& out, const image_format format) const {
+            if(format == image_format::pfm) write_pfm(out);
+            else write_ppm(out);
+        }
+
+    private:
+        size_t index(const int i, const int j) const { return static_cast<size_t>(j) * image_width + i; }
+
+        // 返回所有像素的均值, 每个像素3个float. top_down为true时按照从上到下的行顺序排列.
+        std::vector<float> averages(const bool top_down) const {
+            std::vector<float> linear(accum.size());
+            for(int row = 0; row < image_height; ++row) {
+                const int j = top_down ? image_height - 1 - row : row;
+                const float* src = &accum[3 * index(0, j)];
+                const int* n = &sample_counts[index(0, j)];
+                float* dst = &linear[3 * static_cast<size_t>(row) * image_width];
+                for(int i = 0; i < image_width; ++i) {
+                    const float scale = n[i] > 0 ? 1.0f / n[i] : 0.0f;
+                    dst[3*i]     = src[3*i] * scale;
+                    dst[3*i + 1] = src[3*i + 1] * scale;
+                    dst[3*i + 2] = src[3*i + 2] * scale;
+                }
+            }
+            return linear;
+        }
+
+        vec3 feature_average(const std::vector<float>& feature, const int i, const int j) const {
+            const size_t k = index(i, j);
+            const int n = sample_counts[k];
+            return n > 0 ? vec3(feature[3*k], feature[3*k + 1], feature[3*k + 2]) / n : vec3(0.0, 0.0, 0.0);
+        }
+
+        static bool is_little_endian() {
+            const uint32_t one = 1u;
+            unsigned char first;
+            std::memcpy(&first, &one, 1);
+            return first == 1;
+        }
+
+    private:
+        int image_width;
+        int image_height;
+        std::vector<float> accum;           // 行优先存储, 第j行第i列像素的三个分量下标为3*(j*width + i) + 0,1,2.
+        std::vector<int> sample_counts;
+        std::vector<float> albedo_accum;    // 特征缓冲区, 与accum的存放方式相同. 没有调用enable_features()时为空.
+        std::vector<float> normal_accum;
+        std::vector<float> depth_accum;     // 每个像素一个分量.
+        std::vector<float> variances;
+};
+
+#endif
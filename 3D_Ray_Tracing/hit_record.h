@@ -1,8 +1,6 @@
 #include "vec3.h"
 #include "ray.h"
 
-#include <memory>
-
 /*
     非完整类型的使用情景有限但能使用的场景却价值独特:
         1. 非完整类型的类可以定义指向这种类型的指针和引用(但不能够定义该类的对象).
@@ -34,7 +32,9 @@ struct hit_record {     // hit_record is just a way to stuff a bunch of argument
 
     // 用一个指针记录相交点的材质. 
     // 特别注意, material只有声明没有定义, 必然是incomplete type. 因此必须只能用指针而无法实例化对象.
-    std::shared_ptr<material> mat_ptr;   
+    // 材质由场景的材质表material_table统一持有, 这里只是一个不拥有所有权的普通指针.
+    // 如果用std::shared_ptr, 那么每次求交成功赋值以及每次拷贝hit_record都是一次原子的引用计数加减, 多线程渲染时所有线程都在争抢同一个控制块的cache line.
+    const material* mat_ptr = nullptr;
 
     void set_face_nomral(const ray& r, const vec3& outward_normal) {
         // 如果内积小于0, 那么和射线的相交表面的是内侧, front_face = false; 内积大于0, 那么和射线的相交表面是外侧, front_face = true.
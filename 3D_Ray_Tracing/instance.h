@@ -0,0 +1,87 @@
+#ifndef INSTANCE_H
+#define INSTANCE_H
+
+#include "surface.h"
+#include "transform.h"
+
+#include <memory>
+#include <utility>
+
+/*
+    instance: 把一个共享的几何体(任意surface, 通常是自带BVH的sphere_set或triangle_mesh)以一个仿射变换放置到场景中.
+
+    同一个几何体放置多次时, 几何数据和它自己的BVH只保存一份, 每次放置只多一个instance对象(一个3x4逆变换矩阵加一个包围盒, 不到200字节),
+    所以内存随不同资源的数目增长, 而不是随放置的次数增长.
+
+    求交时不变换几何体, 而是用逆变换把射线变换到几何体自己的物体空间(object space)中求交, 再把法向量变换回世界空间, 交点直接用世界空间的射线和t求出.
+    射线方向变换之后不做单位化, 于是物体空间中的参数t与世界空间中的t完全相同, t_min, t_max以及找到的交点t都不需要换算.
+    法向量按照逆矩阵的转置变换(见transform.h). 因为 dot(A d, (A^-1)^T n) = dot(d, n), 射线在表面哪一侧不变, front_face保持物体空间中的结果.
+
+    两阶段求交: intersect()只把内层图元的hit_query压栈并换成自己, finalize()时才变换射线和法向量, 被更近的交点取代的instance交点不做这些计算.
+
+    两层加速结构: 场景中的instance放进一个bvh_node(顶层, top-level), 顶层的叶子是instance;
+    射线进入instance之后遍历几何体自己的BVH(底层, bottom-level). 顶层只按照instance变换后的包围盒构建, 重新摆放物体时底层不需要重建.
+*/
+class instance : public surface {
+    public:
+        // parameter constructor. object_to_world把几何体从物体空间变换到世界空间.
+        // 几何体通常和instance一起分配在scene的arena中, 由arena持有; 用shared_ptr构造时instance自己持有一份.
+        instance(const surface* geometry, const affine_transform& object_to_world);
+        instance(std::shared_ptr<const surface> geometry, const affine_transform& object_to_world)
+            : instance(geometry.get(), object_to_world) { owner = std::move(geometry); }
+
+    public:
+        virtual bool intersect(const ray& r, double t_min, double t_max, hit_query& q) const override;
+        virtual void finalize(const ray& r, const hit_query& q, hit_record& rec) const override;
+        virtual bool occluded(const ray& r, double t_min, double t_max) const override;
+        virtual bool bounding_box(aabb& output_box) const override;
+
+    private:
+        const surface* object;
+        std::shared_ptr<const surface> owner;   // 用shared_ptr构造时保持几何体存活, 否则为空.
+        affine_transform to_object;             // 世界空间到物体空间的逆变换. 正变换只在构造时计算包围盒用到.
+        aabb world_box;
+        bool has_box;
+};
+
+instance::instance(const surface* geometry, const affine_transform& object_to_world)
+    : object{geometry}, to_object{object_to_world.inverse()} {
+    aabb object_box;
+    has_box = object->bounding_box(object_box);
+    if(has_box) world_box = object_to_world.apply_box(object_box);
+}
+
+bool instance::intersect(const ray& r, double t_min, double t_max, hit_query& q) const {
+    const ray object_ray(to_object.apply_point(r.origin()), to_object.apply_vector(r.direcion()));
+    hit_query inner;
+    if(!object->intersect(object_ray, t_min, t_max, inner)) return false;
+    if(inner.instance_depth >= hit_query::max_instance_depth) return false;        // 嵌套超过max_instance_depth层的instance不可见.
+
+    // 交点由内层的图元产生, 它的finalize()需要物体空间中的射线. 把它压栈, 换成自己, finalize()时先变换射线再交给它.
+    q = inner;
+    q.instance_stack[q.instance_depth++] = q.object;
+    q.object = this;
+    return true;
+}
+
+void instance::finalize(const ray& r, const hit_query& q, hit_record& rec) const {
+    hit_query inner = q;
+    inner.object = q.instance_stack[--inner.instance_depth];
+    inner.object->finalize(ray(to_object.apply_point(r.origin()), to_object.apply_vector(r.direcion())), inner, rec);
+
+    rec.p = r.at(rec.t);
+    rec.normal = unit_vector(to_object.apply_normal(rec.normal));
+}
+
+bool instance::occluded(const ray& r, double t_min, double t_max) const {
+    // t在两个空间中相同, 不需要把任何结果变换回世界空间.
+    return object->occluded(ray(to_object.apply_point(r.origin()), to_object.apply_vector(r.direcion())), t_min, t_max);
+}
+
+bool instance::bounding_box(aabb& output_box) const {
+    if(!has_box) return false;
+    output_box = world_box;
+    return true;
+}
+
+#endif
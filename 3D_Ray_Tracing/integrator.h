@@ -0,0 +1,188 @@
+#ifndef INTEGRATOR_H
+#define INTEGRATOR_H
+
+#include "light.h"
+#include "material.h"
+#include "render_stats.h"
+#include "surface.h"
+#include "utility.h"
+
+/*
+    ray tracer光线追踪器的核心是使从视点发出的光线穿过2D成像平面像素并计算沿这些光线方向看到的空间场景点的颜色. 涉及的步骤是
+        1. 计算从视点发出的闯过2D成像平面像素的光线.
+        2. 确定光线与3D空间中相交的物体点.
+        3. 计算该交点p(t)的颜色.
+*/
+// 定义ray_color()函数, 该函数返回穿过像素点的可视射线所看到的物体颜色.
+/*
+    最初的ray_color()是递归实现的: 每一层递归把attenuation乘到下一层返回的颜色上, 最多递归max_depth = 50层, 每层栈帧上都有一个hit_record, ray和color.
+    现在改写为迭代循环, 用throughput记录从视点到当前交点为止所有attenuation的乘积, 射线最终射向背景时, 像素颜色就是 throughput * background.
+    两种写法计算的是同一个乘积, 只是乘法的结合顺序不同.
+
+    俄罗斯轮盘赌Russian roulette: 光线弹射几次之后, throughput往往已经很小, 继续追踪对像素颜色几乎没有贡献却同样耗时.
+    从第rr_depth次弹射开始, 每次弹射后以概率 q = 1 - p 终止路径, 其中 p = throughput的最大分量; 没有被终止的路径把throughput除以p做补偿.
+    路径贡献的期望为 p * (L/p) + q * 0 = L, 所以估计仍然是无偏的, 而暗的或者吸收强的场景中平均路径长度大大缩短.
+*/
+/*
+    显式光源采样(next-event estimation)与多重重要性采样(multiple importance sampling, MIS):
+    在漫反射交点上, 光源的直接光照有两种估计方式:
+        1. 光源采样: 从lights中选一个光源并在它上面采样一个方向, 发一条shadow ray, 光源可见时累加 f * Le / p_light;
+        2. BSDF采样: scatter()随机选出的下一条射线恰好射中光源时, 累加 f * Le / p_bsdf (即throughput * Le).
+    小光源时1好, 大光源配合镜面一些的材质时2好. 两者同时使用, 分别乘上权重 w_light = p_light^2 / (p_light^2 + p_bsdf^2) 和 w_bsdf = p_bsdf^2 / (p_light^2 + p_bsdf^2)
+    (power heuristic, Veach 1997), 权重之和为1, 所以结果仍然是无偏的, 而且方差不比两者中较好的那个差多少.
+    相机射线以及镜面, 折射材质之后射中光源时没有做过光源采样, 全额计入.
+    lights为空时(场景中没有光源或者关闭了光源采样)不消耗任何额外的采样维度, 结果与原来完全相同.
+*/
+inline double power_heuristic(const double pdf_a, const double pdf_b) {
+    const double a2 = pdf_a * pdf_a;
+    return a2 / (a2 + pdf_b * pdf_b);
+}
+
+// 射线没有与任何物体相交时看到的背景(天空)颜色.
+inline color background(const ray& r) {
+    vec3 unit_direction = unit_vector(r.direcion());    // 得到r方向上的单位向量
+    // 2D成像平面是x-y平面. 这种取参数t值的方法, 不同长度的射线单位化之后的单位向量的x,y,w值是不同的.
+    double t = 0.5*(unit_direction.y() + 1.0);
+    // [0.5, 0.7, 1.0] 天蓝色, [1.0, 1.0, 1.0] 纯白色. 让射线返回的颜色在纯白色和天蓝色范围内线性差值选择.
+    // When t = 1.0 we want blue; When t = 0.0 we want white. In between, we want a white and blue blend color.
+    // 线性差值公式永远是, lerp(t) = (1.0 - t)*startValue + t*endValue.
+    return (1.0 - t)*color(1.0, 1.0, 1.0) + t*color(0.5, 0.7, 1.0);
+}
+
+/*
+    path_features: 路径上第一个非镜面交点的几何和材质信息, 降噪(见denoiser.h)时用来判断相邻像素是否属于同一个表面.
+        albedo: 交点上scatter()的attenuation(即表面颜色), 乘上之前经过的镜面和折射交点的attenuation; 射中光源时是截断到[0,1]的发光颜色, 射向背景时是背景颜色.
+        normal: 交点的法向量(与射线相对的一侧), 射向背景时是零向量.
+        depth:  从视点沿路径到交点的距离, 射向背景时是0.
+    镜面和玻璃表面本身没有可以区分的特征, 像素看到的是反射或者折射出去的东西, 所以特征取自路径穿过它们之后的第一个漫反射交点(或者光源, 背景).
+    这些量都是ray_color()本来就要算的, 记录它们不消耗任何采样维度, 渲染结果不变.
+*/
+struct path_features {
+    color albedo;
+    vec3 normal;
+    double depth = 0.0;
+};
+
+// 沿着一条路径记录path_features: 每次求交之后调用miss()或hit(), 遇到第一个非镜面交点时写入features, 之后的调用不再做任何事.
+// 路径在此之前被俄罗斯轮盘赌终止或者达到最大弹射次数时, features保持默认的零值.
+struct feature_recorder {
+    path_features* features = nullptr;      // 为空时不记录.
+    color tint{1.0, 1.0, 1.0};              // 之前经过的镜面交点attenuation的乘积.
+    double distance = 0.0;                  // 之前经过的路径长度.
+
+    void miss(const ray& r) {
+        if(!features) return;
+        features->albedo = tint * background(r);
+        features->normal = vec3(0.0, 0.0, 0.0);
+        features->depth = 0.0;
+        features = nullptr;
+    }
+
+    // scattered是scatter()的返回值, 为true时attenuation有效; 为false时(光源或者被吸收)用发光颜色代替.
+    void hit(const ray& r, const hit_record& rec, const bool diffuse, const bool scattered, const color& attenuation, const color& emitted) {
+        if(!features) return;
+        distance += rec.t * r.direcion().length();
+        if(scattered && !diffuse) {
+            tint = tint * attenuation;
+            return;
+        }
+        features->albedo = tint * (scattered ? attenuation : color(std::fmin(emitted.x(), 1.0), std::fmin(emitted.y(), 1.0), std::fmin(emitted.z(), 1.0)));
+        features->normal = rec.normal;
+        features->depth = distance;
+        features = nullptr;
+    }
+};
+
+// features不为空时, 把路径第一个非镜面交点的特征写入features.
+color ray_color(const ray& r_in, const surface& world, const light_list& lights, const int max_depth, const int rr_depth = 3,
+                path_features* features = nullptr) {
+    color radiance(0.0, 0.0, 0.0);          // 沿路径已经收集到的光.
+    color throughput(1.0, 1.0, 1.0);
+    ray r = r_in;
+    bool sampled_lights = false;            // 上一个交点是否做过光源采样. 做过时射中光源要按MIS加权.
+    double scatter_pdf = 0.0;               // 上一个交点上scatter()选出当前方向的pdf.
+    feature_recorder recorder{features};
+    render_counters& counters = thread_counters();     // 每条路径只取一次thread_local.
+
+    // If we've exceeded the ray bounce limit, no more light is gathered.
+    for(int depth = 0; depth < max_depth; ++depth) {
+        hit_record rec;
+        ++(depth == 0 ? counters.primary_rays : counters.secondary_rays);
+        // Some of the reflected rays hit the object they are reflecting off of not at exactly t = 0, 
+        // but instead at t = -0.0000001 or t = 0.0000001 or whatever floating point approximation the sphere intersector gives us. 
+        // So we need to ignore hits very near zero, set starting point of intersection range at t = 0.001.
+        if(!world.hit(r, 0.001, infinity, rec)) {  // infinity表示正无穷, 定义于utility.h头文件中.
+            // 如果不相交则返回background color.
+            recorder.miss(r);
+            counters.record_path(depth + 1);
+            return radiance + throughput * background(r);
+        }
+
+        // 射中光源.
+        const color emitted = material_emitted(*rec.mat_ptr);
+        if(emitted.x() > 0.0 || emitted.y() > 0.0 || emitted.z() > 0.0) {
+            double weight = 1.0;
+            if(sampled_lights) {
+                const double length = r.direcion().length();
+                weight = power_heuristic(scatter_pdf, lights.pdf(r.origin(), r.direcion() / length, rec.t * length));
+            }
+            radiance += weight * throughput * emitted;
+        }
+
+        // 光源采样. 用一条shadow ray检查交点和光源上的采样点之间是否有遮挡.
+        const bool diffuse = material_diffuse(*rec.mat_ptr);
+        const bool sample_lights = !lights.empty() && diffuse;
+        if(sample_lights) {
+            const double u_choice = sample_1d();
+            const point2 u_light = sample_2d();
+            light_sample ls;
+            if(lights.sample(rec.p, u_choice, u_light, ls)) {
+                const color f = material_eval(*rec.mat_ptr, rec, ls.direction);
+                const bool contributes = f.x() > 0.0 || f.y() > 0.0 || f.z() > 0.0;
+                counters.shadow_rays += contributes;
+                if(contributes && !world.occluded(ray(rec.p, ls.direction), 0.001, ls.distance * (1.0 - 1e-4))) {
+                    const double weight = power_heuristic(ls.pdf, material_pdf(*rec.mat_ptr, rec, ls.direction));
+                    radiance += throughput * f * ls.radiance * (weight / ls.pdf);
+                }
+            }
+        }
+
+        // 如果相交的话, 那么就有反射, 漫反射或者镜面反射, 依材质而定.
+        // scatter()函数根据材质不同反射形式也不一样, 如果是Lambert材质那就是漫反射, 如果是metal材质那就是镜面反射.
+        // scatter散射这里指的是漫反射, 镜面反射, 折射和全内反射的总称.
+        ray scattered;      // 记录相交点的散射射线, 作为下一次迭代追踪的射线.
+        color attenuation;  // 光强减弱系数, 这里直接等于albedo, 也就是attenuation = albeda, 反射率直接刻画光强减弱系数.
+        const bool has_scattered = material_scatter(*rec.mat_ptr, r, rec, attenuation, scattered);
+        ++counters.scatters[static_cast<int>(rec.mat_ptr->type_tag())];
+        recorder.hit(r, rec, diffuse, has_scattered, attenuation, emitted);
+        if(!has_scattered) {
+            counters.record_path(depth + 1);
+            return radiance;    // 如果无scatter射线(被吸收, 或者是光源), 路径到此结束, 不再收集更多的光.
+        }
+        sampled_lights = sample_lights;
+        if(sample_lights) scatter_pdf = material_pdf(*rec.mat_ptr, rec, unit_vector(scattered.direcion()));
+
+        // 乘以attenuation, 表示物体吸收了( 1.0 - attenuation )的光照强度,另外attenuation数量光强被scatter了出去. 不同材质的光反射率albedo不同.
+        // 可视射线和物体相交的次数越多那么最终反射的光强度越弱, 相交超过max_depth次数直接置反射光强度为0, 也就是这一像素点为纯黑色.
+        throughput = throughput * attenuation;
+        r = scattered;
+
+        // Russian roulette.
+        if(depth + 1 >= rr_depth) {
+            const double p = std::fmax(throughput.x(), std::fmax(throughput.y(), throughput.z()));
+            if(p < 1.0) {
+                if(sample_1d() >= p) {
+                    ++counters.rr_kills;
+                    counters.record_path(depth + 1);
+                    return radiance;
+                }
+                throughput /= p;
+            }
+        }
+    }
+
+    counters.record_path(max_depth);
+    return radiance;
+}
+
+#endif
@@ -0,0 +1,226 @@
+#ifndef LIGHT_H
+#define LIGHT_H
+
+#include "bvh.h"
+#include "material.h"
+#include "utility.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+/*
+    light_list: 场景中所有发光(材质的emitted()不为0)的几何体, 用于显式光源采样(next-event estimation, NEE).
+
+    只在天空背景下, 光线只有在路径碰巧射中光源时才能收集到光. 光源越小, 随机射中它的概率越低, 室内场景几乎全是噪点.
+    NEE在每个漫反射交点上主动选一个光源, 在光源上采样一个点, 用一条shadow ray检查可见性, 可见时直接累加该光源的贡献.
+
+    光源按照功率(亮度 * 面积)成比例地选取. 支持两种形状:
+        球: 从交点看过去, 球所张的立体角是一个圆锥, 在圆锥内均匀采样方向, pdf = 1 / (2 pi (1 - cos_max)). 交点在球内时不采样.
+        三角形: 在面积上均匀采样, 换算到立体角 pdf = dist^2 / (area * cos_light).
+    光源是双面发光的.
+
+    场景加载时由surface::collect_lights()收集, 之后调用一次build(). 对光源的包围盒再建一棵BVH(见bvh.h),
+    这样多重重要性采样(MIS)在路径通过BSDF采样射中光源时, 只需遍历这棵小树就能求出光源采样策略生成同一方向的pdf.
+    instance中的发光几何体不会被收集, 它们仍然可以被BSDF采样射中, 此时不做MIS加权.
+*/
+struct light_sample {
+    vec3 direction;         // 从交点指向光源上采样点的单位向量.
+    double distance;        // 交点到采样点的距离.
+    color radiance;         // 光源的辐射亮度.
+    double pdf;             // 立体角上的pdf, 已经乘上了选中这个光源的概率.
+};
+
+class light_list {
+    public:
+        // 材质不发光时忽略.
+        void add_sphere(const point3& center, const double radius, const material* m);
+        void add_triangle(const point3& a, const point3& b, const point3& c, const material* m);
+        // 计算选取概率并构建光源BVH. 所有add之后调用一次.
+        void build();
+
+        bool empty() const { return lights.empty(); }
+        size_t size() const { return lights.size(); }
+
+        // 从点p采样一个光源方向. u_choice选光源, u在光源上采样. 无法采样时返回false.
+        bool sample(const point3& p, const double u_choice, const point2& u, light_sample& s) const;
+        // 光源采样策略生成从p出发, 沿单位方向d, 在距离t处射中光源上的点的pdf(立体角). 不是由光源列表中的光源射中时返回0.
+        double pdf(const point3& p, const vec3& d, const double t) const;
+
+    private:
+        enum class shape { sphere, triangle };
+        struct light {
+            shape kind;
+            point3 p0;              // 球心, 或者三角形的第一个顶点.
+            vec3 e1, e2;            // 三角形的两条边; 球时e1.x()是半径.
+            color radiance;
+            double area;
+            double probability;     // 被选中的概率.
+        };
+
+        // 立体角上的pdf, 不包括选中概率.
+        double sphere_pdf(const light& l, const point3& p) const;
+        // 射线与单个光源求交, 返回最近交点的参数t, 没有交点返回infinity.
+        double intersect(const light& l, const ray& r) const;
+
+    private:
+        std::vector<light> lights;
+        std::vector<double> cdf;        // 按照选取概率的累积分布, 与lights一一对应.
+        bvh_tree tree;
+};
+
+void light_list::add_sphere(const point3& center, const double radius, const material* m) {
+    const color emit = m ? m->emitted() : color(0.0, 0.0, 0.0);
+    if(emit.x() <= 0.0 && emit.y() <= 0.0 && emit.z() <= 0.0) return;
+    const double r = std::fabs(radius);
+    if(r <= 0.0) return;
+    lights.push_back({shape::sphere, center, vec3(r, 0.0, 0.0), vec3(0.0, 0.0, 0.0), emit, 4.0 * pi * r * r, 0.0});
+}
+
+void light_list::add_triangle(const point3& a, const point3& b, const point3& c, const material* m) {
+    const color emit = m ? m->emitted() : color(0.0, 0.0, 0.0);
+    if(emit.x() <= 0.0 && emit.y() <= 0.0 && emit.z() <= 0.0) return;
+    const double area = 0.5 * cross(b - a, c - a).length();
+    if(area <= 0.0) return;
+    lights.push_back({shape::triangle, a, b - a, c - a, emit, area, 0.0});
+}
+
+void light_list::build() {
+    if(lights.empty()) return;
+
+    // 先建BVH再按照叶子顺序重排, 这样BVH遍历时可以直接用叶子中的下标访问lights.
+    std::vector<aabb> boxes(lights.size());
+    for(size_t k = 0; k < lights.size(); ++k) {
+        const light& l = lights[k];
+        if(l.kind == shape::sphere) {
+            const vec3 half_extent(l.e1.x(), l.e1.x(), l.e1.x());
+            boxes[k] = aabb(l.p0 - half_extent, l.p0 + half_extent);
+        }
+        else {
+            boxes[k].expand(l.p0);
+            boxes[k].expand(l.p0 + l.e1);
+            boxes[k].expand(l.p0 + l.e2);
+        }
+    }
+    tree.build(boxes);
+    std::vector<light> sorted;
+    sorted.reserve(lights.size());
+    for(const int index : tree.primitive_order())
+        sorted.push_back(lights[index]);
+    lights.swap(sorted);
+    tree.release_primitive_order();
+
+    // 选取概率与功率成正比, 功率用亮度(三个分量的平均)乘以面积近似.
+    double total = 0.0;
+    for(const light& l : lights)
+        total += (l.radiance.x() + l.radiance.y() + l.radiance.z()) / 3.0 * l.area;
+    cdf.resize(lights.size());
+    double running = 0.0;
+    for(size_t k = 0; k < lights.size(); ++k) {
+        light& l = lights[k];
+        l.probability = (l.radiance.x() + l.radiance.y() + l.radiance.z()) / 3.0 * l.area / total;
+        running += l.probability;
+        cdf[k] = running;
+    }
+    cdf.back() = 1.0;
+}
+
+double light_list::sphere_pdf(const light& l, const point3& p) const {
+    const double r = l.e1.x();
+    const double dist_squared = (l.p0 - p).lenth_squared();
+    if(dist_squared <= r*r) return 0.0;
+    // 1 - cos_max = 1 - sqrt(1 - s), s = r^2 / dist^2. 写成 s / (1 + cos_max), 远处的小球也不会有相减的精度损失.
+    const double s = r*r / dist_squared;
+    const double one_minus_cos_max = s / (1.0 + std::sqrt(1.0 - s));
+    return 1.0 / (2.0 * pi * one_minus_cos_max);
+}
+
+double light_list::intersect(const light& l, const ray& r) const {
+    const vec3 d = r.direcion();
+    if(l.kind == shape::sphere) {
+        const vec3 oc = r.origin() - l.p0;
+        const double a = d.lenth_squared();
+        const double half_b = dot(d, oc);
+        const double c = oc.lenth_squared() - l.e1.x() * l.e1.x();
+        const double discriminant = half_b*half_b - a*c;
+        if(discriminant < 0.0) return infinity;
+        return (-half_b - std::sqrt(discriminant)) / a;     // 交点在球外, 只有近的交点是可能被采样到的点.
+    }
+    // Möller–Trumbore, 与triangle_mesh相同.
+    const vec3 p = cross(d, l.e2);
+    const double det = dot(l.e1, p);
+    if(std::fabs(det) <= 1e-12) return infinity;
+    const double inv_det = 1.0 / det;
+    const vec3 s = r.origin() - l.p0;
+    const double u = dot(s, p) * inv_det;
+    if(u < 0.0 || u > 1.0) return infinity;
+    const vec3 q = cross(s, l.e1);
+    const double v = dot(d, q) * inv_det;
+    if(v < 0.0 || u + v > 1.0) return infinity;
+    return dot(l.e2, q) * inv_det;
+}
+
+bool light_list::sample(const point3& p, const double u_choice, const point2& u, light_sample& s) const {
+    if(lights.empty()) return false;
+    const size_t k = std::min(static_cast<size_t>(std::upper_bound(cdf.begin(), cdf.end(), u_choice) - cdf.begin()), lights.size() - 1);
+    const light& l = lights[k];
+
+    if(l.kind == shape::sphere) {
+        const double solid_angle_pdf = sphere_pdf(l, p);
+        if(solid_angle_pdf <= 0.0) return false;
+        // 在圆锥内均匀采样: cos(theta)在[cos_max, 1]上均匀分布.
+        const double one_minus_cos_max = 1.0 / (2.0 * pi * solid_angle_pdf);
+        const double cos_theta = 1.0 - u.x * one_minus_cos_max;
+        const double sin_theta = std::sqrt(std::fmax(0.0, 1.0 - cos_theta*cos_theta));
+        const double phi = 2.0 * pi * u.y;
+        const vec3 axis = unit_vector(l.p0 - p);
+        vec3 b1, b2;
+        orthonormal_basis(axis, b1, b2);
+        s.direction = unit_vector(std::cos(phi)*sin_theta*b1 + std::sin(phi)*sin_theta*b2 + cos_theta*axis);
+        s.distance = intersect(l, ray(p, s.direction));
+        if(!(s.distance > 0.0 && s.distance < infinity)) return false;      // 圆锥边缘的掠射方向可能因为舍入误差而错过球.
+        s.pdf = l.probability * solid_angle_pdf;
+    }
+    else {
+        // 三角形上均匀采样, 重心坐标 (1 - sqrt(u1), sqrt(u1) (1 - u2), sqrt(u1) u2).
+        const double su = std::sqrt(u.x);
+        const point3 q = l.p0 + (su * (1.0 - u.y)) * l.e1 + (su * u.y) * l.e2;
+        const vec3 to_light = q - p;
+        s.distance = to_light.length();
+        if(s.distance <= 0.0) return false;
+        s.direction = to_light / s.distance;
+        const vec3 n = cross(l.e1, l.e2);
+        const double cos_light = std::fabs(dot(n, s.direction)) / n.length();
+        if(cos_light <= 1e-9) return false;
+        s.pdf = l.probability * s.distance * s.distance / (l.area * cos_light);
+    }
+    s.radiance = l.radiance;
+    return true;
+}
+
+double light_list::pdf(const point3& p, const vec3& d, const double t) const {
+    if(lights.empty()) return 0.0;
+    // 只测试在距离t处与射线相交的光源. 几个光源在同一点重合时, 它们的pdf相加.
+    const ray r(p, d);
+    const double tolerance = 1e-6 * (1.0 + t);
+    double t_max = t + tolerance;
+    double result = 0.0;
+    tree.traverse(r, t - tolerance, t_max, [&](const int offset, const int count, double&) {
+        for(int k = offset; k < offset + count; ++k) {
+            const light& l = lights[k];
+            const double t_light = intersect(l, r);
+            if(std::fabs(t_light - t) > tolerance) continue;
+            if(l.kind == shape::sphere)
+                result += l.probability * sphere_pdf(l, p);
+            else {
+                const vec3 n = cross(l.e1, l.e2);
+                const double cos_light = std::fabs(dot(n, d)) / n.length();
+                if(cos_light > 1e-9) result += l.probability * t * t / (l.area * cos_light);
+            }
+        }
+        return false;
+    });
+    return result;
+}
+
+#endif
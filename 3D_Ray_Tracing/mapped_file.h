@@ -0,0 +1,90 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <string>
+
+#ifdef _WIN32
+    #ifndef NOMINMAX
+        #define NOMINMAX
+    #endif
+    #include <windows.h>
+#else
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+/*
+    mapped_file: 把整个文件只读地映射到内存中(POSIX的mmap, Windows的MapViewOfFile).
+    读取时不需要先把文件复制到自己分配的缓冲区, 操作系统按页把文件内容直接换入, 加载大的二进制场景文件只需要一次顺序扫描.
+    打开失败(文件不存在, 空文件等)时is_open()返回false.
+*/
+class mapped_file {
+    public:
+        explicit mapped_file(const std::string& path);
+        ~mapped_file();
+
+        mapped_file(const mapped_file&) = delete;
+        mapped_file& operator=(const mapped_file&) = delete;
+
+    public:
+        bool is_open() const { return bytes != nullptr; }
+        const unsigned char* data() const { return bytes; }
+        size_t size() const { return length; }
+
+    private:
+        const unsigned char* bytes = nullptr;
+        size_t length = 0;
+#ifdef _WIN32
+        HANDLE file = INVALID_HANDLE_VALUE;
+        HANDLE mapping = nullptr;
+#endif
+};
+
+#ifdef _WIN32
+
+mapped_file::mapped_file(const std::string& path) {
+    file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if(file == INVALID_HANDLE_VALUE) return;
+    LARGE_INTEGER file_size;
+    if(!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0) return;
+    mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if(mapping == nullptr) return;
+    const void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if(view == nullptr) return;
+    bytes = static_cast<const unsigned char*>(view);
+    length = static_cast<size_t>(file_size.QuadPart);
+}
+
+mapped_file::~mapped_file() {
+    if(bytes) UnmapViewOfFile(bytes);
+    if(mapping) CloseHandle(mapping);
+    if(file != INVALID_HANDLE_VALUE) CloseHandle(file);
+}
+
+#else
+
+mapped_file::mapped_file(const std::string& path) {
+    const int fd = open(path.c_str(), O_RDONLY);
+    if(fd < 0) return;
+    struct stat info;
+    if(fstat(fd, &info) == 0 && info.st_size > 0) {
+        void* view = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        if(view != MAP_FAILED) {
+            bytes = static_cast<const unsigned char*>(view);
+            length = static_cast<size_t>(info.st_size);
+            madvise(view, length, MADV_SEQUENTIAL);
+        }
+    }
+    close(fd);      // 映射建立之后文件描述符就可以关闭了.
+}
+
+mapped_file::~mapped_file() {
+    if(bytes) munmap(const_cast<unsigned char*>(bytes), length);
+}
+
+#endif
+
+#endif
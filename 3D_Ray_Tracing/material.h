@@ -4,20 +4,56 @@
 // 在include头文件的时候, 一定不要出现头文件相互引用的死循环. 所以头文件的organization一定要严格顺序, 并且在源文件的include顺序也要正确合法.
 
 // 我们应该把一些所有子类都会用到的头文件全都放在base class中include, 因为base class的头文件.必然会被子类所include.
+#include "arena.h"
 #include "utility.h"    
 
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+/*
+    内置材质的类型标签. 每个材质对象在基类中保存自己的标签, 渲染时按照标签用switch直接调用具体类型的函数(见文件末尾的visit_material()),
+    而不是每次弹射都经过虚函数表. 内置材质类都声明为final, 通过具体类型调用时编译器可以内联并针对每种材质单独优化.
+    用户自己从material派生的材质标签为custom, 仍然通过虚函数调用, 原有的材质类和场景代码不需要任何修改.
+*/
+enum class material_tag : uint8_t { lambertian, metal, dielectric, diffuse_light, custom };
+const int material_tag_count = 5;
+
 // 定义一个材质抽象基类, 不同材质的反射, 折射系数是不同的.
 class material {
     public:
+        explicit material(const material_tag t = material_tag::custom) : tag{t} {}
+        // 材质由material_table通过基类指针持有并销毁, 所以基类析构函数必须是虚函数.
+        virtual ~material() = default;
+
+        material_tag type_tag() const { return tag; }
+
         // 常量纯虚函数.
         virtual bool scatter(const ray& r, const hit_record& rec, color& attenuation, ray& scattered) const = 0;
+
+        // 材质自身发出的辐射亮度, 只有光源材质不为0.
+        virtual color emitted() const { return color(0.0, 0.0, 0.0); }
+
+        /*
+            显式光源采样(next-event estimation)需要知道任意给定方向上的散射, 而不只是scatter()随机选出的那一个方向.
+            只有diffuse()返回true的材质才在交点上做光源采样; 镜面和折射材质的BSDF是delta分布, 随机选出的光源方向上散射恒为0.
+            eval(rec, wi): BSDF乘以cos(theta), wi是指向光源的单位向量. pdf(rec, wi): scatter()采样到方向wi的概率密度(立体角).
+            两者之比正好是scatter()返回的attenuation.
+        */
+        virtual bool diffuse() const { return false; }
+        virtual color eval(const hit_record& rec, const vec3& wi) const { return color(0.0, 0.0, 0.0); }
+        virtual double pdf(const hit_record& rec, const vec3& wi) const { return 0.0; }
+
+    private:
+        material_tag tag;
 };
 
 // 定义Lambertian材质子类.
-class lambertian : public material {
+class lambertian final : public material {
     public:
         // explict default and parameter constructor
-        explicit lambertian(const color& a = {}) : albedo{a} {}
+        explicit lambertian(const color& a = {}) : material{material_tag::lambertian}, albedo{a} {}
     public:
         /*
             实现Lambertian reflection.
@@ -44,6 +80,12 @@ class lambertian : public material {
 
             return true;
         }
+
+        // Lambertian的BSDF为 albedo / pi, scatter()按照 cos(theta) / pi 采样.
+        virtual bool diffuse() const override { return true; }
+        virtual color eval(const hit_record& rec, const vec3& wi) const override { return albedo * (std::fmax(0.0, dot(rec.normal, wi)) / pi); }
+        virtual double pdf(const hit_record& rec, const vec3& wi) const override { return std::fmax(0.0, dot(rec.normal, wi)) / pi; }
+
     private:
         color albedo;       // 记录材质的反射率. albedo n. 反射率. 英文释义: The ratio of reflected to incident light. 就是对入射光的反射比率. 1单位强度的入射光的反射光线强度为albedo.
 
@@ -52,7 +94,8 @@ class lambertian : public material {
             // 我们对具有cos(theta)分布的Lambertian分布感兴趣. theta是入射光线与法线的夹角. (注: 我们是从可视射线方向逆推, 因此这些函数产生的漫反射方向实际上是入射光线方向.)
             // True Lambertian射线接近法线的可能性更高, 但是分布更均匀. 这是通过选择在单位球表面上沿表面法线偏移的随机点来实现的.
             // 可以通过在单位球体中选择随机点, 然后对其进行规范化来实现在单位球表面上选择随机点.
-            return normal + random_unit_vector();  
+            // normal + random_unit_vector()的方向恰好是以cos(theta)/pi为概率密度分布的, 这里直接用闭式的余弦加权半球采样, 并使用分层的采样维度.
+            return sample_cosine_hemisphere(normal, sample_2d());  
             /*
                 Lambertian漫反射相比于球内随机向量扰动法向量的random_diffuse方法光线的散射更加均匀, 朝法线散射方向的光线更少. 
                 这意味着对于散射的对象, 它们会显得更亮, 因为更多的光向相机方向反弹(背景颜色), 而不是往大球射去再反弹(反弹越多光强越弱).
@@ -83,10 +126,10 @@ class lambertian : public material {
 };
 
 // 定义金属/镜面材质, 金属/镜面材质就是跟镜子一样反射.
-class metal : public material {
+class metal final : public material {
     public:
         // explict default and parameter constructor
-        explicit metal(const color& a = {}, const double f = 0.0) : albedo{a}, fuzz{f < 1 ? f : 1} {}
+        explicit metal(const color& a = {}, const double f = 0.0) : material{material_tag::metal}, albedo{a}, fuzz{f < 1 ? f : 1} {}
     public:
         /*
         实现specular reflection.
@@ -101,7 +144,8 @@ class metal : public material {
             // 有了起点和方向, 就可以生成散射射线.
             // 我们引入fuzzy relection模糊反射, 也就是说我们不希望所有镜面反射都是精确的, 因为现实世界的金属表面是不可能绝对光滑的, 不同的金属材质对于光线的镜面反射精确度是不同的.
             // 因此引入一个模糊系数[0,1]之间, 来乘以一个长度小于1的随机生成向量, 来扰动精确的镜面反射方向, 从而达到模糊反射效果.
-            scattered = ray(rec.p, specular_reflect + fuzz*random_in_unit_sphere());      
+            const point2 u = sample_2d();
+            scattered = ray(rec.p, specular_reflect + fuzz*sample_unit_ball(u, sample_1d()));      
             attenuation = albedo;
 
             return dot(scattered.direcion(), rec.normal) > 0;   // 判断镜面反射光是否和法线向量同向.
@@ -144,9 +188,9 @@ class metal : public material {
     透明材料（例如水，玻璃和钻石）是电介质。当光线撞击它们时，它会分解为反射射线和折射（透射）射线.
     我们将通过在反射或折射之间随机选择，并且每次交互仅生成一条散射射线来解决这一问题。
 */
-class dielectric : public material {
+class dielectric final : public material {
     public:
-        explicit dielectric(const double index_of_refraction = 1.0) : ir{index_of_refraction} {}
+        explicit dielectric(const double index_of_refraction = 1.0) : material{material_tag::dielectric}, ir{index_of_refraction} {}
     public:
         /*
         实现dielectric refraction.
@@ -182,7 +226,7 @@ class dielectric : public material {
             vec3 direction;
             // 判断是折射还是全内反射.
             // 因为我们这里只产生一条射线, 或者折射光线或者反射光线, 所以当求出反射比R之后, 随机选择一条是折射光线还是射线. 不做拆分成折射和反射两条光线处理.
-            if(cannot_refract < 0  ||  reflectance(cos_theta, refraction_ratio) > random_double()) {
+            if(cannot_refract  ||  reflectance(cos_theta, refraction_ratio) > sample_1d()) {
                 // 全内反射 => 镜面反射, 返回镜面反射的反射方向.
                 direction = specular_reflect_direction(r_in_unit_direction, rec.normal); 
             }
@@ -284,4 +328,81 @@ class dielectric : public material {
         }
 };
 
+/*
+    diffuse_light: 面光源材质, 向各个方向均匀地发出亮度为emit的光, 不散射入射光. 两面都发光.
+    射中光源的路径在这里结束. 光源加入场景的light_list之后, 漫反射交点上会对它做显式采样, 见light.h和integrator.h.
+*/
+class diffuse_light final : public material {
+    public:
+        explicit diffuse_light(const color& c = {}) : material{material_tag::diffuse_light}, emit{c} {}
+
+    public:
+        virtual bool scatter(const ray& r, const hit_record& rec, color& attenuation, ray& scattered) const override { return false; }
+        virtual color emitted() const override { return emit; }
+
+    private:
+        color emit;
+};
+
+/*
+    按照材质的标签把m转换成具体类型再调用f, 相当于std::visit. f一般是一个泛型lambda, 例如 [&](const auto& x) { return x.scatter(...); }.
+    内置材质类是final的, 在具体类型上调用虚函数时编译器知道最终的覆盖函数, 会直接调用甚至内联, 只有custom材质才真正走虚函数表.
+    同一种材质连续调用时(例如wavefront按材质分组着色)switch的分支每次都被正确预测.
+*/
+template<typename Function>
+inline auto visit_material(const material& m, Function&& f) {
+    switch(m.type_tag()) {
+        case material_tag::lambertian:      return f(static_cast<const lambertian&>(m));
+        case material_tag::metal:           return f(static_cast<const metal&>(m));
+        case material_tag::dielectric:      return f(static_cast<const dielectric&>(m));
+        case material_tag::diffuse_light:   return f(static_cast<const diffuse_light&>(m));
+        default:                            return f(m);
+    }
+}
+
+// 渲染器使用的材质接口, 与material的同名虚函数含义相同, 按照标签分派.
+inline bool material_scatter(const material& m, const ray& r, const hit_record& rec, color& attenuation, ray& scattered) {
+    return visit_material(m, [&](const auto& x) { return x.scatter(r, rec, attenuation, scattered); });
+}
+inline color material_emitted(const material& m) {
+    return visit_material(m, [](const auto& x) { return x.emitted(); });
+}
+inline bool material_diffuse(const material& m) {
+    return visit_material(m, [](const auto& x) { return x.diffuse(); });
+}
+inline color material_eval(const material& m, const hit_record& rec, const vec3& wi) {
+    return visit_material(m, [&](const auto& x) { return x.eval(rec, wi); });
+}
+inline double material_pdf(const material& m, const hit_record& rec, const vec3& wi) {
+    return visit_material(m, [&](const auto& x) { return x.pdf(rec, wi); });
+}
+
+/*
+    material_table: 场景的材质表, 场景中所有材质对象都由它持有, 场景销毁时统一释放.
+    几何体(sphere, sphere_set等)和hit_record里只保存不拥有所有权的const material*指针.
+    材质对象放在材质表自己的scene_arena中(见arena.h), 按照添加顺序连续存放, 向材质表中添加新材质不会使已经返回的指针失效.
+*/
+class material_table {
+    public:
+        // 构造一个T类型的材质并加入材质表, 返回指向它的指针. 例如: auto m = materials.add<lambertian>(color(0.5, 0.5, 0.5));
+        template<typename T, typename... Args>
+        const material* add(Args&&... args) {
+            ++count;
+            return arena.create<T>(std::forward<Args>(args)...);
+        }
+
+        // 一次构造count个默认值的T类型材质, 它们连续存放在同一块内存中, 返回第一个的地址, 调用方再逐个赋值.
+        template<typename T>
+        T* add_block(const size_t block_count) {
+            count += block_count;
+            return arena.create_array<T>(block_count);
+        }
+
+        size_t size() const { return count; }
+
+    private:
+        scene_arena arena;
+        size_t count = 0;
+};
+
 #endif
\ No newline at end of file
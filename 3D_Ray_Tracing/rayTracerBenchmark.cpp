@@ -0,0 +1,447 @@
+// 光线追踪器的性能基准测试. 编译方式与rayTracerMain相同:
+//     g++ -std=c++17 -O2 -pthread rayTracerBenchmark.cpp -o rayTracerBenchmark
+// 每个基准测试输出一行JSON到标准输出, 进度信息输出到标准错误, 所以可以直接 "./rayTracerBenchmark > result.jsonl" 保存结果, 在不同提交之间比较.
+#include "utility.h"
+
+#include "bvh_node.h"
+#include "framebuffer.h"
+#include "material.h"
+#include "render_options.h"
+#include "render_stats.h"
+#include "renderer.h"
+#include "scene.h"
+#include "scenes.h"
+#include "sphere.h"
+#include "surface_list.h"
+#include "triangle_mesh.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/*
+    微基准测试(micro benchmark): 单独测量一个函数(sphere::hit, surface_list::hit, scatter, vec3运算, 采样函数)每次调用的耗时.
+        输入数据(射线, 向量等)预先生成好放在数组中, 计时的循环里只调用被测函数, 结果累加到benchmark_sink中防止被编译器优化掉.
+        先用很少的迭代次数试跑, 再按照耗时放大迭代次数, 直到一次测量至少持续min_time秒.
+    宏基准测试(macro benchmark): 在固定的种子下完整渲染scene1, random_scene和forest, 通过render_frame()走的是与rayTracerMain完全相同的渲染路径.
+        每个场景再用wavefront路径追踪器渲染一次(名字带_wavefront), 比较两种组织方式.
+        用一个counting_surface包住world, 统计world求交的次数, 即追踪的射线总数(主射线和所有弹射射线).
+*/
+static volatile double benchmark_sink = 0.0;
+
+struct benchmark_options {
+    std::string filter;             // 只运行名字中包含filter的基准测试.
+    double min_time = 0.5;          // 每个微基准测试至少测量的秒数.
+    int num_threads = 1;            // 宏基准测试的渲染线程数. 默认单线程, 结果更稳定.
+    int image_width = 200;
+    int samples_per_pixel = 16;
+    unsigned seed = 1;
+};
+
+// 输出一行JSON. fields是已经格式化好的 "key": value 列表.
+void report(const std::string& name, const std::string& fields) {
+    std::cout << "{\"benchmark\": \"" << name << "\", " << fields << "}" << std::endl;
+}
+
+/*
+    运行一个微基准测试. batch(n)执行n次被测操作; 每次操作包含ops_per_call个unit(例如一条射线测试64个球, 就是64次intersection).
+    输出每个unit的纳秒数和每秒的unit数.
+*/
+template<typename Batch>
+void run_micro(const benchmark_options& bopts, const std::string& name, const std::string& unit, Batch&& batch, const double units_per_call = 1.0) {
+    if(name.find(bopts.filter) == std::string::npos) return;
+    std::cerr << "running " << name << "..." << std::endl;
+
+    using clock = std::chrono::steady_clock;
+    long long n = 16;
+    double seconds = 0.0;
+    while(true) {
+        const auto start = clock::now();
+        batch(n);
+        seconds = std::chrono::duration<double>(clock::now() - start).count();
+        if(seconds >= bopts.min_time || n > (1LL << 40)) break;       // 后一个条件防止被测循环被编译器整个优化掉时死循环.
+        // 按照这一次的耗时估计需要的迭代次数, 多估计20%, 每次至少翻倍.
+        const double scale = seconds > 0.0 ? 1.2 * bopts.min_time / seconds : 100.0;
+        n = static_cast<long long>(n * (scale < 2.0 ? 2.0 : (scale > 100.0 ? 100.0 : scale)));
+    }
+
+    const double units = n * units_per_call;
+    std::ostringstream fields;
+    fields << "\"unit\": \"" << unit << "\", \"iterations\": " << n << ", \"seconds\": " << seconds
+           << ", \"ns_per_" << unit << "\": " << 1e9 * seconds / units
+           << ", \"" << unit << "s_per_sec\": " << units / seconds;
+    report(name, fields.str());
+}
+
+void run_macro(const benchmark_options& bopts, const std::string& scene_name, const bool wavefront = false) {
+    const std::string name = "macro/" + scene_name + (wavefront ? "_wavefront" : "");
+    if(name.find(bopts.filter) == std::string::npos) return;
+    std::cerr << "running " << name << "..." << std::endl;
+
+    render_options opts;
+    opts.num_threads = bopts.num_threads;
+    opts.seed = bopts.seed;
+    opts.samples_per_pixel = bopts.samples_per_pixel;
+    opts.image_width = bopts.image_width;
+    opts.wavefront = wavefront;
+
+    const double aspect_ratio = 16.0/9.0;
+    thread_sampler().seed(opts.seed);
+    scene world;
+    make_scene(scene_name, aspect_ratio, world);
+
+    using clock = std::chrono::steady_clock;
+    const auto build_start = clock::now();
+    bvh_node world_bvh(world.objects);
+    world.build_lights();
+    const double build_seconds = std::chrono::duration<double>(clock::now() - build_start).count();
+
+    framebuffer image(opts.image_width, static_cast<int>(opts.image_width / aspect_ratio));
+    sampling_stats stats;
+    global_counters().reset();                  // 射线数来自渲染线程的计数器, 见render_stats.h.
+    const auto start = clock::now();
+    render_frame(world_bvh, world.lights, world.cam, opts, image, stats, false);
+    const double seconds = std::chrono::duration<double>(clock::now() - start).count();
+    const render_counters counters = global_counters().total();
+    const long long rays = static_cast<long long>(counters.primary_rays + counters.secondary_rays + counters.shadow_rays);
+    const double bounces = static_cast<double>(counters.primary_rays + counters.secondary_rays);
+
+    std::ostringstream fields;
+    fields << "\"width\": " << image.width() << ", \"height\": " << image.height() << ", \"spp\": " << opts.samples_per_pixel
+           << ", \"seed\": " << opts.seed << ", \"threads\": " << opts.num_threads
+           << ", \"precision\": \"" << (sizeof(real) == sizeof(float) ? "float" : "double") << "\""
+           << ", \"bvh_build_seconds\": " << build_seconds << ", \"seconds\": " << seconds
+           << ", \"rays\": " << rays << ", \"samples\": " << stats.total_samples
+           << ", \"rays_per_sec\": " << rays / seconds
+           << ", \"thread_ns_per_bounce\": " << 1e9 * seconds * opts.num_threads / bounces
+           << ", \"bvh_nodes_per_ray\": " << counters.bvh_nodes / static_cast<double>(rays)
+           << ", \"samples_per_sec\": " << stats.total_samples / seconds;
+    report(name, fields.str());
+}
+
+// 在原点附近随机生成的射线, 大约一半能击中单位球.
+std::vector<ray> make_rays(const int count) {
+    std::vector<ray> rays;
+    rays.reserve(count);
+    for(int k = 0; k < count; ++k) {
+        const point3 origin = point3(0.0, 0.0, 4.0) + random_vec3(-2.0, 2.0);
+        const point3 target = random_vec3(-1.5, 1.5);
+        rays.push_back(ray(origin, target - origin));
+    }
+    return rays;
+}
+
+// 半径为1的经纬度球面三角网格, 共2 * rings * segments个三角形.
+std::shared_ptr<triangle_mesh> make_sphere_mesh(const int rings, const int segments, const material* mat) {
+    auto mesh = std::make_shared<triangle_mesh>(mat);
+    for(int i = 0; i <= rings; ++i) {
+        const double theta = pi * i / rings;
+        for(int j = 0; j < segments; ++j) {
+            const double phi = 2.0 * pi * j / segments;
+            mesh->add_vertex(point3(std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi)));
+        }
+    }
+    for(int i = 0; i < rings; ++i) {
+        for(int j = 0; j < segments; ++j) {
+            const uint32_t a = i*segments + j, b = i*segments + (j + 1) % segments;
+            const uint32_t c = (i + 1)*segments + (j + 1) % segments, d = (i + 1)*segments + j;
+            mesh->add_triangle(a, d, c);
+            mesh->add_triangle(a, c, b);
+        }
+    }
+    mesh->build();
+    return mesh;
+}
+
+void run_vec3_benchmarks(const benchmark_options& bopts) {
+    const int count = 1024;     // 数据量小于L1 cache, 测量的是运算本身而不是内存带宽.
+    std::vector<vec3> a, b;
+    for(int k = 0; k < count; ++k) {
+        a.push_back(random_vec3());
+        b.push_back(random_vec3());
+    }
+
+    run_micro(bopts, "vec3/add_mul", "op", [&](long long n) {
+        vec3 acc(0.0, 0.0, 0.0);
+        for(long long k = 0; k < n; ++k) acc += a[k % count] * 0.5 + b[k % count];
+        benchmark_sink += acc.x();
+    });
+    run_micro(bopts, "vec3/dot", "op", [&](long long n) {
+        double acc = 0.0;
+        for(long long k = 0; k < n; ++k) acc += dot(a[k % count], b[k % count]);
+        benchmark_sink += acc;
+    });
+    run_micro(bopts, "vec3/cross", "op", [&](long long n) {
+        vec3 acc(0.0, 0.0, 0.0);
+        for(long long k = 0; k < n; ++k) acc += cross(a[k % count], b[k % count]);
+        benchmark_sink += acc.x();
+    });
+    run_micro(bopts, "vec3/unit_vector", "op", [&](long long n) {
+        vec3 acc(0.0, 0.0, 0.0);
+        for(long long k = 0; k < n; ++k) acc += unit_vector(a[k % count]);
+        benchmark_sink += acc.x();
+    });
+}
+
+void run_sampling_benchmarks(const benchmark_options& bopts) {
+    const vec3 normal = unit_vector(vec3(0.3, 0.8, -0.2));
+    sampler& rng = thread_sampler();
+
+    run_micro(bopts, "sampling/random_double", "sample", [&](long long n) {
+        double acc = 0.0;
+        for(long long k = 0; k < n; ++k) acc += random_double();
+        benchmark_sink += acc;
+    });
+    run_micro(bopts, "sampling/start_pixel_sample", "sample", [&](long long n) {
+        double acc = 0.0;
+        for(long long k = 0; k < n; ++k) {
+            rng.start_pixel_sample(1, 17, 42, static_cast<uint64_t>(k));
+            acc += rng.next_double();
+        }
+        benchmark_sink += acc;
+    });
+    for(const sampler_type type : {sampler_type::independent, sampler_type::sobol}) {
+        const std::string suffix = type == sampler_type::sobol ? "sobol" : "independent";
+        run_micro(bopts, "sampling/next_2d_" + suffix, "sample", [&](long long n) {
+            rng.set_type(type);
+            rng.start_pixel_sample(1, 17, 42, 0);
+            double acc = 0.0;
+            for(long long k = 0; k < n; ++k) {
+                if((k & 63) == 0) rng.start_pixel_sample(1, 17, 42, static_cast<uint64_t>(k >> 6));     // 一个采样最多用到64组维度.
+                const point2 u = rng.next_2d();
+                acc += u.x + u.y;
+            }
+            benchmark_sink += acc;
+        });
+    }
+    rng.set_type(sampler_type::independent);
+
+    run_micro(bopts, "sampling/random_in_unit_sphere", "sample", [&](long long n) {
+        vec3 acc(0.0, 0.0, 0.0);
+        for(long long k = 0; k < n; ++k) acc += random_in_unit_sphere();
+        benchmark_sink += acc.x();
+    });
+    run_micro(bopts, "sampling/random_unit_vector", "sample", [&](long long n) {
+        vec3 acc(0.0, 0.0, 0.0);
+        for(long long k = 0; k < n; ++k) acc += random_unit_vector();
+        benchmark_sink += acc.x();
+    });
+    run_micro(bopts, "sampling/random_in_unit_disk", "sample", [&](long long n) {
+        vec3 acc(0.0, 0.0, 0.0);
+        for(long long k = 0; k < n; ++k) acc += random_in_unit_disk();
+        benchmark_sink += acc.x();
+    });
+    run_micro(bopts, "sampling/cosine_hemisphere", "sample", [&](long long n) {
+        vec3 acc(0.0, 0.0, 0.0);
+        for(long long k = 0; k < n; ++k) acc += sample_cosine_hemisphere(normal, sample_2d());
+        benchmark_sink += acc.x();
+    });
+}
+
+void run_intersection_benchmarks(const benchmark_options& bopts) {
+    const int count = 4096;
+    const std::vector<ray> rays = make_rays(count);
+    material_table materials;
+    const material* mat = materials.add<lambertian>(color(0.5, 0.5, 0.5));
+
+    const sphere ball(point3(0.0, 0.0, 0.0), 1.0, mat);
+    run_micro(bopts, "sphere/hit", "intersection", [&](long long n) {
+        hit_record rec;
+        long long hits = 0;
+        for(long long k = 0; k < n; ++k) hits += ball.hit(rays[k % count], 0.001, infinity, rec);
+        benchmark_sink += static_cast<double>(hits);
+    });
+
+    // surface_list::hit对每条射线测试所有物体, 每条射线的intersection数目等于物体数目.
+    for(const int num_objects : {4, 64}) {
+        surface_list list;
+        for(int k = 0; k < num_objects; ++k)
+            list.add(std::make_shared<sphere>(random_vec3(-1.5, 1.5), 0.25, mat));
+        run_micro(bopts, "surface_list/hit_" + std::to_string(num_objects), "intersection", [&](long long n) {
+            hit_record rec;
+            long long hits = 0;
+            for(long long k = 0; k < n; ++k) hits += list.hit(rays[k % count], 0.001, infinity, rec);
+            benchmark_sink += static_cast<double>(hits);
+        }, num_objects);
+    }
+
+    // 加速结构: 射线穿过random_scene中约500个球.
+    thread_sampler().seed(bopts.seed);
+    scene world = random_scene(16.0/9.0);
+    bvh_node world_bvh(world.objects);
+    std::vector<ray> scene_rays;
+    for(int k = 0; k < count; ++k) {
+        const double s = random_double(), t = random_double();
+        scene_rays.push_back(world.cam.get_ray(s, t));
+    }
+    run_micro(bopts, "bvh_node/hit_random_scene", "ray", [&](long long n) {
+        hit_record rec;
+        long long hits = 0;
+        for(long long k = 0; k < n; ++k) hits += world_bvh.hit(scene_rays[k % count], 0.001, infinity, rec);
+        benchmark_sink += static_cast<double>(hits);
+    });
+
+    // shadow ray: 从主射线的交点射向场景上方的一个点, 同一组线段分别用hit()和occluded()测试可见性.
+    std::vector<ray> shadow_rays;
+    for(const ray& r : scene_rays) {
+        hit_record rec;
+        if(world_bvh.hit(r, 0.001, infinity, rec))
+            shadow_rays.push_back(ray(rec.p, point3(random_double(-4.0, 4.0), 8.0, random_double(-4.0, 4.0)) - rec.p));
+    }
+    const int shadow_count = static_cast<int>(shadow_rays.size());
+    run_micro(bopts, "bvh_node/shadow_hit_random_scene", "ray", [&](long long n) {
+        hit_record rec;
+        long long blocked = 0;
+        for(long long k = 0; k < n; ++k) blocked += world_bvh.hit(shadow_rays[k % shadow_count], 0.001, 1.0, rec);
+        benchmark_sink += static_cast<double>(blocked);
+    });
+    run_micro(bopts, "bvh_node/shadow_occluded_random_scene", "ray", [&](long long n) {
+        long long blocked = 0;
+        for(long long k = 0; k < n; ++k) blocked += world_bvh.occluded(shadow_rays[k % shadow_count], 0.001, 1.0);
+        benchmark_sink += static_cast<double>(blocked);
+    });
+
+    // 三角形网格: 与sphere/hit相同的射线打在约1M个三角形组成的球面上.
+    const auto mesh = make_sphere_mesh(512, 1024, mat);
+    run_micro(bopts, "triangle_mesh/hit_1M", "ray", [&](long long n) {
+        hit_record rec;
+        long long hits = 0;
+        for(long long k = 0; k < n; ++k) hits += mesh->hit(rays[k % count], 0.001, infinity, rec);
+        benchmark_sink += static_cast<double>(hits);
+    });
+
+    // 场景的构建和销毁: forest中的一万个instance都分配在scene的arena中, 销毁时一次释放.
+    run_micro(bopts, "scene/build_random_scene", "scene", [&](long long n) {
+        for(long long k = 0; k < n; ++k) {
+            const scene built = random_scene(16.0/9.0);
+            benchmark_sink += static_cast<double>(built.materials.size());
+        }
+    });
+    run_micro(bopts, "scene/build_forest_scene", "scene", [&](long long n) {
+        for(long long k = 0; k < n; ++k) {
+            const scene built = forest_scene(16.0/9.0);
+            benchmark_sink += static_cast<double>(built.objects.objects_list().size());
+        }
+    });
+}
+
+void run_scatter_benchmarks(const benchmark_options& bopts) {
+    material_table materials;
+    const std::pair<std::string, const material*> cases[] = {
+        {"scatter/lambertian", materials.add<lambertian>(color(0.5, 0.5, 0.5))},
+        {"scatter/metal",      materials.add<metal>(color(0.8, 0.6, 0.2), 0.3)},
+        {"scatter/dielectric", materials.add<dielectric>(1.5)},
+    };
+
+    // 预先求好一组交点, scatter只依赖入射射线和交点.
+    const int count = 1024;
+    const std::vector<ray> rays = make_rays(4 * count);
+    const sphere ball(point3(0.0, 0.0, 0.0), 1.0, nullptr);
+    std::vector<ray> incoming;
+    std::vector<hit_record> records;
+    for(const ray& r : rays) {
+        hit_record rec;
+        if(static_cast<int>(records.size()) < count && ball.hit(r, 0.001, infinity, rec)) {
+            incoming.push_back(r);
+            records.push_back(rec);
+        }
+    }
+    const int num_records = static_cast<int>(records.size());
+
+    for(const auto& c : cases) {
+        run_micro(bopts, c.first, "scatter", [&](long long n) {
+            double acc = 0.0;
+            ray scattered;
+            color attenuation;
+            for(long long k = 0; k < n; ++k) {
+                const int index = static_cast<int>(k % num_records);
+                if(c.second->scatter(incoming[index], records[index], attenuation, scattered))
+                    acc += scattered.direcion().x();
+            }
+            benchmark_sink += acc;
+        });
+    }
+
+    // 三种材质随机交错, 与渲染时相邻两次弹射的材质互不相关的情况相同. 分别通过虚函数和按标签分派(渲染器使用的方式)调用.
+    std::vector<const material*> mixed(num_records);
+    for(int k = 0; k < num_records; ++k) mixed[k] = cases[random_int(0, 2)].second;
+    run_micro(bopts, "scatter/mixed_virtual", "scatter", [&](long long n) {
+        double acc = 0.0;
+        ray scattered;
+        color attenuation;
+        for(long long k = 0; k < n; ++k) {
+            const int index = static_cast<int>(k % num_records);
+            if(mixed[index]->scatter(incoming[index], records[index], attenuation, scattered))
+                acc += scattered.direcion().x();
+        }
+        benchmark_sink += acc;
+    });
+    run_micro(bopts, "scatter/mixed_tagged", "scatter", [&](long long n) {
+        double acc = 0.0;
+        ray scattered;
+        color attenuation;
+        for(long long k = 0; k < n; ++k) {
+            const int index = static_cast<int>(k % num_records);
+            if(material_scatter(*mixed[index], incoming[index], records[index], attenuation, scattered))
+                acc += scattered.direcion().x();
+        }
+        benchmark_sink += acc;
+    });
+}
+
+void print_benchmark_usage(const char* program) {
+    std::cerr << "Usage: " << program << " [options] > results.jsonl\n"
+              << "  --filter S      only run benchmarks whose name contains S, e.g. micro names like sphere/ or macro/\n"
+              << "  --min-time T    minimum measuring time of each micro benchmark in seconds (default: 0.5)\n"
+              << "  --threads N     render threads for the macro benchmarks (default: 1)\n"
+              << "  --width N       image width of the macro benchmarks (default: 200)\n"
+              << "  --spp N         samples per pixel of the macro benchmarks (default: 16)\n"
+              << "  --seed N        seed of the scenes and renders (default: 1)\n";
+}
+
+int main(int argc, char* argv[]) {
+    benchmark_options bopts;
+    for(int k = 1; k < argc; ++k) {
+        const char* arg = argv[k];
+        const bool has_value = k + 1 < argc;
+        if(std::strcmp(arg, "--filter") == 0 && has_value)
+            bopts.filter = argv[++k];
+        else if(std::strcmp(arg, "--min-time") == 0 && has_value)
+            bopts.min_time = std::atof(argv[++k]);
+        else if(std::strcmp(arg, "--threads") == 0 && has_value)
+            bopts.num_threads = std::max(1, std::atoi(argv[++k]));
+        else if(std::strcmp(arg, "--width") == 0 && has_value)
+            bopts.image_width = std::max(16, std::atoi(argv[++k]));
+        else if(std::strcmp(arg, "--spp") == 0 && has_value)
+            bopts.samples_per_pixel = std::max(1, std::atoi(argv[++k]));
+        else if(std::strcmp(arg, "--seed") == 0 && has_value)
+            bopts.seed = static_cast<unsigned>(std::strtoul(argv[++k], nullptr, 10));
+        else {
+            print_benchmark_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    thread_sampler().seed(bopts.seed);
+
+    // micro benchmarks.
+    run_vec3_benchmarks(bopts);
+    run_sampling_benchmarks(bopts);
+    run_intersection_benchmarks(bopts);
+    run_scatter_benchmarks(bopts);
+
+    // macro benchmarks.
+    run_macro(bopts, "scene1");
+    run_macro(bopts, "random");
+    run_macro(bopts, "forest");
+    run_macro(bopts, "scene1", true);
+    run_macro(bopts, "random", true);
+    run_macro(bopts, "forest", true);
+
+    return 0;
+}
@@ -2,242 +2,139 @@
 // 尤其是对main.cc源文件, 最终这一main程序所需的所有头文件(包含的函数, 定义, 类)都会全部被编译器编译到这一main文件中, 然后生成可执行.exe文件.
 #include "utility.h"
 
-#include "camera.h"
-#include "color.h"
-#include "material.h"  
-#include "surface_list.h"
-#include "sphere.h"
+#include "adaptive_sampling.h"
+#include "bvh_node.h"
+#include "denoiser.h"
+#include "distributed.h"
+#include "framebuffer.h"
+#include "render_options.h"
+#include "render_stats.h"
+#include "renderer.h"
+#include "scene.h"
+#include "scene_file.h"
+#include "scenes.h"
+#include "trace.h"
      
+#include <chrono>
+#include <fstream>
 #include <iostream>
-/*
-    ray tracer光线追踪器的核心是使从视点发出的光线穿过2D成像平面像素并计算沿这些光线方向看到的空间场景点的颜色. 涉及的步骤是
-        1. 计算从视点发出的闯过2D成像平面像素的光线.
-        2. 确定光线与3D空间中相交的物体点.
-        3. 计算该交点p(t)的颜色.
-*/
-// 定义ray_color()函数, 该函数返回穿过像素点的可视射线所看到的物体颜色.
-color ray_color(const ray& r, const surface& world, int depth) {
-    // If we've exceeded the ray bounce limit, no more light is gathered.
-    if(depth <= 0) return color(0.0, 0.0, 0.0);
-
-    // 如果world是球, 则先判断是否与球相交, 如果相交则返回相交点参数t, 用于计算相交点法线向量. 然后根据法线向量三个分量的值来计算color map. 如果不相交则返回background color.
-    // 假定球的中心就在成像平面原点处C = (0, 0, -1), 半径R = 0.5. 并且球表面的颜色为纯红color = [1.0, 0.0, 0.0]/
-    hit_record rec;
-    // Some of the reflected rays hit the object they are reflecting off of not at exactly t = 0, 
-    // but instead at t = -0.0000001 or t = 0.0000001 or whatever floating point approximation the sphere intersector gives us. 
-    // So we need to ignore hits very near zero, set starting point of intersection range at t = 0.001.
-    if(world.hit(r, 0.001, infinity, rec)) {  // infinity表示正无穷, 定义于utility.h头文件中.
-        // 如果相交的话, 那么就有反射, 漫反射或者镜面反射, 依材质而定.
-        // scatter()函数根据材质不同反射形式也不一样, 如果是Lambert材质那就是漫反射, 如果是metal材质那就是镜面反射.
-        // scatter散射这里指的是漫反射, 镜面反射, 折射和全内反射的总称.
-        ray scattered;      // 记录相交点的散射射线, 作为递归光线追踪所用.
-        color attenuation;  // 光强减弱系数, 这里直接等于albedo, 也就是attenuation = albeda, 反射率直接刻画光强减弱系数.
-        if(rec.mat_ptr->scatter(r, rec, attenuation, scattered)) {
-            // 乘以attenuation, 表示物体吸收了( 1.0 - attenuation )的光照强度,另外attenuation数量光强被scatter了出去. 不同材质的光反射率albedo不同.
-            // 这里进行光线递归scatter直到超过depth限定范围或者没有物体再相交. 没有物体相交意味着射线最终反射射向远方. 此时获得的是image background color.
-            // 可视射线和物体相交的次数越多那么最终反射的光强度越弱, 相交超过depth次数直接置反射光强度为0, 也就是这一像素点为纯黑色.
-            // 这里对于光源和光源方向是怎么假设的? 貌似并没有说明光源方向和光源强度.
-            return attenuation * ray_color(scattered, world, depth - 1);
-        }
-        return color(0.0, 0.0, 0.0);    // 如果无scatter射线, 则color为0. 一旦color为0那么像素点颜色必然为纯黑色. 0乘以任何递归过程的数认为0.
-    }
 
-    // 如果不相交则返回background color.
-    vec3 unit_direction = unit_vector(r.direcion());    // 得到r方向上的单位向量
-    // 2D成像平面是x-y平面. 这种取参数t值的方法, 不同长度的射线单位化之后的单位向量的x,y,w值是不同的.
-    double t = 0.5*(unit_direction.y() + 1.0);        
-    // [0.5, 0.7, 1.0] 天蓝色, [1.0, 1.0, 1.0] 纯白色. 让射线返回的颜色在纯白色和天蓝色范围内线性差值选择.
-    // When t = 1.0 we want blue; When t = 0.0 we want white. In between, we want a white and blue blend color.
-    // 线性差值公式永远是, lerp(t) = (1.0 - t)*startValue + t*endValue.
-    return (1.0 - t)*color(1.0, 1.0, 1.0) + t*color(0.5, 0.7, 1.0);     
-}
+#ifdef _WIN32
+    #include <fcntl.h>
+    #include <io.h>
+#endif
 
-surface_list random_scene() {
-    surface_list world;
+int main(int argc, char* argv[]) {
     
-    auto ground_material = std::make_shared<lambertian>(color(0.5, 0.5, 0.5));
-    world.add(std::make_shared<sphere>(point3(0,-1000,0), 1000, ground_material));
-
-    for (int a = -11; a < 11; a++) {
-        for (int b = -11; b < 11; b++) {
-            auto choose_mat = random_double();
-            point3 center(a + 0.9*random_double(), 0.2, b + 0.9*random_double());
-            
-            if ((center - point3(4, 0.2, 0)).length() > 0.9) {
-                std::shared_ptr<material> sphere_material;
-                
-                if (choose_mat < 0.8) {
-                    // diffuse
-                    auto albedo = random_vec3() * random_vec3();
-                    sphere_material = std::make_shared<lambertian>(albedo);
-                    world.add(std::make_shared<sphere>(center, 0.2, sphere_material));
-                } 
-                else if (choose_mat < 0.95) {
-                    // metal
-                    auto albedo = random_vec3(0.5, 1);
-                    auto fuzz = random_double(0, 0.5);
-                    sphere_material = std::make_shared<metal>(albedo, fuzz);
-                    world.add(std::make_shared<sphere>(center, 0.2, sphere_material));
-                } 
-                else {
-                    // glass
-                    sphere_material = std::make_shared<dielectric>(1.5);
-                    world.add(std::make_shared<sphere>(center, 0.2, sphere_material));
-                }
-            }
+    // Options.
+    render_options opts;
+    if(!parse_render_options(argc, argv, opts)) return 1;
+    trace_session tracing(opts.trace_path);        // --trace: 从这里开始记录时间线, main返回时写出.
+    if(!opts.save_scene_path.empty()) {             // 只做场景文件的格式转换, 不渲染.
+        scene_description desc;
+        std::string error;
+        if(!load_scene_description(opts.scene_path, desc, error) || !save_scene_file(opts.save_scene_path, desc)) {
+            std::cerr << (error.empty() ? "Cannot write " + opts.save_scene_path : error) << ".\n";
+            return 1;
         }
+        return 0;
     }
+    thread_sampler().seed(opts.seed);               // 场景构建(例如random_scene)也会使用随机数, 所以先设置主线程的种子.
 
-    auto material1 = std::make_shared<dielectric>(1.5);
-    world.add(std::make_shared<sphere>(point3(0, 1, 0), 1.0, material1));
-    auto material2 = std::make_shared<lambertian>(color(0.4, 0.2, 0.1));
-    world.add(std::make_shared<sphere>(point3(-4, 1, 0), 1.0, material2));
-    auto material3 = std::make_shared<metal>(color(0.7, 0.6, 0.5), 0.0);
-    world.add(std::make_shared<sphere>(point3(4, 1, 0), 1.0, material3));
-    
-    return world;
-}
-
-surface_list scene1() {
-    surface_list world;
-    
-    auto material_ground = std::make_shared<lambertian>(color(0.8, 0.8, 0.0));
-    auto material_center = std::make_shared<lambertian>(color(0.1, 0.2, 0.5));
-    auto material_left   = std::make_shared<dielectric>(1.5);
-    auto material_right  = std::make_shared<metal>(color(0.8, 0.6, 0.2), 0.0);
-    
-    world.add(std::make_shared<sphere>(point3( 0.0, -100.5, -1.0), 100.0, material_ground));
-    world.add(std::make_shared<sphere>(point3( 0.0, 0.0, -1.0), 0.5, material_center));
-    world.add(std::make_shared<sphere>(point3(-1.0, 0.0, -1.0), 0.5, material_left));
-    world.add(std::make_shared<sphere>(point3( 1.0, 0.0, -1.0), 0.5, material_right));
-
-    return world;
-}
-
-int main() {
-    
     // Image
     const double aspect_ratio   = 16.0/9.0; //3.0 / 2.0;        // 定义2D渲染图像的默认比例是16:9. 也就是宽是16, 高9. 也即一行所包含的像素点和一列所包含的像素点比例为16比9.
-    const int image_width       = 400; //1200;             // 定义图像上一行包含的像素点的个数.
+    const int image_width       = opts.image_width; //1200;     // 定义图像上一行包含的像素点的个数, 默认400.
     const int image_height      = static_cast<int>(image_width / aspect_ratio);
-    const int samples_per_pixel = 100; //500;              // 抗锯齿功能开启, 对一个pixel采样100个样本点. 
-    const int max_depth         = 50;               // 反射的最大次数. 也就是光线追踪的最大迭代次数
-
-    // world. 
-    //surface_list world = random_scene();        // world是一个surface_list, 包含所有出现在3D场景中的object.
-    surface_list world = scene1();
-
-    /*
-    // Define material object. RGB -> red & green & blue. 
-    // 折射率是一个RGB向量, 对每个基颜色反射率不同, 折射率分量每个值都在[0.0, 1.0]之间, 值越大对于这一基颜色反射能力越强.
-
-    // world->background.
-    // 不同的材质, 分配不同的折射率. 这一漫反射材质更能反射黄光, 红+绿 = 黄.
-    auto material_ground = std::make_shared<lambertian>(color(0.8, 0.8, 0.0));
-    world.add(std::make_shared<sphere>(point3(0.0, -100.5, -1.0), 100.0, material_ground));        // 这一方式定义的球实则是表示一个地面background.
-    
-    // world->spheres. 三个球.
-    //auto material_center = std::make_shared<lambertian>(color(0.7, 0.3, 0.3));      // 这一漫反射材质更能反射红光.
-    //auto material_center = std::make_shared<dielectric>(1.5);           // 电介质材质, 折射率ir = 1.5. typically air = 1.0, glass = 1.3–1.7, diamond =2.4
-    auto material_center = std::make_shared<lambertian>(color(0.1, 0.2, 0.5));      // 这一漫反射材质更能反射蓝光.
-    world.add(std::make_shared<sphere>(point3(0.0, 0.0, -1.0), 0.5, material_center));
-    
-    // 这一金属材质均匀反射光. 所以其镜面反射能让这一球体把背景原封不动的反射出来. 模糊反射系数为0.3, 模糊度低
-    // auto material_left   = std::make_shared<metal>(color(0.8, 0.8, 0.8), 0.3);     
-    auto material_left   = std::make_shared<dielectric>(1.5);           // 电介质材质, 折射率ir = 1.5. typically air = 1.0, glass = 1.3–1.7, diamond =2.4
-    world.add(std::make_shared<sphere>(point3(-1.0, 0.0, -1.0), 0.5, material_left));
-    world.add(std::make_shared<sphere>(point3(-1.0, 0.0, -1.0), -0.45, material_left));      // 半径为负, 表面法向量向内指向, 一正球一"负"球实现空心玻璃球效果.
-
-    // 金属材质更能反射红光和绿光, 红+绿=黄, 所以这一表面会偏黄绿. 模糊反射系数为1.0, 模糊度强.
-    // auto material_right  = std::make_shared<metal>(color(0.8, 0.6, 0.2), 1.0);         
-    auto material_right = std::make_shared<metal>(color(0.8, 0.6, 0.2), 0.0);        // 模糊系数为0.0, 无模糊. 精确镜面反射.  
-    world.add(std::make_shared<sphere>(point3(1.0, 0.0, -1.0), 0.5, material_right));
-    */
 
-    // camera.
-    //camera cam(point3(-2.0,2.0,1.0), point3(0.0,0.0,-1.0), vec3(0.0,1.0,0.0), 90.0, aspect_ratio);
-    //camera cam(point3(-2.0,2.0,1.0), point3(0.0,0.0,-1.0), vec3(0.0,1.0,0.0), 20.0, aspect_ratio);      // 缩小视角, 可视场景范围变小, 视野变深, 越能看清楚物体纹理
-    camera cam(point3(0.0,0.0,0.0), point3(0.0,0.0,-1.0), vec3(0.0,1.0,0.0), 90.0, aspect_ratio, 0.0, 1.0);
-    
-    /*
-    point3 lookfrom(13.0, 2.0, 3.0);         // 右手坐标系, 这个视角就离球远一些, 从上方俯视球.
-    point3 lookat(0.0, 0.0, 0.0);
-    vec3 vup(0.0, 1.0, 0.0);
-    double aov = 20.0;
-    double aperture = 0.1;
-    double focus_dist = 10.0; //(lookfrom - lookat).length();               // 让lookat点就为成像平面中心.
+    // world. world是一个scene, 包含所有出现在3D场景中的object, 它们的材质以及摄像机. 见scenes.h.
+    scene world;
+    {
+        trace_scope trace("load scene");
+        if(!opts.scene_path.empty()) {                  // 从场景文件加载, 见scene_file.h.
+            const auto load_start = std::chrono::steady_clock::now();
+            std::string error;
+            if(!load_scene_file(opts.scene_path, aspect_ratio, world, error)) {
+                std::cerr << "Cannot load scene " << opts.scene_path << ": " << error << ".\n";
+                return 1;
+            }
+            std::cerr << "Scene loaded (including BVH builds) in " << std::chrono::duration<double>(std::chrono::steady_clock::now() - load_start).count() << " s.\n";
+        }
+        else if(!make_scene(opts.scene_name, aspect_ratio, world)) {
+            std::cerr << "Unknown scene " << opts.scene_name << ".\n";
+            return 1;
+        }
+    }
+    bvh_node world_bvh(world.objects);                  // 在world之上构建BVH, 渲染时使用BVH求交, 每条射线不再需要测试所有物体.
+    if(opts.light_sampling) world.build_lights();       // 收集发光的几何体, 用于显式光源采样. 关闭时lights为空.
 
-    camera cam(lookfrom, lookat, vup, aov, aspect_ratio, aperture, focus_dist);
-    */
+    if(opts.worker) return run_worker(world_bvh, world.lights, world.cam, opts, image_width, image_height);       // 分布式渲染的worker进程, 见distributed.h.
 
     // Render
-    std::cout << "P3\n" << image_width << ' ' << image_height << "\n255\n";
-
-    /*  
-        计算机图形学做的事情和计算机视觉刚好相反. 计算机图形学是给定3D空间场景生成2D图片, 而计算机图形学是给定2D图片, 分析2D图片所包含的3D物体信息.
-        下图的w-h 2D平面坐标空间, 是我们要生成的渲染图像image的平面空间.
-            1. 渲染图像宽为width, 表示的是一列有width个像素点; 高为height, 表示的是一行有height个像素点. 渲染图像总共包含 包含width*height个像素. 
-            2. 每个像素点坐落于边长为1单位像素长度(两个像素点的距离)的小正方形的中心. 这个小正方形所覆盖的区域都会使用像素点的颜色来着色.
-            3. 渲染图像只表示我们想要渲染的像素点总数有多少个, 并不表示光线追踪程序中成像平面image_plane的大小. image_plane的大小是有摄像机视角, 聚焦距离和屏幕比例共同决定的.
-               在光线追踪器程序中, 我们需要把渲染图像空间的像素点的坐标位置(i,j)正确映射成光线追踪程序中在3D世界坐标系空间下成像平面上对应的正确位置(u,v).
-               如果成像平面大, 这通常意味着摄像机视角范围大, 这意味着被正确映射后的两个相邻像素点之间的在u-v平面的间隔距离就会大, 这样好处是渲染图像显示3D场景空间范围大, 但图像容易不清晰.
-               如果成像平面小, 这通常意味着摄像机视角范围小, 这意味着被正确映射后的两个相邻像素点之间的在u-v平面的间隔距离就会小, 这样好处是渲染图像会比较清晰, 但显示的3D场景空间范围会小.              
-            4. 渲染图像的遍历的默认顺序是从高到低, 从左到右, 所以index j从iheight的遍历
-
-        ^ height h-轴       j = image_height - 1 to 0 with stepsize = -1.
-        |
-        |
-        | (0, image_h-1)
-        |--------------------------------
-        |                               |
-        |                               |
-        |            image              |
-        |                               |
-        |    pixels = width x height    |
-        |                               |           i =  0 to image_width - 1 with stepsize = 1.
-        |                               |
-        ---------------------------------------------> width w-轴
-     (0,0)                              (image_width - 1, 0)
-     */
-    for(int j = image_height-1; j >= 0; --j) {
-        std::cerr << "\rScanlines remaing: " << j << ' ' << std::flush;
-        for(int i = 0; i < image_width; ++i) {
-            color pixel_color(0.0, 0.0, 0.0);
-            /*  抗锯齿, antialiasing.
-                这里我们使用随机采样抗锯齿, 在w-h平面上以像素点为中心的边长为1个单位像素长度的正方形邻域内随机采样着色位置.
-                然后把这样采样的着色位置映射到u-v成像平面, 以此在u-v成像平面我们也就在一个特定邻域内随机取到了像素点在成像平面的坐标位置.
-                然后对每一个这样在邻域内随机取得的像素点坐标位置进行执行光线追踪算法算出颜色, 对所有这样的采样像素位置的颜色值进行平均化, 最终就是该像素点的值.
-
-                随机采样是很简单的抗锯齿技术, 还有更高级一些的分层随机采样抗锯齿技术, 对像素点选取的采样邻域进行扰动. 
-                此时虽然初始仍以像素点为中心选取邻域, 但是引入的随机扰动会使得选取的邻域的中心相对于像素点出现随机偏离. */
-            for(int k = 0; k < samples_per_pixel; ++k) {
-                /* 这里用了一个很巧妙的方法, 当确定了渲染图像像素点的空间坐标值(i,j)之后, 并没有直接把两个整数(i,j)传给摄像机让摄像机来转换映射.
-                   而是先除以对应的image_width-1和image_height-1, 得到的是这一像素点与渲染图像空间关于两个坐标轴的分量比例值.
-                   对于h轴分量j, 得到了比例分量s, s在[0,1]之间; 对于w轴分量i, 得到了比例分量t, t在[0,1]之间.
-                   然后把这两个比例分量传给摄像机, 这样做可以很明显简化摄像机内部把像素点在渲染图像空间坐标值转换到u-v平面上正确世界坐标值的计算. 
-                   我们只需要在摄像机内部存储好:
-                                    1. 摄像机位置lookfrom, 成像平面的左下角顶点坐标lower_left_vertex;
-                                    2. 成像平面在u-v空间上, u轴的长度为成像平面宽度的基向量horizontal, v轴的长度为成像平面高度的基向量vertical.
-                   然后使用从h-w平面得到的像素点比例分量s和t, 就能立即确定像素点映射在成像平面的正确位置(即正确的世界坐标值), 或者确定从视点发出的指向这一像素点在成像平面位置的射线的方向:
-                                    loc     = lower_left_vertex + s*horizontal + t*vertical
-                                    ray_dir = (lower_left_vertex - cam_origin) + s*horizontal + t*vertical */
-                double s = (i + random_double()) / (image_width - 1);
-                double t = (j + random_double()) / (image_height - 1);
-                // 以视点射向成像平面最左下角顶点的射线为base, 通过add在horizontal所代表的的u轴基向量和vertical所代表的v轴基向量的增量offset, 来确定正确的穿过成像平面"像素点"的射线.
-                // base_dir     = lower_left_corner - origin        => 表示的是以视点射向成像平面最左下角顶点的射线
-                // x_dir_offset = u*horizontal; y_dir_offset = v*vertical;
-                ray r = cam.get_ray(s, t);          // 摄像机这个对象负责生成光线. 
-                // 找到第一个与3D场景物体列表的相交点, 然后计算像素值!
-                pixel_color += ray_color(r, world, max_depth);
+    framebuffer image(image_width, image_height);   // 所有线程共享的像素缓冲区, 全部tile渲染完成后一次性输出.
+    sampling_stats stats;                           // 统计实际花费的采样数.
+    if(opts.denoise) image.enable_features();       // 降噪需要第一个交点的albedo, 法向量和深度.
+    std::string error;
+    const bool distributed = opts.num_workers > 0 || !opts.worker_commands.empty();
+    const auto render_start = std::chrono::steady_clock::now();
+    {
+        trace_scope trace("render");
+        if(distributed) {
+            if(!render_frame_distributed(world_bvh, world.lights, world.cam, opts, argv[0], image, stats, error)) {
+                std::cerr << error << ".\n";
+                return 1;
+            }
+        }
+        else if(!opts.checkpoint_path.empty()) {
+            if(!render_frame_checkpointed(world_bvh, world.lights, world.cam, opts, image, stats, error)) {
+                std::cerr << error << ".\n";
+                return 1;
             }
-            // use write_color function to print out the color value in [0, 255].
-            write_color(std::cout, pixel_color, samples_per_pixel);     // IO操作是一个很耗时的操作, 放入采样loop中输入一下子耗时就大了可能1-2个数量级.
+        }
+        else
+            render_frame(world_bvh, world.lights, world.cam, opts, image, stats);
+    }
+    const double render_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - render_start).count();
+    if(opts.denoise) {
+        trace_scope trace("denoise");
+        const auto denoise_start = std::chrono::steady_clock::now();
+        denoise(image, opts.num_threads);
+        std::cerr << "Denoised in " << std::chrono::duration<double>(std::chrono::steady_clock::now() - denoise_start).count() << " s.\n";
+    }
 
-            // 使用".\ppmImageText.exe > image.ppm" command把输出变成ppm格式图片. 注意用右箭头">", 这个是关键.
+    // 使用".\rayTracerMain.exe > image.ppm" command把输出变成ppm格式图片. 注意用右箭头">", 这个是关键. 或者用--output直接写入文件.
+    // 输出的是二进制数据, Windows下标准输出默认是文本模式, 会把'\n'替换成"\r\n", 所以要先切换成二进制模式.
+    {
+        trace_scope trace("write image");
+        if(opts.output_path.empty()) {
+#ifdef _WIN32
+            _setmode(_fileno(stdout), _O_BINARY);
+#endif
+            image.write(std::cout, opts.format);
+            std::cout.flush();
+        }
+        else {
+            std::ofstream file(opts.output_path, std::ios::binary);
+            image.write(file, opts.format);
+            if(!file) {
+                std::cerr << "\nCannot write " << opts.output_path << ".\n";
+                return 1;
+            }
         }
     }
 
-    std::cerr << "\nDone.\n";
+    stats.report(std::cerr, opts.samples_per_pixel);
+    if(opts.print_stats || !opts.stats_json_path.empty()) {
+        // 所有渲染线程都已经结束(分布式渲染时worker的计数已经合并进来), 合并每个线程的计数器.
+        const render_counters counters = global_counters().total();
+        const int threads = distributed ? opts.num_workers + static_cast<int>(opts.worker_commands.size()) : opts.num_threads;     // 每个worker单线程渲染.
+        if(opts.print_stats) write_counters_summary(std::cerr, counters, render_seconds, threads);
+        if(!opts.stats_json_path.empty()) {
+            std::ofstream file(opts.stats_json_path);
+            write_counters_json(file, counters, render_seconds, threads);
+            if(!file) std::cerr << "Cannot write " << opts.stats_json_path << ".\n";
+        }
+    }
+    std::cerr << "Done.\n";
 
     return 0;
 }
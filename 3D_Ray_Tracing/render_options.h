@@ -0,0 +1,216 @@
+#ifndef RENDER_OPTIONS_H
+#define RENDER_OPTIONS_H
+
+#include "framebuffer.h"
+#include "sampler.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// 渲染器的命令行参数. 所有参数都有默认值, 不给任何参数时的行为和原来的单线程渲染器相同(只是输出可以复现).
+struct render_options {
+    int num_threads = static_cast<int>(std::thread::hardware_concurrency());    // 工作线程数目, 默认等于CPU逻辑核数.
+    int tile_size   = 16;                                                       // tile边长, 以像素为单位.
+    unsigned seed   = 0;                                                        // 全局随机数种子, 相同种子得到相同图像.
+    std::string scene_name = "scene1";                                          // 渲染哪个场景, 见scenes.h中的make_scene().
+    std::string scene_path;                                                     // 场景文件, 不为空时代替scene_name. 见scene_file.h.
+    std::string save_scene_path;                                                // 把scene_path读入的场景另存为这个文件(格式转换)然后退出.
+    int image_width = 400;                                                      // 图像宽度, 高度由16:9的比例决定.
+    int max_depth   = 50;                                                       // 反射的最大次数. 也就是光线追踪的最大迭代次数.
+    int rr_depth    = 3;                                                        // 从第几次弹射开始使用俄罗斯轮盘赌终止路径.
+    bool light_sampling = true;                                                 // 对场景中的光源做显式采样(NEE + MIS), 见integrator.h.
+    bool wavefront = false;                                                     // 使用wavefront路径追踪器按阶段渲染, 见wavefront.h. 图像与默认渲染器相同.
+    bool denoise = false;                                                       // 渲染之后用特征引导的à-trous滤波降噪, 见denoiser.h.
+    sampler_type sampler_kind = sampler_type::sobol;                             // 像素, 镜头和散射方向的采样方式.
+    int samples_per_pixel = 100;                                                // 每个像素的采样数. 自适应采样时是平均采样数的参考预算.
+
+    // 自适应采样. adaptive_threshold <= 0时关闭, 每个像素固定采样samples_per_pixel次.
+    double adaptive_threshold = 0.0;                                            // 像素在输出图像上的估计误差低于该值时停止采样.
+    int min_samples = 16;                                                       // 每个像素至少采样的次数, 之后才开始估计误差.
+    int max_samples = 0;                                                        // 每个像素最多采样的次数, 0表示4 * samples_per_pixel.
+    int adaptive_batch = 8;                                                     // 每追加多少个采样检查一次误差.
+
+    image_format format = image_format::ppm;                                    // 输出图像格式.
+    std::string output_path;                                                    // 输出文件, 为空时输出到标准输出.
+
+    // 断点续渲, 见checkpoint.h. checkpoint_path为空时关闭.
+    std::string checkpoint_path;                                                // 检查点文件. 已经存在时从它继续渲染.
+    double checkpoint_interval = 60.0;                                          // 大约每隔多少秒保存一次检查点.
+
+    // 多进程分布式渲染, 见distributed.h. num_workers为0并且worker_commands为空时在本进程中渲染.
+    int num_workers = 0;                                                        // 启动多少个本地worker进程.
+    std::vector<std::string> worker_commands;                                   // 每个命令启动一个worker, 例如"ssh host ./rayTracerMain".
+    double worker_timeout = 60.0;                                               // worker超过这么多秒没有交回tile就认为它已经卡死.
+    bool worker = false;                                                        // 作为worker运行: 从标准输入读取tile, 结果写到标准输出.
+
+    // 渲染统计, 见render_stats.h.
+    bool print_stats = false;                                                   // 渲染结束后在标准错误上输出射线数, 每次弹射的开销等统计.
+    std::string stats_json_path;                                                // 把同样的统计以JSON格式写入这个文件, 为空时不写.
+    std::string trace_path;                                                     // 把各阶段和每个tile的时间线以Chrome trace-event JSON写入这个文件, 见trace.h.
+};
+
+inline void print_usage(const char* program) {
+    std::cerr << "Usage: " << program << " [options] > image.ppm\n"
+              << "  --format F      ppm (binary P6, default) or pfm (32-bit float, linear HDR)\n"
+              << "  --output FILE   write the image to FILE instead of standard output\n"
+              << "  --threads N     number of worker threads (default: hardware concurrency)\n"
+              << "  --tile N        tile size in pixels (default: 16)\n"
+              << "  --seed N        random seed, identical seeds give identical images (default: 0)\n"
+              << "  --scene NAME    scene1 (default), random, forest or cornell\n"
+              << "  --scene-file F  load the scene from a text or binary scene file instead (see scene_file.h)\n"
+              << "  --save-scene F  convert the --scene-file scene to F (text if F ends in .txt, binary otherwise) and exit\n"
+              << "  --width N       image width in pixels, the height follows a 16:9 aspect ratio (default: 400)\n"
+              << "  --max-depth N   maximum number of bounces per path (default: 50)\n"
+              << "  --rr-depth N    bounce at which Russian roulette starts; >= max depth disables it (default: 3)\n"
+              << "  --no-light-sampling  find lights only by chance hits instead of sampling them explicitly (for comparison)\n"
+              << "  --wavefront     trace each tile's paths stage by stage in large path queues; same image as the default renderer\n"
+              << "  --denoise       record first-hit albedo, normal and depth and run an edge-aware a-trous filter over the image\n"
+              << "  --sampler S     sobol (stratified, default) or independent\n"
+              << "  --spp N         samples per pixel (default: 100)\n"
+              << "  --adaptive E    stop sampling a pixel once its estimated error drops below E, e.g. 0.01 (default: off)\n"
+              << "  --min-spp N     adaptive sampling: samples taken before the first error check (default: 16)\n"
+              << "  --max-spp N     adaptive sampling: per-pixel sample limit (default: 4 * spp)\n"
+              << "  --checkpoint F  save progress to F periodically and when done; if F exists, resume from it (a larger --spp adds samples)\n"
+              << "  --checkpoint-interval S  seconds between checkpoints (default: 60)\n"
+              << "  --workers N     render tiles in N local worker processes and merge their results\n"
+              << "  --worker-command CMD  also start a worker with the shell command CMD, e.g. \"ssh host ./rayTracerMain\" (repeatable)\n"
+              << "  --worker-timeout S    re-issue a worker's tiles when it returns nothing for S seconds (default: 60)\n"
+              << "  --stats         print ray counts, rays/sec, cost per bounce and a path-length histogram when done\n"
+              << "  --stats-json F  write the same statistics to F as JSON\n"
+              << "  --trace F       write a timeline of the render phases and of every tile on every thread to F (Chrome trace-event JSON)\n"
+              << "  --worker        (internal) render tiles requested on standard input, write results to standard output\n";
+}
+
+// 解析命令行参数. 遇到不认识的参数或者参数缺少数值时打印用法并返回false.
+inline bool parse_render_options(const int argc, char* argv[], render_options& opts) {
+    for(int k = 1; k < argc; ++k) {
+        const char* arg = argv[k];
+        const bool has_value = k + 1 < argc;
+
+        if(std::strcmp(arg, "--threads") == 0 && has_value)
+            opts.num_threads = std::atoi(argv[++k]);
+        else if(std::strcmp(arg, "--tile") == 0 && has_value)
+            opts.tile_size = std::atoi(argv[++k]);
+        else if(std::strcmp(arg, "--seed") == 0 && has_value)
+            opts.seed = static_cast<unsigned>(std::strtoul(argv[++k], nullptr, 10));
+        else if(std::strcmp(arg, "--scene") == 0 && has_value)
+            opts.scene_name = argv[++k];
+        else if(std::strcmp(arg, "--scene-file") == 0 && has_value)
+            opts.scene_path = argv[++k];
+        else if(std::strcmp(arg, "--save-scene") == 0 && has_value)
+            opts.save_scene_path = argv[++k];
+        else if(std::strcmp(arg, "--width") == 0 && has_value)
+            opts.image_width = std::atoi(argv[++k]);
+        else if(std::strcmp(arg, "--max-depth") == 0 && has_value)
+            opts.max_depth = std::atoi(argv[++k]);
+        else if(std::strcmp(arg, "--rr-depth") == 0 && has_value)
+            opts.rr_depth = std::atoi(argv[++k]);
+        else if(std::strcmp(arg, "--no-light-sampling") == 0)
+            opts.light_sampling = false;
+        else if(std::strcmp(arg, "--wavefront") == 0)
+            opts.wavefront = true;
+        else if(std::strcmp(arg, "--denoise") == 0)
+            opts.denoise = true;
+        else if(std::strcmp(arg, "--sampler") == 0 && has_value && std::strcmp(argv[k+1], "sobol") == 0) {
+            opts.sampler_kind = sampler_type::sobol;
+            ++k;
+        }
+        else if(std::strcmp(arg, "--sampler") == 0 && has_value && std::strcmp(argv[k+1], "independent") == 0) {
+            opts.sampler_kind = sampler_type::independent;
+            ++k;
+        }
+        else if(std::strcmp(arg, "--format") == 0 && has_value && std::strcmp(argv[k+1], "ppm") == 0) {
+            opts.format = image_format::ppm;
+            ++k;
+        }
+        else if(std::strcmp(arg, "--format") == 0 && has_value && std::strcmp(argv[k+1], "pfm") == 0) {
+            opts.format = image_format::pfm;
+            ++k;
+        }
+        else if(std::strcmp(arg, "--output") == 0 && has_value)
+            opts.output_path = argv[++k];
+        else if(std::strcmp(arg, "--spp") == 0 && has_value)
+            opts.samples_per_pixel = std::atoi(argv[++k]);
+        else if(std::strcmp(arg, "--adaptive") == 0 && has_value)
+            opts.adaptive_threshold = std::atof(argv[++k]);
+        else if(std::strcmp(arg, "--min-spp") == 0 && has_value)
+            opts.min_samples = std::atoi(argv[++k]);
+        else if(std::strcmp(arg, "--max-spp") == 0 && has_value)
+            opts.max_samples = std::atoi(argv[++k]);
+        else if(std::strcmp(arg, "--checkpoint") == 0 && has_value)
+            opts.checkpoint_path = argv[++k];
+        else if(std::strcmp(arg, "--checkpoint-interval") == 0 && has_value)
+            opts.checkpoint_interval = std::atof(argv[++k]);
+        else if(std::strcmp(arg, "--workers") == 0 && has_value)
+            opts.num_workers = std::atoi(argv[++k]);
+        else if(std::strcmp(arg, "--worker-command") == 0 && has_value)
+            opts.worker_commands.push_back(argv[++k]);
+        else if(std::strcmp(arg, "--worker-timeout") == 0 && has_value)
+            opts.worker_timeout = std::atof(argv[++k]);
+        else if(std::strcmp(arg, "--worker") == 0)
+            opts.worker = true;
+        else if(std::strcmp(arg, "--stats") == 0)
+            opts.print_stats = true;
+        else if(std::strcmp(arg, "--stats-json") == 0 && has_value)
+            opts.stats_json_path = argv[++k];
+        else if(std::strcmp(arg, "--trace") == 0 && has_value)
+            opts.trace_path = argv[++k];
+        else {
+            print_usage(argv[0]);
+            return false;
+        }
+    }
+
+    if(opts.num_threads < 1) opts.num_threads = 1;      // hardware_concurrency()在无法获知核数时会返回0.
+    if(opts.tile_size < 1) {
+        std::cerr << "tile size must be positive.\n";
+        return false;
+    }
+    if(opts.image_width < 16) {
+        std::cerr << "image width must be at least 16.\n";
+        return false;
+    }
+    if(opts.samples_per_pixel < 1) {
+        std::cerr << "samples per pixel must be positive.\n";
+        return false;
+    }
+    if(opts.wavefront && opts.adaptive_threshold > 0.0) {
+        std::cerr << "--wavefront does not support adaptive sampling.\n";
+        return false;
+    }
+    if(opts.wavefront && !opts.checkpoint_path.empty()) {
+        std::cerr << "--wavefront does not support checkpoints.\n";
+        return false;
+    }
+    const bool distributed = opts.num_workers > 0 || !opts.worker_commands.empty();
+    if(distributed && (opts.wavefront || !opts.checkpoint_path.empty())) {
+        std::cerr << "--workers and --worker-command do not support --wavefront or --checkpoint.\n";
+        return false;
+    }
+    if(opts.num_workers < 0 || opts.worker_timeout <= 0.0) {
+        std::cerr << "worker count must not be negative and worker timeout must be positive.\n";
+        return false;
+    }
+    if(opts.checkpoint_interval <= 0.0) {
+        std::cerr << "checkpoint interval must be positive.\n";
+        return false;
+    }
+    if(!opts.save_scene_path.empty() && opts.scene_path.empty()) {
+        std::cerr << "--save-scene needs a --scene-file to convert.\n";
+        return false;
+    }
+    if(opts.max_samples == 1) {
+        std::cerr << "--max-spp must be at least 2: adaptive sampling needs two samples to estimate a pixel's error.\n";
+        return false;
+    }
+    if(opts.max_samples <= 0) opts.max_samples = 4 * opts.samples_per_pixel;
+    opts.min_samples = std::max(2, std::min(opts.min_samples, opts.max_samples));      // 估计方差至少需要两个采样.
+    return true;
+}
+
+#endif
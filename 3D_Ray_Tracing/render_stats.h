@@ -0,0 +1,137 @@
+#ifndef RENDER_STATS_H
+#define RENDER_STATS_H
+
+#include "material.h"
+
+#include <cstdint>
+#include <deque>
+#include <iostream>
+#include <mutex>
+
+/*
+    渲染统计: 决定渲染开销的几个量的计数器, 用来估算rays/sec和每次弹射的开销.
+
+    每个线程第一次计数时向counter_registry登记一块自己的render_counters, 之后只在这块内存上做普通的(非原子的)加法,
+    线程之间没有任何共享写入; 每块按照cache line对齐, 不同线程的计数器不会落在同一条cache line上(false sharing).
+    内存块归registry所有, 线程退出之后仍然保留, 渲染结束后由主线程把所有块加起来.
+    热的循环(BVH遍历, 一个叶子中的多个图元)先在局部变量中计数, 结束时再加到线程的计数器上, 每次求交只多一次thread_local访问.
+*/
+const int path_length_buckets = 64;
+
+struct alignas(64) render_counters {
+    uint64_t primary_rays = 0;                      // 相机射线.
+    uint64_t secondary_rays = 0;                    // 散射之后继续追踪的射线.
+    uint64_t shadow_rays = 0;                       // 光源采样的遮挡测试射线.
+    uint64_t bvh_nodes = 0;                         // BVH遍历中访问(测试包围盒)的节点数, 包括几何体自己的底层BVH.
+    uint64_t sphere_tests = 0;                      // 射线与球的求交测试, sphere和sphere_set中的每个球各算一次.
+    uint64_t triangle_tests = 0;                    // 射线与三角形的求交测试.
+    uint64_t scatters[material_tag_count] = {};     // 每种材质scatter()的调用次数, 下标是material_tag.
+    uint64_t rr_kills = 0;                          // 被俄罗斯轮盘赌终止的路径.
+    uint64_t path_lengths[path_length_buckets] = {};    // 路径长度(主射线加上次级射线的段数)的直方图, 最后一格包括所有更长的路径.
+
+    void merge(const render_counters& other);
+    // 记录n条长度为length的路径.
+    void record_path(const int length, const uint64_t n = 1) { path_lengths[length < path_length_buckets ? length : path_length_buckets - 1] += n; }
+};
+
+void render_counters::merge(const render_counters& other) {
+    primary_rays += other.primary_rays;
+    secondary_rays += other.secondary_rays;
+    shadow_rays += other.shadow_rays;
+    bvh_nodes += other.bvh_nodes;
+    sphere_tests += other.sphere_tests;
+    triangle_tests += other.triangle_tests;
+    for(int k = 0; k < material_tag_count; ++k) scatters[k] += other.scatters[k];
+    rr_kills += other.rr_kills;
+    for(int k = 0; k < path_length_buckets; ++k) path_lengths[k] += other.path_lengths[k];
+}
+
+class counter_registry {
+    public:
+        // 为调用线程分配一块计数器. 只在每个线程第一次计数时加锁一次.
+        render_counters& add_thread() {
+            std::lock_guard<std::mutex> lock(mtx);
+            blocks.emplace_back();
+            return blocks.back();
+        }
+
+        // 所有块的和. 只在没有线程正在渲染时调用(渲染线程join之后, 它们的写入对调用线程可见).
+        render_counters total() const {
+            std::lock_guard<std::mutex> lock(mtx);
+            render_counters sum;
+            for(const render_counters& block : blocks) sum.merge(block);
+            return sum;
+        }
+
+        // 清零所有块. 同样只在没有线程正在渲染时调用.
+        void reset() {
+            std::lock_guard<std::mutex> lock(mtx);
+            for(render_counters& block : blocks) block = render_counters{};
+        }
+
+    private:
+        mutable std::mutex mtx;
+        std::deque<render_counters> blocks;         // deque追加元素时已有元素的地址不变.
+};
+
+inline counter_registry& global_counters() {
+    static counter_registry registry;
+    return registry;
+}
+
+// 当前线程的计数器. thread_local指针是常量初始化的, 每次访问只是一次线程局部的读取, 不经过动态初始化的guard.
+inline render_counters& thread_counters() {
+    thread_local render_counters* counters = nullptr;
+    if(!counters) counters = &global_counters().add_thread();
+    return *counters;
+}
+
+/*
+    输出统计. seconds是渲染花费的墙上时间, threads是渲染线程数(或者分布式渲染的worker数),
+    每次弹射的开销按照 seconds * threads / (主射线 + 次级射线) 计算, 即一个线程追踪一段路径(求交, 着色, 光源采样)平均花费的时间.
+*/
+inline void write_counters_summary(std::ostream& out, const render_counters& c, const double seconds, const int threads) {
+    static const char* const material_names[material_tag_count] = {"lambertian", "metal", "dielectric", "diffuse_light", "custom"};
+    const double segments = static_cast<double>(c.primary_rays + c.secondary_rays);
+    const double rays = segments + static_cast<double>(c.shadow_rays);
+    const double traced = rays > 0.0 ? rays : 1.0;
+    uint64_t paths = 0, path_segments = 0;
+    for(int k = 0; k < path_length_buckets; ++k) {
+        paths += c.path_lengths[k];
+        path_segments += c.path_lengths[k] * static_cast<uint64_t>(k);
+    }
+
+    out << "Rays: " << c.primary_rays << " primary, " << c.secondary_rays << " secondary, " << c.shadow_rays << " shadow; "
+        << (seconds > 0.0 ? rays / seconds : 0.0) << " rays/sec in " << seconds << " s\n"
+        << "Cost per bounce: " << (segments > 0.0 ? 1e9 * seconds * threads / segments : 0.0) << " thread-ns\n"
+        << "Per ray: " << c.bvh_nodes / traced << " BVH nodes, " << c.sphere_tests / traced << " sphere tests, " << c.triangle_tests / traced << " triangle tests\n"
+        << "Scatter calls:";
+    for(int k = 0; k < material_tag_count; ++k)
+        if(c.scatters[k] > 0) out << ' ' << material_names[k] << ' ' << c.scatters[k];
+    out << "\nPaths: " << paths << ", " << (paths > 0 ? static_cast<double>(path_segments) / paths : 0.0) << " segments on average, "
+        << c.rr_kills << " ended by Russian roulette\nPath lengths:";
+    for(int k = 1; k < path_length_buckets; ++k)
+        if(c.path_lengths[k] > 0) out << ' ' << k << (k == path_length_buckets - 1 ? "+:" : ":") << c.path_lengths[k];
+    out << '\n';
+}
+
+// 一行JSON, 字段与write_counters_summary()相同. path_lengths[k]是长度为k的路径数(最后一项包括更长的路径).
+inline void write_counters_json(std::ostream& out, const render_counters& c, const double seconds, const int threads) {
+    static const char* const material_names[material_tag_count] = {"lambertian", "metal", "dielectric", "diffuse_light", "custom"};
+    const double segments = static_cast<double>(c.primary_rays + c.secondary_rays);
+    const double rays = segments + static_cast<double>(c.shadow_rays);
+    out << "{\"seconds\": " << seconds << ", \"threads\": " << threads
+        << ", \"primary_rays\": " << c.primary_rays << ", \"secondary_rays\": " << c.secondary_rays << ", \"shadow_rays\": " << c.shadow_rays
+        << ", \"rays_per_sec\": " << (seconds > 0.0 ? rays / seconds : 0.0)
+        << ", \"thread_ns_per_bounce\": " << (segments > 0.0 ? 1e9 * seconds * threads / segments : 0.0)
+        << ", \"bvh_nodes\": " << c.bvh_nodes << ", \"sphere_tests\": " << c.sphere_tests << ", \"triangle_tests\": " << c.triangle_tests
+        << ", \"scatters\": {";
+    for(int k = 0; k < material_tag_count; ++k)
+        out << (k > 0 ? ", " : "") << '"' << material_names[k] << "\": " << c.scatters[k];
+    out << "}, \"rr_kills\": " << c.rr_kills << ", \"path_lengths\": [";
+    for(int k = 0; k < path_length_buckets; ++k)
+        out << (k > 0 ? ", " : "") << c.path_lengths[k];
+    out << "]}\n";
+}
+
+#endif
@@ -0,0 +1,237 @@
+#ifndef RENDERER_H
+#define RENDERER_H
+
+#include "adaptive_sampling.h"
+#include "camera.h"
+#include "checkpoint.h"
+#include "framebuffer.h"
+#include "integrator.h"
+#include "render_options.h"
+#include "surface.h"
+#include "tile_scheduler.h"
+#include "trace.h"
+#include "wavefront.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <string>
+
+/*
+    render_tile: 渲染tile tl中的所有像素. image_width和image_height是整幅图像的大小, features为true时同时记录第一个交点的特征, 供降噪使用.
+    state按照tile内行优先的顺序保存每个像素的状态(见checkpoint.h中的pixel_progress), 每个像素从state中的状态继续采样,
+    采样到sample_limit个(自适应采样时是做完达到sample_limit的那一批)为止, 再把状态写回state. state全部为默认值, sample_limit为0时就是完整地渲染一遍.
+    render_frame和分布式渲染的worker(见distributed.h)都通过这一函数渲染, 所以同一个像素无论在哪个线程, 哪个进程中渲染, 结果都逐位相同.
+*/
+void render_tile(const surface& world, const light_list& lights, const camera& cam, const render_options& opts, const int image_width, const int image_height,
+                 const bool features, const tile& tl, pixel_progress* state, int sample_limit) {
+    const bool adaptive = opts.adaptive_threshold > 0.0;
+    const int target = adaptive ? opts.max_samples : opts.samples_per_pixel;
+    sample_limit = sample_limit > 0 ? std::min(sample_limit, target) : target;
+
+    /*  
+        计算机图形学做的事情和计算机视觉刚好相反. 计算机图形学是给定3D空间场景生成2D图片, 而计算机图形学是给定2D图片, 分析2D图片所包含的3D物体信息.
+        下图的w-h 2D平面坐标空间, 是我们要生成的渲染图像image的平面空间.
+            1. 渲染图像宽为width, 表示的是一列有width个像素点; 高为height, 表示的是一行有height个像素点. 渲染图像总共包含 包含width*height个像素. 
+            2. 每个像素点坐落于边长为1单位像素长度(两个像素点的距离)的小正方形的中心. 这个小正方形所覆盖的区域都会使用像素点的颜色来着色.
+            3. 渲染图像只表示我们想要渲染的像素点总数有多少个, 并不表示光线追踪程序中成像平面image_plane的大小. image_plane的大小是有摄像机视角, 聚焦距离和屏幕比例共同决定的.
+               在光线追踪器程序中, 我们需要把渲染图像空间的像素点的坐标位置(i,j)正确映射成光线追踪程序中在3D世界坐标系空间下成像平面上对应的正确位置(u,v).
+               如果成像平面大, 这通常意味着摄像机视角范围大, 这意味着被正确映射后的两个相邻像素点之间的在u-v平面的间隔距离就会大, 这样好处是渲染图像显示3D场景空间范围大, 但图像容易不清晰.
+               如果成像平面小, 这通常意味着摄像机视角范围小, 这意味着被正确映射后的两个相邻像素点之间的在u-v平面的间隔距离就会小, 这样好处是渲染图像会比较清晰, 但显示的3D场景空间范围会小.              
+            4. 渲染图像的遍历的默认顺序是从高到低, 从左到右, 所以index j从iheight的遍历
+
+        ^ height h-轴       j = image_height - 1 to 0 with stepsize = -1.
+        |
+        |
+        | (0, image_h-1)
+        |--------------------------------
+        |                               |
+        |                               |
+        |            image              |
+        |                               |
+        |    pixels = width x height    |
+        |                               |           i =  0 to image_width - 1 with stepsize = 1.
+        |                               |
+        ---------------------------------------------> width w-轴
+     (0,0)                              (image_width - 1, 0)
+     */
+    // 每个采样开始之前都用(全局种子, 像素坐标, 采样编号)重新设置当前线程的sampler, 因此渲染结果与线程数目, tile大小以及tile被哪个线程渲染都无关.
+    sampler& rng = thread_sampler();
+    rng.set_type(opts.sampler_kind);
+    for(int j = tl.y0; j < tl.y1; ++j) {
+        for(int i = tl.x0; i < tl.x1; ++i) {
+            pixel_progress& progress = state[static_cast<size_t>(j - tl.y0) * (tl.x1 - tl.x0) + (i - tl.x0)];
+            pixel_estimator pixel = progress.estimator;
+            path_features feature_sum = progress.features;
+            /*  抗锯齿, antialiasing.
+                这里我们使用随机采样抗锯齿, 在w-h平面上以像素点为中心的边长为1个单位像素长度的正方形邻域内随机采样着色位置.
+                然后把这样采样的着色位置映射到u-v成像平面, 以此在u-v成像平面我们也就在一个特定邻域内随机取到了像素点在成像平面的坐标位置.
+                然后对每一个这样在邻域内随机取得的像素点坐标位置进行执行光线追踪算法算出颜色, 对所有这样的采样像素位置的颜色值进行平均化, 最终就是该像素点的值.
+
+                随机采样是很简单的抗锯齿技术, 还有更高级一些的分层随机采样抗锯齿技术, 对像素点选取的采样邻域进行扰动. 
+                此时虽然初始仍以像素点为中心选取邻域, 但是引入的随机扰动会使得选取的邻域的中心相对于像素点出现随机偏离. */
+            auto take_samples = [&](const int count) {
+                for(int k = pixel.count(), k_end = pixel.count() + count; k < k_end; ++k) {
+                    rng.start_pixel_sample(opts.seed, i, j, k);
+                    /* 这里用了一个很巧妙的方法, 当确定了渲染图像像素点的空间坐标值(i,j)之后, 并没有直接把两个整数(i,j)传给摄像机让摄像机来转换映射.
+                       而是先除以对应的image_width-1和image_height-1, 得到的是这一像素点与渲染图像空间关于两个坐标轴的分量比例值.
+                       对于h轴分量j, 得到了比例分量s, s在[0,1]之间; 对于w轴分量i, 得到了比例分量t, t在[0,1]之间.
+                       然后把这两个比例分量传给摄像机, 这样做可以很明显简化摄像机内部把像素点在渲染图像空间坐标值转换到u-v平面上正确世界坐标值的计算. 
+                       我们只需要在摄像机内部存储好:
+                                        1. 摄像机位置lookfrom, 成像平面的左下角顶点坐标lower_left_vertex;
+                                        2. 成像平面在u-v空间上, u轴的长度为成像平面宽度的基向量horizontal, v轴的长度为成像平面高度的基向量vertical.
+                       然后使用从h-w平面得到的像素点比例分量s和t, 就能立即确定像素点映射在成像平面的正确位置(即正确的世界坐标值), 或者确定从视点发出的指向这一像素点在成像平面位置的射线的方向:
+                                        loc     = lower_left_vertex + s*horizontal + t*vertical
+                                        ray_dir = (lower_left_vertex - cam_origin) + s*horizontal + t*vertical */
+                    const point2 jitter = sample_2d();
+                    double s = (i + jitter.x) / (image_width - 1);
+                    double t = (j + jitter.y) / (image_height - 1);
+                    // 以视点射向成像平面最左下角顶点的射线为base, 通过add在horizontal所代表的的u轴基向量和vertical所代表的v轴基向量的增量offset, 来确定正确的穿过成像平面"像素点"的射线.
+                    // base_dir     = lower_left_corner - origin        => 表示的是以视点射向成像平面最左下角顶点的射线
+                    // x_dir_offset = u*horizontal; y_dir_offset = v*vertical;
+                    ray r = cam.get_ray(s, t);          // 摄像机这个对象负责生成光线. 
+                    // 找到第一个与3D场景物体列表的相交点, 然后计算像素值!
+                    if(features) {
+                        path_features f;
+                        pixel.add(ray_color(r, world, lights, opts.max_depth, opts.rr_depth, &f));
+                        feature_sum.albedo += f.albedo;
+                        feature_sum.normal += f.normal;
+                        feature_sum.depth += f.depth;
+                    }
+                    else
+                        pixel.add(ray_color(r, world, lights, opts.max_depth, opts.rr_depth));
+                }
+            };
+
+            if(adaptive) {
+                // 自适应采样: 先采样min_samples次, 之后每追加adaptive_batch个采样检查一次误差, 误差足够小或者达到max_samples时停止.
+                // 天空等平坦区域很快就会停止, 省下来的采样留给玻璃球, 阴影边缘等噪声大的像素, 它们最多可以采样max_samples次.
+                // 第k个采样的随机数只由(种子, 像素, k)决定, 所以自适应采样的结果同样与线程数目和tile大小无关.
+                // 从检查点继续时, 批次的划分与不中断时相同, 每次检查误差时的采样数也相同, 所以停在同一个采样数上.
+                if(pixel.count() < opts.min_samples) take_samples(opts.min_samples - pixel.count());
+                while(pixel.count() < sample_limit && pixel.error() > opts.adaptive_threshold)
+                    take_samples(std::min(opts.adaptive_batch, opts.max_samples - pixel.count()));
+            }
+            else
+                take_samples(std::max(0, sample_limit - pixel.count()));
+
+            progress = {pixel, feature_sum};
+        }
+    }
+}
+
+// 把一个tile中像素的状态写入image(features为true时包括特征), 并把这一tile的采样数统计合并到stats中.
+// 只写入这一tile的像素, 不同tile的像素互不重叠, 多个线程同时写入不同的tile无需加锁.
+void store_tile(const render_options& opts, const tile& tl, const pixel_progress* state, const bool features, framebuffer& image, sampling_stats& stats) {
+    long long tile_samples = 0, tile_converged = 0;
+    int tile_min = opts.samples_per_pixel, tile_max = 0;
+    for(int j = tl.y0; j < tl.y1; ++j) {
+        for(int i = tl.x0; i < tl.x1; ++i) {
+            const pixel_progress& progress = *state++;
+            const pixel_estimator& pixel = progress.estimator;
+            image.set(i, j, pixel.sum(), pixel.count());
+            if(features) image.set_features(i, j, progress.features.albedo, progress.features.normal, progress.features.depth, pixel.mean_variance());
+            // 自适应采样时, 在达到最大采样数之前误差就已经足够小的像素算作收敛.
+            if(opts.adaptive_threshold > 0.0 && pixel.count() < opts.max_samples && pixel.error() <= opts.adaptive_threshold) ++tile_converged;
+            tile_samples += pixel.count();
+            tile_min = std::min(tile_min, pixel.count());
+            tile_max = std::max(tile_max, pixel.count());
+        }
+    }
+    stats.merge(tile_samples, static_cast<long long>(tl.x1 - tl.x0) * (tl.y1 - tl.y0), tile_converged, tile_min, tile_max);
+}
+
+/*
+    render_frame: 把场景world通过摄像机cam渲染到image中, lights是显式采样的光源(可以为空). 图像的大小就是image的大小, 其余参数(线程数, 采样数, 种子等)都来自opts.
+    实际花费的采样数累加到stats中. rayTracerMain和rayTracerBenchmark共用这一函数, 所以基准测试测量的就是真正的渲染路径.
+    opts.wavefront时交给wavefront.h中的render_frame_wavefront().
+
+    checkpoint不为空时, 每个像素从checkpoint中保存的状态继续采样到sample_limit个(见render_tile()), 再把状态写回checkpoint.
+    分多轮渲染(见render_frame_checkpointed())时, 每一轮只是把sample_limit提高一些.
+*/
+void render_frame(const surface& world, const light_list& lights, const camera& cam, const render_options& opts, framebuffer& image, sampling_stats& stats,
+                  const bool show_progress = true, render_checkpoint* checkpoint = nullptr, const int sample_limit = 0) {
+    if(opts.wavefront) {
+        render_frame_wavefront(world, lights, cam, opts, image, stats, show_progress);
+        return;
+    }
+
+    tile_scheduler scheduler(image.width(), image.height(), opts.tile_size);
+    std::atomic<int> tiles_remaining(static_cast<int>(scheduler.tiles().size()));
+    const bool features = image.has_features();
+    scheduler.run(opts.num_threads, [&](const tile& tl, int) {
+        trace_scope trace("tile", "tile", tl.index);
+        // 像素的状态先放在tile自己的数组中, 渲染完成之后只把采样累加值和采样数写入共享缓冲区.
+        // IO操作是一个很耗时的操作, 所以等全部渲染完成之后再统一输出.
+        std::vector<pixel_progress> state(static_cast<size_t>(tl.x1 - tl.x0) * (tl.y1 - tl.y0));
+        if(checkpoint) {
+            for(int j = tl.y0, k = 0; j < tl.y1; ++j)
+                for(int i = tl.x0; i < tl.x1; ++i, ++k) state[k] = checkpoint->at(i, j);
+        }
+        render_tile(world, lights, cam, opts, image.width(), image.height(), features, tl, state.data(), sample_limit);
+        store_tile(opts, tl, state.data(), features, image, stats);
+        if(checkpoint) {
+            for(int j = tl.y0, k = 0; j < tl.y1; ++j)
+                for(int i = tl.x0; i < tl.x1; ++i, ++k) checkpoint->at(i, j) = state[k];
+        }
+        const int remaining = --tiles_remaining;
+        if(show_progress) print_tiles_remaining(remaining);
+    });
+    if(show_progress) std::cerr << '\n';
+}
+
+/*
+    render_frame_checkpointed: 带检查点的渲染. 如果opts.checkpoint_path已经存在, 先从它恢复每个像素的状态, 然后分多轮渲染,
+    每一轮把所有像素的采样数上限sample_limit提高一些, 距离上次保存超过opts.checkpoint_interval秒时把状态保存到opts.checkpoint_path, 全部完成时再保存一次.
+    渲染被终止时, 用相同的命令重新运行即可从最后一个检查点继续; 给出更大的--spp则在已有的采样上继续追加.
+
+    每一轮的采样数根据上一轮的速度估计, 使一轮大约花费checkpoint_interval秒. 轮与轮之间只多一次等待所有线程完成的同步和一次保存(几MB的顺序写),
+    相对于几十秒的一轮渲染可以忽略. 检查点不能加载(与当前参数不一致, 文件损坏)或者保存失败时返回false, 错误信息写入error.
+*/
+bool render_frame_checkpointed(const surface& world, const light_list& lights, const camera& cam, const render_options& opts, framebuffer& image, sampling_stats& stats, std::string& error) {
+    using clock = std::chrono::steady_clock;
+    render_checkpoint checkpoint(opts, image.width(), image.height());
+    if(checkpoint.load(opts.checkpoint_path, error))
+        std::cerr << "Resuming from " << opts.checkpoint_path << " with " << checkpoint.total_samples() << " samples.\n";
+    else if(!error.empty())
+        return false;
+
+    const int target = opts.adaptive_threshold > 0.0 ? opts.max_samples : opts.samples_per_pixel;
+    const double pixels = static_cast<double>(image.width()) * image.height();
+    int sample_limit = checkpoint.min_samples();
+    int step = 1;                               // 第一轮每个像素只采样一次, 用来估计渲染速度.
+    auto last_save = clock::now();
+    do {
+        sample_limit = static_cast<int>(std::min<long long>(target, static_cast<long long>(sample_limit) + step));
+        const long long samples_before = checkpoint.total_samples();
+        const auto pass_start = clock::now();
+        stats.reset();
+        {
+            trace_scope trace("render pass", "samples_per_pixel", sample_limit);
+            render_frame(world, lights, cam, opts, image, stats, false, &checkpoint, sample_limit);
+        }
+        std::cerr << "\rSamples per pixel: " << sample_limit << " / " << target << "   " << std::flush;
+
+        const auto now = clock::now();
+        if(sample_limit >= target || now - last_save >= std::chrono::duration<double>(opts.checkpoint_interval)) {
+            if(!checkpoint.save(opts.checkpoint_path)) {
+                error = "Cannot write checkpoint " + opts.checkpoint_path;
+                return false;
+            }
+            last_save = clock::now();
+        }
+
+        // 按照这一轮每秒的采样数估计下一轮的步长. 这一轮没有采样(所有像素已经超过上限)时步长加倍.
+        const double seconds = std::chrono::duration<double>(now - pass_start).count();
+        const double samples = static_cast<double>(stats.total_samples - samples_before);
+        if(samples > 0.0 && seconds > 0.0)
+            step = static_cast<int>(std::max(1.0, std::min(1e6, samples / seconds * opts.checkpoint_interval / pixels)));
+        else
+            step = std::min(2 * step, 1 << 20);
+    } while(sample_limit < target);
+    std::cerr << '\n';
+    return true;
+}
+
+#endif
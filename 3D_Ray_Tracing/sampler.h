@@ -0,0 +1,190 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include <cstdint>
+
+/*
+    PCG32随机数引擎 (Melissa O'Neill, "PCG: A Family of Simple Fast Space-Efficient Statistically Good Algorithms for Random Number Generation").
+    状态只有两个64位整数(state和选择序列的inc), 每生成一个32位随机数只需要一次64位乘加和一次置换, 比std::mt19937(约2.5KB状态)轻得多,
+    统计质量却更好. 不同的inc对应互不相关的随机数序列(stream), 因此可以为每个像素的每个采样分配一个独立的序列.
+*/
+class pcg32 {
+    public:
+        // default and parameter constructor.
+        explicit pcg32(const uint64_t init_state = 0x853c49e6748fea9bULL, const uint64_t init_seq = 0xda3e39cb94b95bdbULL) { seed(init_state, init_seq); }
+
+    public:
+        // 设置初始状态和序列编号, 与PCG参考实现pcg32_srandom_r一致.
+        void seed(const uint64_t init_state, const uint64_t init_seq) {
+            state = 0u;
+            inc = (init_seq << 1u) | 1u;        // inc必须是奇数.
+            next_uint();
+            state += init_state;
+            next_uint();
+        }
+
+        // 返回一个[0, 2^32)范围内均匀分布的32位无符号整数.
+        uint32_t next_uint() {
+            const uint64_t old_state = state;
+            state = old_state * 6364136223846793005ULL + inc;
+            const uint32_t xorshifted = static_cast<uint32_t>(((old_state >> 18u) ^ old_state) >> 27u);
+            const uint32_t rot = static_cast<uint32_t>(old_state >> 59u);
+            return (xorshifted >> rot) | (xorshifted << ((~rot + 1u) & 31u));
+        }
+
+        // 返回一个[0, bound)范围内均匀分布的整数. 通过拒绝采样去掉取模带来的偏差.
+        uint32_t next_uint(const uint32_t bound) {
+            const uint32_t threshold = (~bound + 1u) % bound;
+            while(true) {
+                const uint32_t r = next_uint();
+                if(r >= threshold) return r % bound;
+            }
+        }
+
+        // 返回一个[0, 1)范围内均匀分布的双精度浮点数. 32位精度对于蒙特卡洛采样已经足够.
+        double next_double() { return next_uint() * (1.0 / 4294967296.0); }
+
+    private:
+        uint64_t state;
+        uint64_t inc;
+};
+
+// SplitMix64的混合函数, 把(种子, 像素, 采样编号)这样相关性很强的整数打散成互不相关的64位数, 用作PCG32的初始状态和序列编号.
+inline uint64_t mix_bits(uint64_t v) {
+    v ^= v >> 30;
+    v *= 0xbf58476d1ce4e5b9ULL;
+    v ^= v >> 27;
+    v *= 0x94d049bb133111ebULL;
+    v ^= v >> 31;
+    return v;
+}
+
+// 把32位整数的二进制位反转, 第0位变成第31位.
+inline uint32_t reverse_bits(uint32_t x) {
+    x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+    x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+    x = ((x >> 4) & 0x0f0f0f0fu) | ((x & 0x0f0f0f0fu) << 4);
+    x = ((x >> 8) & 0x00ff00ffu) | ((x & 0x00ff00ffu) << 8);
+    return (x >> 16) | (x << 16);
+}
+
+/*
+    Owen scrambling的哈希实现(Brent Burley, "Practical Hash-based Owen Scrambling", JCGT 2020, 这里使用Nathan Vegdahl改进过的哈希).
+    Owen scrambling对[0,1)区间做随机的嵌套置换: 随机决定是否交换左右两半, 再对每一半递归地做同样的事情.
+    它保持点集的分层(stratification)性质不变, 又去掉了Sobol序列规则的网格结构, 不同种子得到互不相关的点集.
+    从高位到低位的嵌套置换相当于对反转之后的二进制位做一次"只让低位影响高位"的哈希.
+*/
+inline uint32_t laine_karras_permutation(uint32_t x, const uint32_t seed) {
+    x ^= x * 0x3d20adeau;
+    x += seed;
+    x *= (seed >> 16) | 1u;
+    x ^= x * 0x05526c56u;
+    x ^= x * 0x53a22864u;
+    return x;
+}
+
+inline uint32_t nested_uniform_scramble(const uint32_t x, const uint32_t seed) {
+    return reverse_bits(laine_karras_permutation(reverse_bits(x), seed));
+}
+
+/*
+    Sobol序列的前两个维度. 第0维是van der Corput序列(把下标的二进制位反转), 第1维的生成矩阵由本原多项式x + 1确定,
+    方向数满足 v_1 = 2^31, v_k = v_{k-1} ^ (v_{k-1} >> 1). 前2^m个点在[0,1)^2的每个面积为2^-m的基本区间中恰好各有一个点.
+    生成矩阵对下标是线性的(按位异或), 所以把下标按字节拆开, 每个字节查一次预先算好的256项表, 代替逐位循环32次.
+*/
+struct sobol_dimension1_table {
+    uint32_t entries[4][256];
+
+    sobol_dimension1_table() {
+        uint32_t v[32];
+        v[0] = 1u << 31;
+        for(int k = 1; k < 32; ++k) v[k] = v[k-1] ^ (v[k-1] >> 1);
+        for(int byte = 0; byte < 4; ++byte) {
+            for(uint32_t b = 0; b < 256; ++b) {
+                uint32_t result = 0u;
+                for(int bit = 0; bit < 8; ++bit)
+                    if((b >> bit) & 1u) result ^= v[8*byte + bit];
+                entries[byte][b] = result;
+            }
+        }
+    }
+};
+
+inline uint32_t sobol_dimension1(const uint32_t index) {
+    static const sobol_dimension1_table table;
+    return table.entries[0][index & 0xffu] ^ table.entries[1][(index >> 8) & 0xffu]
+         ^ table.entries[2][(index >> 16) & 0xffu] ^ table.entries[3][index >> 24];
+}
+
+// 二维采样点.
+struct point2 {
+    double x, y;
+};
+
+// 采样器的类型. independent: 每个随机数独立均匀分布; sobol: 每两个维度是一组打乱并且scramble过的二维Sobol点.
+enum class sampler_type { independent, sobol };
+
+/*
+    sampler: 渲染器使用的采样器. 它不是一个全局共享的随机数发生器, 而是由每个渲染线程各自持有一份(见utility.h中的thread_sampler()).
+
+    基于计数器(counter-based)的播种方式: 每渲染一个像素的一个采样之前, 都用(全局种子, 像素坐标, 采样编号)重新设置PCG32的状态.
+    于是一个采样所用到的全部随机数只由这三个整数决定, 与这个采样由哪个线程计算, 线程数目, tile大小以及渲染顺序都无关,
+    相同的种子总能得到逐位相同的图像. 这也使得以后可以只补算某些像素的某些采样(例如分布式渲染或者中断后继续渲染).
+
+    低差异(low-discrepancy)采样: 路径上的像素抖动, 镜头采样, 每次弹射的散射方向等都通过next_1d()/next_2d()按顺序取"维度".
+    sobol类型时, 每次next_2d()使用一组新的维度: 像素的第k个采样取二维Sobol序列的第k个点, 下标和两个坐标都用
+    (像素, 维度编号)导出的种子做Owen scrambling(padded 2D Sobol). 同一像素的前N个采样在每一组维度上都是分层的,
+    比独立的均匀随机数更均匀地覆盖像素面积, 镜头和半球, 相同采样数下方差更小; 不同像素, 不同维度之间互不相关.
+    next_double()始终返回PCG32的独立随机数, 供不需要分层的场合(例如场景构建)使用.
+*/
+class sampler {
+    public:
+        // 用一个种子和一个序列编号设置状态. 场景构建等与像素无关的随机过程使用这一接口.
+        void seed(const uint64_t seed_value, const uint64_t stream = 0) {
+            rng.seed(mix_bits(seed_value ^ mix_bits(stream)), mix_bits(stream + 0x9e3779b97f4a7c15ULL));
+            pixel_sample_index = 0u;
+            sample_seed = 0u;
+            dimension = 0u;
+        }
+
+        void set_type(const sampler_type t) { type = t; }
+
+        // 开始像素(px, py)的第sample_index个采样.
+        void start_pixel_sample(const uint64_t seed_value, const int px, const int py, const uint64_t sample_index) {
+            const uint64_t pixel_key = (static_cast<uint64_t>(static_cast<uint32_t>(py)) << 32) | static_cast<uint32_t>(px);
+            rng.seed(mix_bits(sample_index ^ mix_bits(seed_value)), mix_bits(pixel_key ^ mix_bits(seed_value + 1)));
+            pixel_sample_index = static_cast<uint32_t>(sample_index);
+            sample_seed = static_cast<uint32_t>(mix_bits(pixel_key ^ mix_bits(seed_value + 2)));
+            dimension = 0u;
+        }
+
+        double next_double() { return rng.next_double(); }
+        uint32_t next_uint() { return rng.next_uint(); }
+        uint32_t next_uint(const uint32_t bound) { return rng.next_uint(bound); }
+
+        // 取下一个维度的一维采样值, [0,1)范围.
+        double next_1d() { return type == sampler_type::independent ? rng.next_double() : next_2d().x; }
+
+        // 取下一组维度的二维采样点, [0,1)^2范围.
+        point2 next_2d() {
+            if(type == sampler_type::independent) {
+                const double x = rng.next_double();
+                return {x, rng.next_double()};
+            }
+            const uint32_t dim_seed = static_cast<uint32_t>(mix_bits(sample_seed ^ (static_cast<uint64_t>(dimension++) << 32)));
+            const uint32_t index = nested_uniform_scramble(pixel_sample_index, dim_seed);
+            // 第0维是reverse_bits(index), 对它做nested_uniform_scramble时两次反转相互抵消.
+            const uint32_t x = reverse_bits(laine_karras_permutation(index, dim_seed * 0x9e3779b9u + 1u));
+            const uint32_t y = nested_uniform_scramble(sobol_dimension1(index), dim_seed * 0x85ebca6bu + 2u);
+            return {x * (1.0 / 4294967296.0), y * (1.0 / 4294967296.0)};
+        }
+
+    private:
+        pcg32 rng;
+        sampler_type type = sampler_type::independent;
+        uint32_t pixel_sample_index = 0u;
+        uint32_t sample_seed = 0u;      // 由(种子, 像素)导出, 每个像素的Sobol点集互不相关.
+        uint32_t dimension = 0u;        // 当前采样已经用掉的二维维度组数.
+};
+
+#endif
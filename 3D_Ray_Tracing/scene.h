@@ -0,0 +1,31 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include "arena.h"
+#include "camera.h"
+#include "light.h"
+#include "material.h"
+#include "surface_list.h"
+
+/*
+    scene: 一个完整的3D场景. 它持有场景中所有的材质和物体, 以及观察这个场景的摄像机.
+    几何体通过材质表返回的const material*引用材质, 所以材质表必须和物体一起存活到渲染结束, 把它们放在同一个scene对象中就保证了这一点.
+
+    场景中的物体用arena.create<T>()分配, 再把指针add进objects. 物体在arena中连续存放, 场景销毁时arena一次性释放所有物体;
+    材质同样连续存放在材质表的arena中. arena声明在最前面, 所以最后析构, 析构objects等成员时物体都还有效.
+*/
+struct scene {
+    scene_arena arena;              // 场景中所有物体的存储.
+    material_table materials;       // 场景中所有的材质.
+    surface_list objects;           // 场景中所有的物体.
+    camera cam;
+    light_list lights;              // 场景中的光源, 场景构建完成之后由build_lights()收集.
+
+    void build_lights() {
+        lights = light_list();
+        objects.collect_lights(lights);
+        lights.build();
+    }
+};
+
+#endif
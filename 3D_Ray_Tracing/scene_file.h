@@ -0,0 +1,496 @@
+#ifndef SCENE_FILE_H
+#define SCENE_FILE_H
+
+#include "instance.h"
+#include "mapped_file.h"
+#include "material.h"
+#include "scene.h"
+#include "sphere_set.h"
+#include "triangle_mesh.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/*
+    场景文件. 场景不再只能写成C++函数, 修改场景不需要重新编译. 有两种格式:
+
+    1. 文本格式, 便于手写和修改. 每行一条语句, #之后是注释:
+           camera  lookfrom_x lookfrom_y lookfrom_z  lookat_x lookat_y lookat_z  vup_x vup_y vup_z  aov  aperture  focus_dist
+           lambertian  名字  r g b
+           metal       名字  r g b  fuzz
+           dielectric  名字  折射率
+           light       名字  r g b                  (发光材质diffuse_light, r g b是辐射亮度, 可以大于1)
+           sphere      x y z  半径  材质名字
+           mesh        OBJ文件名  材质名字
+           instance    OBJ文件名  材质名字  x y z  绕y轴旋转角度  缩放
+       材质必须先定义后使用. 没有camera语句时使用camera的默认参数. OBJ文件名是相对于场景文件所在目录的路径, 不能包含空格.
+       instance把网格先缩放, 再绕y轴旋转, 最后平移到(x, y, z). 同一个OBJ文件和材质无论放置多少次都只加载一次, 见instance.h.
+
+    2. 二进制格式(little-endian), 便于快速加载大场景:
+           scene_file_header                        文件头, 包括各种材质的数目, 球的数目和摄像机参数
+           material_record[material_count]          每个材质40字节
+           double center_x[n], center_y[n], center_z[n], radius[n]
+           uint32_t material_index[n]
+           mesh_count个网格记录, 每个为 mesh_file_record, 之后是文件名(版本1的记录只有材质编号和文件名长度)
+       球以SoA形式存放, 与sphere_set内部的存放方式相同. 加载时把文件映射到内存, 每种材质只分配一次内存,
+       球的数组直接从映射的内存整块复制到sphere_set中, 一遍扫描完成, 没有逐个物体的堆内存分配.
+
+    文本格式先解析成scene_description, 再用与二进制格式相同的批量接口构建场景; scene_description也可以写成任意一种格式, 用于格式转换.
+*/
+
+enum class material_kind : uint32_t { lambertian = 0, metal = 1, dielectric = 2, diffuse_light = 3 };
+const int material_kind_count = 4;
+const int header_kind_count = 3;        // 文件头只记录前三种材质的数目. diffuse_light是后加的, 为了不改变文件头的布局, 加载时扫描统计.
+
+// 一个材质的参数. lambertian, diffuse_light: params = (r, g, b); metal: params = (r, g, b, fuzz); dielectric: params[0] = 折射率.
+struct material_record {
+    uint32_t kind;
+    uint32_t reserved;
+    double params[4];
+};
+
+struct scene_file_header {
+    char magic[8];                              // "RTSCENE1"
+    uint32_t version;
+    uint32_t material_count;
+    uint64_t sphere_count;
+    uint32_t kind_count[header_kind_count];     // 前三种材质的数目, 加载时与扫描材质记录得到的数目核对.
+    uint32_t mesh_count;                        // 三角形网格的数目, 网格记录放在球的数组之后.
+    double camera_params[12];                   // lookfrom, lookat, vup, aov, aperture, focus_dist.
+};
+
+const char scene_file_magic[8] = {'R', 'T', 'S', 'C', 'E', 'N', 'E', '1'};
+const uint32_t scene_file_version = 2;
+
+// 场景引用的一个OBJ网格, 整个网格使用材质materials[material]. instanced为true时按照placement放置网格的一个instance.
+struct mesh_reference {
+    std::string path;
+    uint32_t material;
+    bool instanced = false;
+    double placement[5] = {0.0, 0.0, 0.0, 0.0, 1.0};      // x, y, z, 绕y轴旋转角度, 缩放.
+
+    affine_transform object_to_world() const {
+        return affine_transform::translate(vec3(placement[0], placement[1], placement[2]))
+             * affine_transform::rotate(vec3(0.0, 1.0, 0.0), placement[3]) * affine_transform::scale(placement[4]);
+    }
+};
+
+struct mesh_file_record {
+    uint32_t material;
+    uint32_t path_length;
+    uint32_t instanced;
+    uint32_t reserved;
+    double placement[5];
+};
+
+// 场景的完整描述, 只有数据, 不持有任何材质或物体对象.
+struct scene_description {
+    double camera_params[12] = {0.0, 0.0, 0.0,  0.0, 0.0, -1.0,  0.0, 1.0, 0.0,  90.0, 0.0, 1.0};
+    std::vector<material_record> materials;
+    std::vector<double> center_x, center_y, center_z, radius;
+    std::vector<uint32_t> material_index;
+    std::vector<mesh_reference> meshes;
+
+    size_t sphere_count() const { return radius.size(); }
+};
+
+// 按照摄像机参数和图像宽高比构造摄像机.
+inline camera make_camera(const double* p, const double aspect_ratio) {
+    return camera(point3(p[0], p[1], p[2]), point3(p[3], p[4], p[5]), vec3(p[6], p[7], p[8]), p[9], aspect_ratio, p[10], p[11]);
+}
+
+/*
+    按照材质记录构建材质表和材质指针数组palette, palette[k]是第k个材质. 先统计每种材质的数目, 每种材质只分配一次内存.
+    每种材质的数目总是扫描一遍materials统计得到. kind_count是文件头中的前三种材质的数目, 可以为nullptr;
+    不为nullptr时必须与扫描的结果一致, 否则文件已经损坏, 不能按照文件头中的(可能任意大的)数目分配内存.
+*/
+inline bool build_materials(const material_record* records, const size_t count, const uint32_t* header_count,
+                            material_table& table, std::vector<const material*>& palette, std::string& error) {
+    uint32_t kind_count[material_kind_count] = {0, 0, 0, 0};
+    for(size_t k = 0; k < count; ++k)
+        if(records[k].kind < material_kind_count) ++kind_count[records[k].kind];
+    if(header_count != nullptr && !std::equal(header_count, header_count + header_kind_count, kind_count)) {
+        error = "material counts in the header do not match the material records";
+        return false;
+    }
+
+    lambertian* lambertians = table.add_block<lambertian>(kind_count[0]);
+    metal* metals           = table.add_block<metal>(kind_count[1]);
+    dielectric* dielectrics = table.add_block<dielectric>(kind_count[2]);
+    diffuse_light* lights   = table.add_block<diffuse_light>(kind_count[3]);
+    uint32_t used[material_kind_count] = {0, 0, 0, 0};
+
+    palette.resize(count);
+    for(size_t k = 0; k < count; ++k) {
+        const material_record& m = records[k];
+        if(m.kind >= material_kind_count || used[m.kind] >= kind_count[m.kind]) {
+            error = "invalid material record " + std::to_string(k);
+            return false;
+        }
+        const uint32_t slot = used[m.kind]++;
+        switch(static_cast<material_kind>(m.kind)) {
+            case material_kind::lambertian:
+                lambertians[slot] = lambertian(color(m.params[0], m.params[1], m.params[2]));
+                palette[k] = &lambertians[slot];
+                break;
+            case material_kind::metal:
+                metals[slot] = metal(color(m.params[0], m.params[1], m.params[2]), m.params[3]);
+                palette[k] = &metals[slot];
+                break;
+            case material_kind::dielectric:
+                dielectrics[slot] = dielectric(m.params[0]);
+                palette[k] = &dielectrics[slot];
+                break;
+            case material_kind::diffuse_light:
+                lights[slot] = diffuse_light(color(m.params[0], m.params[1], m.params[2]));
+                palette[k] = &lights[slot];
+                break;
+        }
+    }
+    return true;
+}
+
+// 场景文件所在的目录(带末尾的分隔符), 网格文件名相对于这个目录.
+inline std::string scene_directory(const std::string& scene_path) {
+    const size_t slash = scene_path.find_last_of("/\\");
+    return slash == std::string::npos ? std::string() : scene_path.substr(0, slash + 1);
+}
+
+inline std::string resolve_scene_path(const std::string& base_dir, const std::string& path) {
+    const bool absolute = !path.empty() && (path[0] == '/' || path[0] == '\\' || (path.size() > 1 && path[1] == ':'));
+    return absolute ? path : base_dir + path;
+}
+
+// 用SoA数组构建场景: 材质表, 一个包含所有球的sphere_set, 每个网格一个triangle_mesh, 以及摄像机.
+inline bool build_scene(const double* camera_params, const material_record* records, const size_t material_count, const uint32_t* kind_count,
+                        const double* cx, const double* cy, const double* cz, const double* radii, const uint32_t* material_ids, const size_t sphere_count,
+                        const std::vector<mesh_reference>& meshes, const std::string& base_dir,
+                        const double aspect_ratio, scene& world, std::string& error) {
+    std::vector<const material*> palette;
+    if(!build_materials(records, material_count, kind_count, world.materials, palette, error)) return false;
+    for(size_t k = 0; k < sphere_count; ++k) {
+        if(material_ids[k] >= material_count) {
+            error = "sphere " + std::to_string(k) + " uses undefined material " + std::to_string(material_ids[k]);
+            return false;
+        }
+    }
+
+    if(sphere_count > 0) {
+        auto spheres = world.arena.create<sphere_set>();
+        spheres->add_spheres(palette, cx, cy, cz, radii, material_ids, sphere_count);
+        spheres->build();
+        world.objects.add(spheres);
+    }
+    // 同一个文件和材质的网格只加载一次, 多次放置时共享.
+    std::map<std::pair<std::string, uint32_t>, triangle_mesh*> loaded_meshes;
+    for(const mesh_reference& m : meshes) {
+        if(m.material >= material_count) {
+            error = "mesh " + m.path + " uses undefined material " + std::to_string(m.material);
+            return false;
+        }
+        triangle_mesh*& mesh = loaded_meshes[{m.path, m.material}];
+        if(!mesh) {
+            mesh = world.arena.create<triangle_mesh>(palette[m.material]);
+            if(!mesh->load_obj(resolve_scene_path(base_dir, m.path), error)) return false;
+        }
+        if(m.instanced) world.objects.add(world.arena.create<instance>(mesh, m.object_to_world()));
+        else world.objects.add(mesh);
+    }
+    world.cam = make_camera(camera_params, aspect_ratio);
+    return true;
+}
+
+inline bool build_scene(const scene_description& desc, const std::string& base_dir, const double aspect_ratio, scene& world, std::string& error) {
+    return build_scene(desc.camera_params, desc.materials.data(), desc.materials.size(), nullptr,
+                       desc.center_x.data(), desc.center_y.data(), desc.center_z.data(), desc.radius.data(), desc.material_index.data(),
+                       desc.sphere_count(), desc.meshes, base_dir, aspect_ratio, world, error);
+}
+
+/*
+    二进制文件的布局检查. 返回各个数组在文件中的起始位置. 文件头的大小是8的倍数, 材质记录是40字节, 所以所有double数组都是8字节对齐的.
+*/
+struct scene_file_layout {
+    const scene_file_header* header;
+    const material_record* materials;
+    const double* center_x;
+    const double* center_y;
+    const double* center_z;
+    const double* radius;
+    const uint32_t* material_index;
+    std::vector<mesh_reference> meshes;         // 网格记录很少, 解析时直接复制出来.
+};
+
+inline bool is_little_endian_host() {
+    const uint32_t one = 1u;
+    unsigned char first;
+    std::memcpy(&first, &one, 1);
+    return first == 1;
+}
+
+inline bool parse_scene_file_layout(const unsigned char* data, const size_t size, scene_file_layout& layout, std::string& error) {
+    if(!is_little_endian_host()) {
+        error = "binary scene files are only supported on little-endian machines";
+        return false;
+    }
+    if(size < sizeof(scene_file_header) || std::memcmp(data, scene_file_magic, sizeof(scene_file_magic)) != 0) {
+        error = "not a binary scene file";
+        return false;
+    }
+    layout.header = reinterpret_cast<const scene_file_header*>(data);
+    const scene_file_header& h = *layout.header;
+    if(h.version != 1 && h.version != scene_file_version) {
+        error = "unsupported scene file version " + std::to_string(h.version);
+        return false;
+    }
+
+    const uint64_t n = h.sphere_count;
+    const uint64_t expected = sizeof(scene_file_header) + uint64_t(h.material_count) * sizeof(material_record) + n * (4 * sizeof(double) + sizeof(uint32_t));
+    if(n > (uint64_t(1) << 40) || expected > size) {
+        error = "truncated scene file";
+        return false;
+    }
+
+    const unsigned char* p = data + sizeof(scene_file_header);
+    layout.materials = reinterpret_cast<const material_record*>(p);
+    p += h.material_count * sizeof(material_record);
+    layout.center_x = reinterpret_cast<const double*>(p);
+    layout.center_y = layout.center_x + n;
+    layout.center_z = layout.center_y + n;
+    layout.radius   = layout.center_z + n;
+    layout.material_index = reinterpret_cast<const uint32_t*>(layout.radius + n);
+
+    p = reinterpret_cast<const unsigned char*>(layout.material_index + n);
+    const unsigned char* const end = data + size;
+    layout.meshes.clear();
+    const size_t record_size = h.version == 1 ? 2 * sizeof(uint32_t) : sizeof(mesh_file_record);
+    for(uint32_t k = 0; k < h.mesh_count; ++k) {
+        mesh_file_record record = {0, 0, 0, 0, {0.0, 0.0, 0.0, 0.0, 1.0}};
+        if(static_cast<size_t>(end - p) < record_size) {
+            error = "truncated scene file";
+            return false;
+        }
+        std::memcpy(&record, p, record_size);
+        p += record_size;
+        if(static_cast<size_t>(end - p) < record.path_length) {
+            error = "truncated scene file";
+            return false;
+        }
+        mesh_reference m;
+        m.path.assign(reinterpret_cast<const char*>(p), record.path_length);
+        m.material = record.material;
+        m.instanced = record.instanced != 0;
+        std::memcpy(m.placement, record.placement, sizeof(m.placement));
+        layout.meshes.push_back(m);
+        p += record.path_length;
+    }
+    return true;
+}
+
+// 把二进制场景文件映射到内存并直接构建场景.
+inline bool load_binary_scene(const mapped_file& file, const std::string& base_dir, const double aspect_ratio, scene& world, std::string& error) {
+    scene_file_layout layout;
+    if(!parse_scene_file_layout(file.data(), file.size(), layout, error)) return false;
+    const scene_file_header& h = *layout.header;
+    return build_scene(h.camera_params, layout.materials, h.material_count, h.kind_count,
+                       layout.center_x, layout.center_y, layout.center_z, layout.radius, layout.material_index, h.sphere_count,
+                       layout.meshes, base_dir, aspect_ratio, world, error);
+}
+
+// 解析文本格式的场景文件.
+inline bool parse_text_scene(std::istream& in, scene_description& desc, std::string& error) {
+    std::unordered_map<std::string, uint32_t> material_names;
+    std::string line;
+    for(int line_number = 1; std::getline(in, line); ++line_number) {
+        const size_t comment = line.find('#');
+        if(comment != std::string::npos) line.erase(comment);
+        std::istringstream words(line);
+        std::string keyword;
+        if(!(words >> keyword)) continue;       // 空行.
+
+        bool ok = true;
+        if(keyword == "camera") {
+            for(double& v : desc.camera_params) ok = ok && static_cast<bool>(words >> v);
+        }
+        else if(keyword == "lambertian" || keyword == "metal" || keyword == "dielectric" || keyword == "light") {
+            material_record m = {};
+            std::string name;
+            ok = static_cast<bool>(words >> name);
+            if(keyword == "lambertian" || keyword == "light") {
+                m.kind = static_cast<uint32_t>(keyword == "light" ? material_kind::diffuse_light : material_kind::lambertian);
+                ok = ok && static_cast<bool>(words >> m.params[0] >> m.params[1] >> m.params[2]);
+            }
+            else if(keyword == "metal") {
+                m.kind = static_cast<uint32_t>(material_kind::metal);
+                ok = ok && static_cast<bool>(words >> m.params[0] >> m.params[1] >> m.params[2] >> m.params[3]);
+            }
+            else {
+                m.kind = static_cast<uint32_t>(material_kind::dielectric);
+                ok = ok && static_cast<bool>(words >> m.params[0]);
+            }
+            if(ok) {
+                material_names[name] = static_cast<uint32_t>(desc.materials.size());
+                desc.materials.push_back(m);
+            }
+        }
+        else if(keyword == "sphere") {
+            double x, y, z, r;
+            std::string name;
+            ok = static_cast<bool>(words >> x >> y >> z >> r >> name);
+            auto it = material_names.find(name);
+            if(ok && it == material_names.end()) {
+                error = "line " + std::to_string(line_number) + ": undefined material " + name;
+                return false;
+            }
+            if(ok) {
+                desc.center_x.push_back(x);
+                desc.center_y.push_back(y);
+                desc.center_z.push_back(z);
+                desc.radius.push_back(r);
+                desc.material_index.push_back(it->second);
+            }
+        }
+        else if(keyword == "mesh" || keyword == "instance") {
+            mesh_reference m;
+            std::string name;
+            ok = static_cast<bool>(words >> m.path >> name);
+            m.instanced = keyword == "instance";
+            for(int k = 0; ok && m.instanced && k < 5; ++k)
+                ok = static_cast<bool>(words >> m.placement[k]);
+            auto it = material_names.find(name);
+            if(ok && it == material_names.end()) {
+                error = "line " + std::to_string(line_number) + ": undefined material " + name;
+                return false;
+            }
+            if(ok) {
+                m.material = it->second;
+                desc.meshes.push_back(m);
+            }
+        }
+        else
+            ok = false;
+
+        if(!ok) {
+            error = "line " + std::to_string(line_number) + ": cannot parse \"" + line + "\"";
+            return false;
+        }
+    }
+    return true;
+}
+
+// 读取任意一种格式的场景文件到scene_description中, 用于格式转换.
+inline bool load_scene_description(const std::string& path, scene_description& desc, std::string& error) {
+    mapped_file file(path);
+    if(!file.is_open()) {
+        error = "cannot open " + path;
+        return false;
+    }
+    if(file.size() >= sizeof(scene_file_magic) && std::memcmp(file.data(), scene_file_magic, sizeof(scene_file_magic)) == 0) {
+        scene_file_layout layout;
+        if(!parse_scene_file_layout(file.data(), file.size(), layout, error)) return false;
+        const scene_file_header& h = *layout.header;
+        const size_t n = h.sphere_count;
+        std::memcpy(desc.camera_params, h.camera_params, sizeof(desc.camera_params));
+        desc.materials.assign(layout.materials, layout.materials + h.material_count);
+        desc.center_x.assign(layout.center_x, layout.center_x + n);
+        desc.center_y.assign(layout.center_y, layout.center_y + n);
+        desc.center_z.assign(layout.center_z, layout.center_z + n);
+        desc.radius.assign(layout.radius, layout.radius + n);
+        desc.material_index.assign(layout.material_index, layout.material_index + n);
+        desc.meshes = layout.meshes;
+        return true;
+    }
+    std::istringstream in(std::string(reinterpret_cast<const char*>(file.data()), file.size()));
+    return parse_text_scene(in, desc, error);
+}
+
+/*
+    加载场景文件并构建场景. 根据文件开头的magic判断是二进制格式还是文本格式.
+*/
+inline bool load_scene_file(const std::string& path, const double aspect_ratio, scene& world, std::string& error) {
+    mapped_file file(path);
+    if(!file.is_open()) {
+        error = "cannot open " + path;
+        return false;
+    }
+    if(file.size() >= sizeof(scene_file_magic) && std::memcmp(file.data(), scene_file_magic, sizeof(scene_file_magic)) == 0)
+        return load_binary_scene(file, scene_directory(path), aspect_ratio, world, error);
+
+    scene_description desc;
+    std::istringstream in(std::string(reinterpret_cast<const char*>(file.data()), file.size()));
+    if(!parse_text_scene(in, desc, error)) return false;
+    return build_scene(desc, scene_directory(path), aspect_ratio, world, error);
+}
+
+inline void write_text_scene(std::ostream& out, const scene_description& desc) {
+    out.precision(17);
+    out << "# 3D_Ray_Tracing scene file\ncamera";
+    for(const double v : desc.camera_params) out << ' ' << v;
+    out << '\n';
+    for(size_t k = 0; k < desc.materials.size(); ++k) {
+        const material_record& m = desc.materials[k];
+        switch(static_cast<material_kind>(m.kind)) {
+            case material_kind::lambertian:
+                out << "lambertian m" << k << ' ' << m.params[0] << ' ' << m.params[1] << ' ' << m.params[2] << '\n';
+                break;
+            case material_kind::metal:
+                out << "metal m" << k << ' ' << m.params[0] << ' ' << m.params[1] << ' ' << m.params[2] << ' ' << m.params[3] << '\n';
+                break;
+            case material_kind::dielectric:
+                out << "dielectric m" << k << ' ' << m.params[0] << '\n';
+                break;
+            case material_kind::diffuse_light:
+                out << "light m" << k << ' ' << m.params[0] << ' ' << m.params[1] << ' ' << m.params[2] << '\n';
+                break;
+        }
+    }
+    for(size_t k = 0; k < desc.sphere_count(); ++k)
+        out << "sphere " << desc.center_x[k] << ' ' << desc.center_y[k] << ' ' << desc.center_z[k] << ' ' << desc.radius[k] << " m" << desc.material_index[k] << '\n';
+    for(const mesh_reference& m : desc.meshes) {
+        out << (m.instanced ? "instance " : "mesh ") << m.path << " m" << m.material;
+        for(int k = 0; m.instanced && k < 5; ++k) out << ' ' << m.placement[k];
+        out << '\n';
+    }
+}
+
+inline void write_binary_scene(std::ostream& out, const scene_description& desc) {
+    scene_file_header h = {};
+    std::memcpy(h.magic, scene_file_magic, sizeof(h.magic));
+    h.version = scene_file_version;
+    h.material_count = static_cast<uint32_t>(desc.materials.size());
+    h.sphere_count = desc.sphere_count();
+    h.mesh_count = static_cast<uint32_t>(desc.meshes.size());
+    for(const material_record& m : desc.materials)
+        if(m.kind < header_kind_count) ++h.kind_count[m.kind];
+    std::memcpy(h.camera_params, desc.camera_params, sizeof(h.camera_params));
+
+    const size_t n = desc.sphere_count();
+    out.write(reinterpret_cast<const char*>(&h), sizeof(h));
+    out.write(reinterpret_cast<const char*>(desc.materials.data()), static_cast<std::streamsize>(desc.materials.size() * sizeof(material_record)));
+    for(const std::vector<double>* values : {&desc.center_x, &desc.center_y, &desc.center_z, &desc.radius})
+        out.write(reinterpret_cast<const char*>(values->data()), static_cast<std::streamsize>(n * sizeof(double)));
+    out.write(reinterpret_cast<const char*>(desc.material_index.data()), static_cast<std::streamsize>(n * sizeof(uint32_t)));
+    for(const mesh_reference& m : desc.meshes) {
+        mesh_file_record record = {m.material, static_cast<uint32_t>(m.path.size()), m.instanced ? 1u : 0u, 0u, {}};
+        std::memcpy(record.placement, m.placement, sizeof(record.placement));
+        out.write(reinterpret_cast<const char*>(&record), sizeof(record));
+        out.write(m.path.data(), static_cast<std::streamsize>(m.path.size()));
+    }
+}
+
+// 保存场景文件. 文件名以.txt结尾时写文本格式, 否则写二进制格式.
+inline bool save_scene_file(const std::string& path, const scene_description& desc) {
+    const bool text = path.size() >= 4 && path.compare(path.size() - 4, 4, ".txt") == 0;
+    std::ofstream out(path, std::ios::binary);
+    if(text) write_text_scene(out, desc);
+    else write_binary_scene(out, desc);
+    return static_cast<bool>(out);
+}
+
+#endif
@@ -0,0 +1,237 @@
+#ifndef SCENES_H
+#define SCENES_H
+
+#include "instance.h"
+#include "material.h"
+#include "scene.h"
+#include "sphere.h"
+#include "sphere_set.h"
+#include "triangle_mesh.h"
+
+#include <string>
+#include <vector>
+
+// 场景几乎全部由球组成, 所以把所有球放进一个sphere_set, 用SoA存储并用SIMD求交, 而不是每个球单独make_shared一个sphere对象.
+// 物体都分配在world.arena中, 材质都在world.materials中, 构建场景时没有零散的小对象分配.
+scene random_scene(const double aspect_ratio) {
+    scene world;
+    auto spheres = world.arena.create<sphere_set>();
+    
+    auto ground_material = world.materials.add<lambertian>(color(0.5, 0.5, 0.5));
+    spheres->add(point3(0,-1000,0), 1000, ground_material);
+
+    for (int a = -11; a < 11; a++) {
+        for (int b = -11; b < 11; b++) {
+            auto choose_mat = random_double();
+            point3 center(a + 0.9*random_double(), 0.2, b + 0.9*random_double());
+            
+            if ((center - point3(4, 0.2, 0)).length() > 0.9) {
+                const material* sphere_material;
+                
+                if (choose_mat < 0.8) {
+                    // diffuse
+                    auto albedo = random_vec3() * random_vec3();
+                    sphere_material = world.materials.add<lambertian>(albedo);
+                    spheres->add(center, 0.2, sphere_material);
+                } 
+                else if (choose_mat < 0.95) {
+                    // metal
+                    auto albedo = random_vec3(0.5, 1);
+                    auto fuzz = random_double(0, 0.5);
+                    sphere_material = world.materials.add<metal>(albedo, fuzz);
+                    spheres->add(center, 0.2, sphere_material);
+                } 
+                else {
+                    // glass
+                    sphere_material = world.materials.add<dielectric>(1.5);
+                    spheres->add(center, 0.2, sphere_material);
+                }
+            }
+        }
+    }
+
+    auto material1 = world.materials.add<dielectric>(1.5);
+    spheres->add(point3(0, 1, 0), 1.0, material1);
+    auto material2 = world.materials.add<lambertian>(color(0.4, 0.2, 0.1));
+    spheres->add(point3(-4, 1, 0), 1.0, material2);
+    auto material3 = world.materials.add<metal>(color(0.7, 0.6, 0.5), 0.0);
+    spheres->add(point3(4, 1, 0), 1.0, material3);
+    
+    spheres->build();
+    world.objects.add(spheres);
+
+    point3 lookfrom(13.0, 2.0, 3.0);         // 右手坐标系, 这个视角就离球远一些, 从上方俯视球.
+    point3 lookat(0.0, 0.0, 0.0);
+    vec3 vup(0.0, 1.0, 0.0);
+    double aov = 20.0;
+    double aperture = 0.1;
+    double focus_dist = 10.0; //(lookfrom - lookat).length();               // 让lookat点就为成像平面中心.
+    world.cam = camera(lookfrom, lookat, vup, aov, aspect_ratio, aperture, focus_dist);
+    return world;
+}
+
+scene scene1(const double aspect_ratio) {
+    scene world;
+    auto spheres = world.arena.create<sphere_set>();
+    
+    auto material_ground = world.materials.add<lambertian>(color(0.8, 0.8, 0.0));
+    auto material_center = world.materials.add<lambertian>(color(0.1, 0.2, 0.5));
+    auto material_left   = world.materials.add<dielectric>(1.5);
+    auto material_right  = world.materials.add<metal>(color(0.8, 0.6, 0.2), 0.0);
+    
+    spheres->add(point3( 0.0, -100.5, -1.0), 100.0, material_ground);
+    spheres->add(point3( 0.0, 0.0, -1.0), 0.5, material_center);
+    spheres->add(point3(-1.0, 0.0, -1.0), 0.5, material_left);
+    spheres->add(point3( 1.0, 0.0, -1.0), 0.5, material_right);
+
+    spheres->build();
+    world.objects.add(spheres);
+
+    // camera.
+    //camera cam(point3(-2.0,2.0,1.0), point3(0.0,0.0,-1.0), vec3(0.0,1.0,0.0), 90.0, aspect_ratio);
+    //camera cam(point3(-2.0,2.0,1.0), point3(0.0,0.0,-1.0), vec3(0.0,1.0,0.0), 20.0, aspect_ratio);      // 缩小视角, 可视场景范围变小, 视野变深, 越能看清楚物体纹理
+    world.cam = camera(point3(0.0,0.0,0.0), point3(0.0,0.0,-1.0), vec3(0.0,1.0,0.0), 90.0, aspect_ratio, 0.0, 1.0);
+    return world;
+}
+
+/*
+    scene1最初的写法, 每个球单独make_shared一个sphere对象:
+    // Define material object. RGB -> red & green & blue. 
+    // 折射率是一个RGB向量, 对每个基颜色反射率不同, 折射率分量每个值都在[0.0, 1.0]之间, 值越大对于这一基颜色反射能力越强.
+
+    // world->background.
+    // 不同的材质, 分配不同的折射率. 这一漫反射材质更能反射黄光, 红+绿 = 黄.
+    auto material_ground = world.materials.add<lambertian>(color(0.8, 0.8, 0.0));
+    world.objects.add(std::make_shared<sphere>(point3(0.0, -100.5, -1.0), 100.0, material_ground));        // 这一方式定义的球实则是表示一个地面background.
+    
+    // world->spheres. 三个球.
+    //auto material_center = world.materials.add<lambertian>(color(0.7, 0.3, 0.3));      // 这一漫反射材质更能反射红光.
+    //auto material_center = world.materials.add<dielectric>(1.5);           // 电介质材质, 折射率ir = 1.5. typically air = 1.0, glass = 1.3–1.7, diamond =2.4
+    auto material_center = world.materials.add<lambertian>(color(0.1, 0.2, 0.5));      // 这一漫反射材质更能反射蓝光.
+    world.objects.add(std::make_shared<sphere>(point3(0.0, 0.0, -1.0), 0.5, material_center));
+    
+    // 这一金属材质均匀反射光. 所以其镜面反射能让这一球体把背景原封不动的反射出来. 模糊反射系数为0.3, 模糊度低
+    // auto material_left   = world.materials.add<metal>(color(0.8, 0.8, 0.8), 0.3);     
+    auto material_left   = world.materials.add<dielectric>(1.5);           // 电介质材质, 折射率ir = 1.5. typically air = 1.0, glass = 1.3–1.7, diamond =2.4
+    world.objects.add(std::make_shared<sphere>(point3(-1.0, 0.0, -1.0), 0.5, material_left));
+    world.objects.add(std::make_shared<sphere>(point3(-1.0, 0.0, -1.0), -0.45, material_left));      // 半径为负, 表面法向量向内指向, 一正球一"负"球实现空心玻璃球效果.
+
+    // 金属材质更能反射红光和绿光, 红+绿=黄, 所以这一表面会偏黄绿. 模糊反射系数为1.0, 模糊度强.
+    // auto material_right  = world.materials.add<metal>(color(0.8, 0.6, 0.2), 1.0);         
+    auto material_right = world.materials.add<metal>(color(0.8, 0.6, 0.2), 0.0);        // 模糊系数为0.0, 无模糊. 精确镜面反射.  
+    world.objects.add(std::make_shared<sphere>(point3(1.0, 0.0, -1.0), 0.5, material_right));
+    */
+
+/*
+    forest: 几种树的模型各建一次, 再用instance以不同的位置, 朝向和大小重复放置一万次.
+    每棵树由一个sphere_set表示(树干加树冠共约90个球), 自带底层BVH; 所有instance放进main()中的bvh_node, 即顶层BVH.
+    场景中相当于有约90万个球, 但几何数据只有几百个球, 其余是每次放置一个instance对象.
+*/
+scene forest_scene(const double aspect_ratio) {
+    scene world;
+
+    auto ground = world.arena.create<sphere_set>();
+    ground->add(point3(0.0, -1000.0, 0.0), 1000.0, world.materials.add<lambertian>(color(0.35, 0.45, 0.2)));
+    ground->build();
+    world.objects.add(ground);
+
+    // 树的模型: 底部在原点, 树干沿y轴, 树冠是一个圆锥形的球堆.
+    const material* bark = world.materials.add<lambertian>(color(0.35, 0.22, 0.1));
+    const color leaf_colors[] = {color(0.1, 0.35, 0.1), color(0.2, 0.45, 0.1), color(0.1, 0.3, 0.2)};
+    std::vector<const surface*> models;
+    for(const color& leaf_color : leaf_colors) {
+        const material* leaves = world.materials.add<lambertian>(leaf_color);
+        auto tree = world.arena.create<sphere_set>();
+        for(int k = 0; k < 6; ++k)
+            tree->add(point3(0.0, 0.08 * k, 0.0), 0.07, bark);
+        for(int k = 0; k < 84; ++k) {
+            const double h = random_double();                       // 树冠中的相对高度, 越往上越窄.
+            const double spread = 0.35 * (1.0 - h);
+            const vec3 offset(random_double(-spread, spread), 0.4 + 0.9 * h, random_double(-spread, spread));
+            tree->add(point3(0.0, 0.0, 0.0) + offset, random_double(0.08, 0.14), leaves);
+        }
+        tree->build();
+        models.push_back(tree);
+    }
+
+    const int rows = 100;
+    const double spacing = 0.6;
+    for(int a = 0; a < rows; ++a) {
+        for(int b = 0; b < rows; ++b) {
+            const vec3 position((a - rows/2 + random_double(-0.3, 0.3)) * spacing, 0.0, (b - rows/2 + random_double(-0.3, 0.3)) * spacing);
+            const affine_transform placement = affine_transform::translate(position)
+                                             * affine_transform::rotate(vec3(0.0, 1.0, 0.0), random_double(0.0, 360.0))
+                                             * affine_transform::scale(random_double(0.7, 1.3));
+            world.objects.add(world.arena.create<instance>(models[random_int(0, static_cast<int>(models.size()) - 1)], placement));
+        }
+    }
+
+    world.cam = camera(point3(0.0, 6.0, 34.0), point3(0.0, 0.0, 0.0), vec3(0.0, 1.0, 0.0), 35.0, aspect_ratio, 0.0, 1.0);
+    return world;
+}
+
+// 往mesh中加入一个四边形p0 p1 p2 p3(按顺序相邻的四个顶点), 拆成两个三角形.
+void add_quad(triangle_mesh& mesh, const point3& p0, const point3& p1, const point3& p2, const point3& p3) {
+    const uint32_t base = static_cast<uint32_t>(mesh.vertex_count());
+    mesh.add_vertex(p0);
+    mesh.add_vertex(p1);
+    mesh.add_vertex(p2);
+    mesh.add_vertex(p3);
+    mesh.add_triangle(base, base + 1, base + 2);
+    mesh.add_triangle(base, base + 2, base + 3);
+}
+
+/*
+    cornell: 封闭的房间, 唯一的光源是天花板上的一小块面光源, 摄像机在房间里面, 看不到天空.
+    只靠路径碰巧射中光源时, 光源占的立体角很小, 同样的采样数下噪点远多于显式光源采样(见integrator.h), 用来比较两者.
+*/
+scene cornell_scene(const double aspect_ratio) {
+    scene world;
+    const material* white = world.materials.add<lambertian>(color(0.73, 0.73, 0.73));
+    const material* red   = world.materials.add<lambertian>(color(0.65, 0.05, 0.05));
+    const material* green = world.materials.add<lambertian>(color(0.12, 0.45, 0.15));
+    const material* lamp  = world.materials.add<diffuse_light>(color(15.0, 15.0, 15.0));
+
+    // 房间: x在[-1.6, 1.6], y在[0, 2], z在[-2, 1].
+    const double x0 = -1.6, x1 = 1.6, y0 = 0.0, y1 = 2.0, z0 = -2.0, z1 = 1.0;
+    auto walls = world.arena.create<triangle_mesh>(white);
+    add_quad(*walls, point3(x0, y0, z0), point3(x1, y0, z0), point3(x1, y0, z1), point3(x0, y0, z1));      // 地板
+    add_quad(*walls, point3(x0, y1, z0), point3(x1, y1, z0), point3(x1, y1, z1), point3(x0, y1, z1));      // 天花板
+    add_quad(*walls, point3(x0, y0, z0), point3(x1, y0, z0), point3(x1, y1, z0), point3(x0, y1, z0));      // 后墙
+    add_quad(*walls, point3(x0, y0, z1), point3(x1, y0, z1), point3(x1, y1, z1), point3(x0, y1, z1));      // 摄像机身后的墙
+    walls->build();
+    world.objects.add(walls);
+    auto left = world.arena.create<triangle_mesh>(red);
+    add_quad(*left, point3(x0, y0, z0), point3(x0, y1, z0), point3(x0, y1, z1), point3(x0, y0, z1));
+    left->build();
+    world.objects.add(left);
+    auto right = world.arena.create<triangle_mesh>(green);
+    add_quad(*right, point3(x1, y0, z0), point3(x1, y1, z0), point3(x1, y1, z1), point3(x1, y0, z1));
+    right->build();
+    world.objects.add(right);
+
+    // 光源略低于天花板, 避免两个面重合.
+    auto light = world.arena.create<triangle_mesh>(lamp);
+    add_quad(*light, point3(-0.3, y1 - 0.001, -1.1), point3(0.3, y1 - 0.001, -1.1), point3(0.3, y1 - 0.001, -0.5), point3(-0.3, y1 - 0.001, -0.5));
+    light->build();
+    world.objects.add(light);
+
+    world.objects.add(world.arena.create<sphere>(point3(-0.6, 0.45, -1.1), 0.45, white));
+    world.objects.add(world.arena.create<sphere>(point3(0.7, 0.4, -0.6), 0.4, world.materials.add<dielectric>(1.5)));
+    world.objects.add(world.arena.create<sphere>(point3(0.3, 0.3, -1.6), 0.3, world.materials.add<metal>(color(0.8, 0.8, 0.8), 0.1)));
+
+    world.cam = camera(point3(0.0, 1.0, 0.9), point3(0.0, 0.9, -1.0), vec3(0.0, 1.0, 0.0), 70.0, aspect_ratio, 0.0, 1.0);
+    return world;
+}
+
+// 按名字构建场景, 名字不认识时返回false. 场景构建会用到随机数, 调用之前先设置当前线程sampler的种子, 相同种子得到相同场景.
+bool make_scene(const std::string& name, const double aspect_ratio, scene& world) {
+    if(name == "scene1") world = scene1(aspect_ratio);
+    else if(name == "random") world = random_scene(aspect_ratio);
+    else if(name == "forest") world = forest_scene(aspect_ratio);
+    else if(name == "cornell") world = cornell_scene(aspect_ratio);
+    else return false;
+    return true;
+}
+
+#endif
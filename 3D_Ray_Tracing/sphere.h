@@ -1,22 +1,28 @@
 #ifndef SPHERE_H
 #define SPHERE_H
 
+#include "light.h"
+#include "render_stats.h"
 #include "surface.h"
 #include "vec3.h"
 
 class sphere : public surface {
     public:
         // default and parameter constructor.
-        sphere(const point3 cen = {}, const double r = 0.0, std::shared_ptr<material> m_ptr = nullptr) : center{cen}, radius{r}, mat_ptr{m_ptr} {}
+        sphere(const point3 cen = {}, const double r = 0.0, const material* m_ptr = nullptr) : center{cen}, radius{r}, mat_ptr{m_ptr} {}
 
     public:
         // 显示标注这是对抽象基类虚函数的覆盖, 前面使用virtual, 后面使用override.
-        virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
+        virtual bool intersect(const ray& r, double t_min, double t_max, hit_query& q) const override;
+        virtual void finalize(const ray& r, const hit_query& q, hit_record& rec) const override;
+        virtual bool occluded(const ray& r, double t_min, double t_max) const override;
+        virtual bool bounding_box(aabb& output_box) const override;
+        virtual void collect_lights(light_list& lights) const override { lights.add_sphere(center, radius, mat_ptr); }
 
     private:
         point3 center;
         double radius;          // 这里其实可以允许半径为负数, 此时的是一个半径为|radius|的球, 但是它的表面正向法向量向内指示.
-        std::shared_ptr<material> mat_ptr;      // 一个指针存放球表面的材质.
+        const material* mat_ptr;        // 一个指针存放球表面的材质. 材质由场景的材质表持有.
 };
 
 /*
@@ -28,7 +34,8 @@ class sphere : public surface {
     a = dot(b,b);       b = 2*dot(b,O-C);       c = dot(O-C,O-C)-R^2.
     一元二次方程解的判别式delta = b^2 - 4ac.   如果delta>=0, 则有交点.
 */
-bool sphere::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+bool sphere::intersect(const ray& r, double t_min, double t_max, hit_query& q) const {
+    ++thread_counters().sphere_tests;
     // 先求射线起点到球心的方向向量.
     vec3 oc = r.origin() - center;
     // 再求一元二次方法a, b, c; 然后求判别式. 我们可以优化代码.
@@ -56,14 +63,45 @@ bool sphere::hit(const ray& r, double t_min, double t_max, hit_record& rec) cons
             return false;
     }
 
-    // 如果相交点落在range之中, 那么填充rec对象保存相交点的各方面信息, 比如相交点3D空间位置, 射线方程t的值, 还有点的平面法线向量.
+    // 第一阶段只记录t. 这一交点可能还会被更近的交点取代, 交点位置和法向量等到finalize()再求.
+    q.t = root;
+    q.object = this;
+    q.primitive = 0;
+    q.instance_depth = 0;
+
+    return true;
+}
+
+void sphere::finalize(const ray& r, const hit_query& q, hit_record& rec) const {
+    // 填充rec对象保存相交点的各方面信息, 比如相交点3D空间位置, 射线方程t的值, 还有点的平面法线向量.
     // 判断相交表面是表面内侧还是外侧, 并始终记录方向始终指向射线的的法线.
-    rec.t = root;
+    rec.t = q.t;
     rec.p = r.at(rec.t);
     vec3 outward_normal = (rec.p - center) / radius;     // 求单位法向量.
     rec.set_face_nomral(r, outward_normal);
     rec.mat_ptr = mat_ptr;      // 也需要记录相交点的材质.
-    
+}
+
+// 与hit()相同的一元二次方程, 只判断两个根中是否有一个落在[t_min, t_max]中, 不求交点和法向量.
+bool sphere::occluded(const ray& r, double t_min, double t_max) const {
+    ++thread_counters().sphere_tests;
+    const vec3 oc = r.origin() - center;
+    const double a = r.direcion().lenth_squared();
+    const double half_b = dot(r.direcion(), oc);
+    const double c = oc.lenth_squared() - radius*radius;
+    const double discriminant = half_b*half_b - a*c;
+    if(discriminant < 0) return false;
+
+    const double sqrtd = std::sqrt(discriminant);
+    const double root0 = (-half_b - sqrtd) / a;
+    const double root1 = (-half_b + sqrtd) / a;
+    return (t_min <= root0 && root0 <= t_max) || (t_min <= root1 && root1 <= t_max);
+}
+
+bool sphere::bounding_box(aabb& output_box) const {
+    // 半径可以为负数, 所以包围盒的半边长取半径的绝对值.
+    const vec3 half_extent(fabs(radius), fabs(radius), fabs(radius));
+    output_box = aabb(center - half_extent, center + half_extent);
     return true;
 }
 
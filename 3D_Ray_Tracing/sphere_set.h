@@ -0,0 +1,294 @@
+#ifndef SPHERE_SET_H
+#define SPHERE_SET_H
+
+#include "bvh.h"
+#include "light.h"
+#include "render_stats.h"
+#include "surface.h"
+
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#if defined(__AVX2__)
+    #include <immintrin.h>
+#elif defined(__SSE2__)
+    #include <emmintrin.h>
+#endif
+
+/*
+    sphere_set: 以结构数组(structure of arrays, SoA)形式存储的一组球, 它本身是一个surface.
+
+    每个sphere都是单独分配在堆上的对象, 求交时每个球都要经过一次shared_ptr和一次虚函数调用. 而random_scene()中几乎所有物体都是球.
+    sphere_set把所有球的球心x, y, z, 半径和材质编号分别存放在连续的数组中, 求交时用SIMD一次测试一条射线和8个球:
+        - 编译时开启AVX2(-mavx2或-march=native), 每条256位指令处理4个double, 两条指令处理8个球;
+        - 只有SSE2时, 每条128位指令处理2个double, 四条指令处理8个球;
+        - 都没有时退化为普通的标量循环.
+    sphere::hit中的一元二次方程求解与射线无关的部分全部是逐球独立的, 正好映射到SIMD的各个lane上.
+
+    sphere_set内部自己构建一棵BVH, 每个叶子最多包含8个球, 并且把SoA数组按照叶子顺序重新排列, 于是每个叶子恰好是一次8路SIMD测试.
+
+    用法: 先逐个add()球, 再调用一次build(), 之后就是只读的, 可以被多个渲染线程同时使用.
+*/
+class sphere_set : public surface {
+    public:
+        static const int simd_width = 8;        // 一次相交测试同时处理的球的个数.
+
+    public:
+        void add(const point3& center, const double radius, const material* m_ptr);
+        // 批量添加count个球, 球心和半径是SoA数组, 第k个球的材质是palette[material_ids[k]]. 例如场景文件加载时直接从映射的文件内存复制.
+        void add_spheres(const std::vector<const material*>& palette, const double* cx, const double* cy, const double* cz,
+                         const double* radii, const uint32_t* material_ids, const size_t count);
+        // 构建BVH并按照叶子顺序重排SoA数组. 所有add()调用之后必须调用一次build().
+        void build();
+
+        size_t size() const { return radius.size(); }
+
+        virtual bool intersect(const ray& r, double t_min, double t_max, hit_query& q) const override;
+        virtual void finalize(const ray& r, const hit_query& q, hit_record& rec) const override;
+        virtual bool occluded(const ray& r, double t_min, double t_max) const override;
+        virtual bool bounding_box(aabb& output_box) const override;
+        virtual void collect_lights(light_list& lights) const override;
+
+    private:
+        // 测试一个叶子中从offset开始的count(<= 8)个球, 返回[t_min, t_max]范围内最近交点对应的球的下标, 没有交点返回-1.
+        int hit_leaf(const ray& r, const int offset, const int count, const double t_min, double& t_max) const;
+
+    private:
+        // SoA数组. 末尾额外填充simd_width个元素, 这样SIMD在最后一个叶子也可以整块读取而不会越界.
+        std::vector<double> center_x, center_y, center_z;
+        std::vector<double> radius;
+        std::vector<uint32_t> material_index;
+
+        std::vector<const material*> materials;                             // 本集合用到的材质, 多个球共享同一个材质时只保存一份. 材质本身由场景的材质表持有.
+        std::unordered_map<const material*, uint32_t> material_lookup;      // 构建时用来给材质去重.
+
+        bvh_tree tree;
+};
+
+void sphere_set::add(const point3& center, const double r, const material* m_ptr) {
+    auto it = material_lookup.find(m_ptr);
+    uint32_t index;
+    if(it == material_lookup.end()) {
+        index = static_cast<uint32_t>(materials.size());
+        materials.push_back(m_ptr);
+        material_lookup.emplace(m_ptr, index);
+    }
+    else
+        index = it->second;
+
+    center_x.push_back(center.x());
+    center_y.push_back(center.y());
+    center_z.push_back(center.z());
+    radius.push_back(r);
+    material_index.push_back(index);
+}
+
+void sphere_set::add_spheres(const std::vector<const material*>& palette, const double* cx, const double* cy, const double* cz,
+                             const double* radii, const uint32_t* material_ids, const size_t count) {
+    // 批量添加时不对材质去重, palette整体追加到材质表的末尾, 材质编号加上偏移.
+    const uint32_t base = static_cast<uint32_t>(materials.size());
+    materials.insert(materials.end(), palette.begin(), palette.end());
+    center_x.insert(center_x.end(), cx, cx + count);
+    center_y.insert(center_y.end(), cy, cy + count);
+    center_z.insert(center_z.end(), cz, cz + count);
+    radius.insert(radius.end(), radii, radii + count);
+    const size_t first = material_index.size();
+    material_index.insert(material_index.end(), material_ids, material_ids + count);
+    if(base != 0)
+        for(size_t k = first; k < material_index.size(); ++k) material_index[k] += base;
+}
+
+void sphere_set::build() {
+    const size_t n = radius.size();
+    std::vector<aabb> boxes(n);
+    for(size_t k = 0; k < n; ++k) {
+        const vec3 half_extent(fabs(radius[k]), fabs(radius[k]), fabs(radius[k]));     // 半径可以为负数.
+        const point3 center(center_x[k], center_y[k], center_z[k]);
+        boxes[k] = aabb(center - half_extent, center + half_extent);
+    }
+    tree.build(boxes, simd_width, simd_width);
+
+    // 按照叶子顺序重排, 并在末尾填充simd_width个半径为0的球.
+    auto reorder = [&](auto& values) {
+        std::remove_reference_t<decltype(values)> sorted(n + simd_width);
+        for(size_t k = 0; k < n; ++k)
+            sorted[k] = values[tree.primitive_order()[k]];
+        values.swap(sorted);
+    };
+    reorder(center_x);
+    reorder(center_y);
+    reorder(center_z);
+    reorder(radius);
+    reorder(material_index);
+    material_lookup.clear();
+    tree.release_primitive_order();
+}
+
+bool sphere_set::intersect(const ray& r, double t_min, double t_max, hit_query& q) const {
+    int nearest = -1;
+    uint64_t tests = 0;                     // 测试的图元数, 遍历结束后一次加到线程的计数器上.
+    tree.traverse(r, t_min, t_max, [&](const int offset, const int count, double& closest_so_far) {
+        tests += static_cast<uint64_t>(count);
+        const int k = hit_leaf(r, offset, count, t_min, closest_so_far);
+        if(k < 0) return false;
+        nearest = k;
+        return true;
+    });
+    thread_counters().sphere_tests += tests;
+    if(nearest < 0) return false;
+
+    q.t = t_max;
+    q.object = this;
+    q.primitive = static_cast<uint32_t>(nearest);
+    q.instance_depth = 0;
+    return true;
+}
+
+void sphere_set::finalize(const ray& r, const hit_query& q, hit_record& rec) const {
+    // 计算方法和sphere::finalize完全相同.
+    const uint32_t k = q.primitive;
+    const point3 center(center_x[k], center_y[k], center_z[k]);
+    rec.t = q.t;
+    rec.p = r.at(rec.t);
+    vec3 outward_normal = (rec.p - center) / radius[k];
+    rec.set_face_nomral(r, outward_normal);
+    rec.mat_ptr = materials[material_index[k]];
+}
+
+bool sphere_set::occluded(const ray& r, double t_min, double t_max) const {
+    // 叶子中的8个球本来就是一次SIMD测试, 直接复用hit_leaf(), 有任何一个lane相交就返回.
+    uint64_t tests = 0;
+    const bool hit = tree.any_hit(r, t_min, t_max, [&](const int offset, const int count) {
+        tests += static_cast<uint64_t>(count);
+        double limit = t_max;
+        return hit_leaf(r, offset, count, t_min, limit) >= 0;
+    });
+    thread_counters().sphere_tests += tests;
+    return hit;
+}
+
+bool sphere_set::bounding_box(aabb& output_box) const {
+    if(tree.empty()) return false;
+    output_box = tree.bounds();
+    return true;
+}
+
+void sphere_set::collect_lights(light_list& lights) const {
+    for(size_t k = 0; k < size(); ++k)
+        lights.add_sphere(point3(center_x[k], center_y[k], center_z[k]), radius[k], materials[material_index[k]]);
+}
+
+int sphere_set::hit_leaf(const ray& r, const int offset, const int count, const double t_min, double& t_max) const {
+    // 与射线有关的量对8个球都相同, 先算好.
+    const point3 o = r.origin();
+    const vec3 d = r.direcion();
+    const double a = d.lenth_squared();
+
+    // 每个lane的最近交点参数, 没有交点的lane为infinity.
+    alignas(32) double roots[simd_width];
+
+#if defined(__AVX2__)
+    const __m256d ox = _mm256_set1_pd(o.x()), oy = _mm256_set1_pd(o.y()), oz = _mm256_set1_pd(o.z());
+    const __m256d dx = _mm256_set1_pd(d.x()), dy = _mm256_set1_pd(d.y()), dz = _mm256_set1_pd(d.z());
+    const __m256d va = _mm256_set1_pd(a);
+    const __m256d vt_min = _mm256_set1_pd(t_min), vt_max = _mm256_set1_pd(t_max);
+    const __m256d vinf = _mm256_set1_pd(infinity), zero = _mm256_setzero_pd();
+    for(int lane = 0; lane < count; lane += 4) {
+        const int k = offset + lane;
+        const __m256d ocx = _mm256_sub_pd(ox, _mm256_loadu_pd(&center_x[k]));
+        const __m256d ocy = _mm256_sub_pd(oy, _mm256_loadu_pd(&center_y[k]));
+        const __m256d ocz = _mm256_sub_pd(oz, _mm256_loadu_pd(&center_z[k]));
+        const __m256d rr  = _mm256_loadu_pd(&radius[k]);
+
+        const __m256d half_b = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(dx, ocx), _mm256_mul_pd(dy, ocy)), _mm256_mul_pd(dz, ocz));
+        const __m256d c = _mm256_sub_pd(_mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(ocx, ocx), _mm256_mul_pd(ocy, ocy)), _mm256_mul_pd(ocz, ocz)),
+                                        _mm256_mul_pd(rr, rr));
+        const __m256d disc = _mm256_sub_pd(_mm256_mul_pd(half_b, half_b), _mm256_mul_pd(va, c));
+        const __m256d has_root = _mm256_cmp_pd(disc, zero, _CMP_GE_OQ);
+        if(_mm256_movemask_pd(has_root) == 0) {         // 4个球都没有交点时跳过开方和除法.
+            _mm256_store_pd(&roots[lane], vinf);
+            continue;
+        }
+        const __m256d sqrtd = _mm256_sqrt_pd(_mm256_max_pd(disc, zero));
+        const __m256d neg_half_b = _mm256_sub_pd(zero, half_b);
+
+        // 先取近的根, 近的根不在[t_min, t_max]范围内再取远的根.
+        const __m256d root0 = _mm256_div_pd(_mm256_sub_pd(neg_half_b, sqrtd), va);
+        const __m256d root1 = _mm256_div_pd(_mm256_add_pd(neg_half_b, sqrtd), va);
+        const __m256d ok0 = _mm256_and_pd(_mm256_cmp_pd(root0, vt_min, _CMP_GE_OQ), _mm256_cmp_pd(root0, vt_max, _CMP_LE_OQ));
+        const __m256d ok1 = _mm256_and_pd(_mm256_cmp_pd(root1, vt_min, _CMP_GE_OQ), _mm256_cmp_pd(root1, vt_max, _CMP_LE_OQ));
+        __m256d root = _mm256_blendv_pd(_mm256_blendv_pd(vinf, root1, ok1), root0, ok0);
+        root = _mm256_blendv_pd(vinf, root, has_root);
+        _mm256_store_pd(&roots[lane], root);
+    }
+#elif defined(__SSE2__)
+    const __m128d ox = _mm_set1_pd(o.x()), oy = _mm_set1_pd(o.y()), oz = _mm_set1_pd(o.z());
+    const __m128d dx = _mm_set1_pd(d.x()), dy = _mm_set1_pd(d.y()), dz = _mm_set1_pd(d.z());
+    const __m128d va = _mm_set1_pd(a);
+    const __m128d vt_min = _mm_set1_pd(t_min), vt_max = _mm_set1_pd(t_max);
+    const __m128d vinf = _mm_set1_pd(infinity), zero = _mm_setzero_pd();
+    // SSE2没有blendv指令, 用and/andnot/or组合出按掩码选择.
+    auto select = [](const __m128d mask, const __m128d if_true, const __m128d if_false) {
+        return _mm_or_pd(_mm_and_pd(mask, if_true), _mm_andnot_pd(mask, if_false));
+    };
+    for(int lane = 0; lane < count; lane += 2) {
+        const int k = offset + lane;
+        const __m128d ocx = _mm_sub_pd(ox, _mm_loadu_pd(&center_x[k]));
+        const __m128d ocy = _mm_sub_pd(oy, _mm_loadu_pd(&center_y[k]));
+        const __m128d ocz = _mm_sub_pd(oz, _mm_loadu_pd(&center_z[k]));
+        const __m128d rr  = _mm_loadu_pd(&radius[k]);
+
+        const __m128d half_b = _mm_add_pd(_mm_add_pd(_mm_mul_pd(dx, ocx), _mm_mul_pd(dy, ocy)), _mm_mul_pd(dz, ocz));
+        const __m128d c = _mm_sub_pd(_mm_add_pd(_mm_add_pd(_mm_mul_pd(ocx, ocx), _mm_mul_pd(ocy, ocy)), _mm_mul_pd(ocz, ocz)), _mm_mul_pd(rr, rr));
+        const __m128d disc = _mm_sub_pd(_mm_mul_pd(half_b, half_b), _mm_mul_pd(va, c));
+        const __m128d has_root = _mm_cmpge_pd(disc, zero);
+        if(_mm_movemask_pd(has_root) == 0) {            // 2个球都没有交点时跳过开方和除法.
+            _mm_store_pd(&roots[lane], vinf);
+            continue;
+        }
+        const __m128d sqrtd = _mm_sqrt_pd(_mm_max_pd(disc, zero));
+        const __m128d neg_half_b = _mm_sub_pd(zero, half_b);
+
+        const __m128d root0 = _mm_div_pd(_mm_sub_pd(neg_half_b, sqrtd), va);
+        const __m128d root1 = _mm_div_pd(_mm_add_pd(neg_half_b, sqrtd), va);
+        const __m128d ok0 = _mm_and_pd(_mm_cmpge_pd(root0, vt_min), _mm_cmple_pd(root0, vt_max));
+        const __m128d ok1 = _mm_and_pd(_mm_cmpge_pd(root1, vt_min), _mm_cmple_pd(root1, vt_max));
+        __m128d root = select(ok0, root0, select(ok1, root1, vinf));
+        root = select(has_root, root, vinf);
+        _mm_store_pd(&roots[lane], root);
+    }
+#else
+    for(int lane = 0; lane < count; ++lane) {
+        const int k = offset + lane;
+        const vec3 oc(o.x() - center_x[k], o.y() - center_y[k], o.z() - center_z[k]);
+        const double half_b = dot(d, oc);
+        const double c = oc.lenth_squared() - radius[k]*radius[k];
+        const double discriminant = half_b*half_b - a*c;
+        roots[lane] = infinity;
+        if(discriminant < 0) continue;
+
+        const double sqrtd = std::sqrt(discriminant);
+        double root = (-half_b - sqrtd) / a;
+        if(root < t_min  ||  t_max < root) {
+            root = (-half_b + sqrtd) / a;
+            if(root < t_min  ||  t_max < root) continue;
+        }
+        roots[lane] = root;
+    }
+#endif
+
+    // 在有效的lane中找最近的交点. SIMD会多算一些超出count的lane, 这些lane直接忽略.
+    int nearest = -1;
+    for(int lane = 0; lane < count; ++lane) {
+        if(roots[lane] < infinity && roots[lane] <= t_max) {
+            t_max = roots[lane];
+            nearest = offset + lane;
+        }
+    }
+    return nearest;
+}
+
+#endif
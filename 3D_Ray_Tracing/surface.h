@@ -5,11 +5,31 @@
 
 // 我们应该把一些所有子类都会用到的头文件全都放在base class中include, 因为base class的头文件.必然会被子类所include.
 #include "utility.h"        // base class包含utility头文件, 所有子类在inlcude base class的时候自动包含. 
+#include "aabb.h"
 
 // 特别注意, extern修饰符是对变量或者说类对象做外部声明用, 例如extern material mat; 这才对.
 // 对于class和struct本身无法使用extern修饰符, 只能直接class material; 声明一个material类但是不做定义, 此时material类是非完整类型incompete type.
 // incomplete type只能被指针或者引用指向, 不能实例化对象.
 class material;         // 让base class做材质类声明, 这样所有子类include基类就自动有了这一材质类声明.
+class light_list;       // 光源列表, 见light.h.
+struct surface;
+
+/*
+    两阶段求交(two-phase intersection)的第一阶段结果.
+    遍历时每找到一个更近的候选交点, 只记录t和产生它的图元, 不计算交点位置, 法向量, 朝向和材质;
+    遍历结束后只对最终最近的那个交点调用一次object->finalize(), 填充完整的hit_record. 被更近的交点取代的候选不再做这些计算.
+*/
+struct hit_query {
+    static const int max_instance_depth = 4;
+
+    double t;
+    const surface* object;                          // 产生这一交点的surface, finalize()在它上面调用.
+    uint32_t primitive;                             // object内部的图元编号, 例如sphere_set中的第几个球.
+    double u, v;                                    // 图元上的参数坐标, 例如三角形的重心坐标, finalize()插值法向量时使用.
+    // instance把内层产生交点的surface压栈, 再把object换成自己, finalize()时逐层弹出. 图元产生新的候选交点时把instance_depth清零.
+    int instance_depth;
+    const surface* instance_stack[max_instance_depth];
+};
 
 /*
     光线跟踪器ray-tracer中的关键类层次结构是构成模型的几何表面. 
@@ -23,7 +43,33 @@ struct surface {
     public:
         // surface是抽象基类, 因此它内部的成员函数全部为纯虚函数. 抽象基类无法调用构造函数构建对象.
         // (t_min,t_max)是射线的区间, rec是一个通过引用传递的record object, 它包含函数hit返回真时的交点参数t等数据.
-        virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const  = 0;
+        // hit = intersect + finalize. 一般不需要覆盖, 只有包装world的surface(例如统计射线数目)才覆盖它.
+        virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+            hit_query q;
+            if(!intersect(r, t_min, t_max, q)) return false;
+            q.object->finalize(r, q, rec);
+            return true;
+        }
+
+        // 第一阶段: 只求(t_min, t_max)内最近交点的参数t和图元. 约定: 只有在返回true时才能改写q.
+        // 这样surface_list和BVH可以把同一个q直接传给每个物体, 每次命中之后q保存的就是目前最近的交点.
+        virtual bool intersect(const ray& r, double t_min, double t_max, hit_query& q) const = 0;
+
+        // 第二阶段: 为intersect()找到的交点q填充rec. 只在q.object上调用. 容器类(surface_list, bvh_node)自己不产生交点, 不需要覆盖.
+        virtual void finalize(const ray& r, const hit_query& q, hit_record& rec) const {}
+
+        // 返回包围这一surface的轴对齐包围盒, 用于构建BVH等加速结构. 没有有限包围盒的物体(例如无限大平面)返回false.
+        virtual bool bounding_box(aabb& output_box) const = 0;
+
+        // 任意交点查询(any-hit), 用于shadow ray: 射线在[t_min, t_max]之间有任何交点就返回true. 不需要最近的交点, 也不计算法向量, 朝向和材质.
+        // 默认用hit()实现; 几何体和加速结构都覆盖它, 找到第一个遮挡物就立即返回.
+        virtual bool occluded(const ray& r, double t_min, double t_max) const {
+            hit_record rec;
+            return hit(r, t_min, t_max, rec);
+        }
+
+        // 把自己包含的发光图元加入光源列表, 场景加载之后调用一次. 默认没有光源; 容器类的surface转发给其中的每个物体.
+        virtual void collect_lights(light_list& lights) const {}
 };
 
 #endif
\ No newline at end of file
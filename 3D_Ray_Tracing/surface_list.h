@@ -4,8 +4,14 @@
 #include "surface.h"
 
 #include <memory>
+#include <utility>
 #include <vector>
 
+/*
+    surface_list: 物体列表. 列表中只保存不拥有所有权的const surface*, 每个元素8字节, 遍历时不经过shared_ptr的控制块.
+    场景中的物体通常分配在scene的arena中(见arena.h和scene.h), 由arena统一持有和释放, 用add(const surface*)加入;
+    用add(std::shared_ptr)加入的物体由列表自己持有一份shared_ptr, 保证它和列表一样长寿.
+*/
 class surface_list : public surface {
     public:
         // default and parameter constructor.
@@ -13,33 +19,65 @@ class surface_list : public surface {
 
         // 还可以定义其他parameter构造函数, 但是没有定义, 先这样. Big-Five使用合成版本.
     public:
-        void clear() { objects.clear(); }
-        
-        // 注意add函数的参数不加const, 会push进入vector中, 必须和vector元素类型相同.
-        // 智能指针开销小, 所以直接pass by copy, 内部也直接使用push_back即可.
-        void add(std::shared_ptr<surface> object) { objects.push_back(object); }
+        void clear() { objects.clear(); owned.clear(); }
 
-        virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
+        // 加入一个由别处(通常是scene的arena)持有的物体, 它必须比列表活得更久.
+        void add(const surface* object) { objects.push_back(object); }
+        // 智能指针开销小, 所以直接pass by copy, 列表持有一份, 保证物体不会先于列表被释放.
+        void add(std::shared_ptr<const surface> object) {
+            objects.push_back(object.get());
+            owned.push_back(std::move(object));
+        }
+
+        // 返回列表中所有物体, 用于在已有的surface_list之上构建BVH等加速结构.
+        const std::vector<const surface*>& objects_list() const { return objects; }
+
+        virtual bool intersect(const ray& r, double t_min, double t_max, hit_query& q) const override;
+        virtual bool occluded(const ray& r, double t_min, double t_max) const override;
+        virtual bool bounding_box(aabb& output_box) const override;
+        virtual void collect_lights(light_list& lights) const override {
+            for(const surface* object : objects) object->collect_lights(lights);
+        }
 
     private:
-        std::vector<std::shared_ptr<surface>> objects;
+        std::vector<const surface*> objects;
+        std::vector<std::shared_ptr<const surface>> owned;      // 用shared_ptr加入的物体, 只用来保持它们存活.
 };
 
-bool surface_list::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+bool surface_list::intersect(const ray& r, double t_min, double t_max, hit_query& q) const {
     // 给定一系列hittable object, 然后记录离视点最近的相交物体点.
-    hit_record temp_rec;
+    // 物体只在找到(t_min, closed_so_far)内的交点时才改写q, 所以直接把q传下去即可, 每次命中之后q保存的就是目前最近的交点.
     bool hit_anything = false;
     double closed_so_far = t_max;
-    // 遍历迭代判断.
-    for(const auto& object : objects) {
-        if(object->hit(r, t_min, closed_so_far, temp_rec)) {
+    // 遍历迭代判断. 列表中是裸指针, 连续存放, 没有引用计数操作.
+    for(const surface* object : objects) {
+        if(object->intersect(r, t_min, closed_so_far, q)) {
             hit_anything = true;
-            closed_so_far = temp_rec.t;         // 一直在缩小closed_so_far所表示的区间最大值.
-            rec = temp_rec;                     // 持续更新rec.
+            closed_so_far = q.t;              // 一直在缩小closed_so_far所表示的区间最大值.
         }
     }
 
     return hit_anything;
 }
 
+bool surface_list::occluded(const ray& r, double t_min, double t_max) const {
+    // 任何一个物体挡住射线即可返回, 不需要比较远近.
+    for(const surface* object : objects)
+        if(object->occluded(r, t_min, t_max)) return true;
+    return false;
+}
+
+bool surface_list::bounding_box(aabb& output_box) const {
+    // 列表的包围盒是所有物体包围盒的并集. 只要有一个物体没有有限包围盒, 整个列表就没有有限包围盒.
+    if(objects.empty()) return false;
+
+    aabb temp_box;
+    output_box = aabb();
+    for(const surface* object : objects) {
+        if(!object->bounding_box(temp_box)) return false;
+        output_box.expand(temp_box);
+    }
+    return true;
+}
+
 #endif
\ No newline at end of file
@@ -0,0 +1,132 @@
+#ifndef TILE_SCHEDULER_H
+#define TILE_SCHEDULER_H
+
+#include "trace.h"
+
+#include <algorithm>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// 一个tile就是渲染图像上的一个矩形像素区域[x0, x1) x [y0, y1). index是tile的全局编号.
+struct tile {
+    int x0, y0;
+    int x1, y1;
+    int index;
+};
+
+// 输出渲染进度. 多个渲染线程同时调用, 所以先拼好整行再一次写出; 用多个<<分段写出时各线程的片段会交错在一起.
+inline void print_tiles_remaining(const int remaining) {
+    const std::string line = "\rTiles remaining: " + std::to_string(remaining) + "   ";
+    std::cerr.write(line.data(), static_cast<std::streamsize>(line.size())).flush();
+}
+
+/*
+    tile_scheduler: 基于work-stealing的tile调度器.
+
+    1. 先把渲染图像切分成tile_size x tile_size大小的tile, 边缘的tile可能小一些.
+    2. 每个工作线程有一个自己的tile队列, 初始时把连续的一段tile平均分配给每个线程, 这样每个线程处理的是图像上相邻的区域, cache局部性更好.
+    3. 线程先从自己队列的队头取tile; 自己的队列空了之后, 再去其他线程队列的队尾"偷"tile.
+       天空区域的tile很快就能算完, 而玻璃球区域的tile很慢, 通过work-stealing可以保证所有线程一直有活干, 直到所有tile都渲染完成.
+
+    一个tile的渲染时间远远大于一次加锁解锁的时间, 所以每个队列直接使用std::mutex保护即可, 无需无锁队列.
+*/
+class tile_scheduler {
+    public:
+        // parameter constructor.
+        tile_scheduler(const int image_width, const int image_height, const int tile_size = 16) {
+            int index = 0;
+            for(int y0 = 0; y0 < image_height; y0 += tile_size)
+                for(int x0 = 0; x0 < image_width; x0 += tile_size)
+                    all_tiles.push_back({x0, y0, std::min(x0 + tile_size, image_width), std::min(y0 + tile_size, image_height), index++});
+        }
+
+    public:
+        const std::vector<tile>& tiles() const { return all_tiles; }
+
+        // 使用num_threads个工作线程渲染所有tile. render_tile是一个可调用对象, 签名为void(const tile&, int worker),
+        // worker是执行它的工作线程的编号, 在[0, num_threads)之内, 可以用来索引每个线程自己的缓冲区.
+        // 所有tile完成后函数才返回. num_threads == 1时直接在调用线程中顺序渲染.
+        template<typename Function>
+        void run(int num_threads, Function&& render_tile);
+
+    private:
+        // 每个工作线程的tile队列, 保存的是tile在all_tiles中的下标.
+        struct worker_queue {
+            std::mutex mtx;
+            std::deque<int> tile_ids;
+        };
+
+        bool pop_own(worker_queue& q, int& id);
+        bool steal(std::vector<std::unique_ptr<worker_queue>>& queues, const int thief, int& id);
+
+    private:
+        std::vector<tile> all_tiles;
+};
+
+bool tile_scheduler::pop_own(worker_queue& q, int& id) {
+    std::lock_guard<std::mutex> lock(q.mtx);
+    if(q.tile_ids.empty()) return false;
+    id = q.tile_ids.front();
+    q.tile_ids.pop_front();
+    return true;
+}
+
+bool tile_scheduler::steal(std::vector<std::unique_ptr<worker_queue>>& queues, const int thief, int& id) {
+    // 从thief的下一个线程开始轮流尝试, 避免所有空闲线程都去偷同一个线程的tile.
+    const int n = static_cast<int>(queues.size());
+    for(int k = 1; k < n; ++k) {
+        worker_queue& victim = *queues[(thief + k) % n];
+        std::lock_guard<std::mutex> lock(victim.mtx);
+        if(!victim.tile_ids.empty()) {
+            id = victim.tile_ids.back();
+            victim.tile_ids.pop_back();
+            return true;
+        }
+    }
+    return false;
+}
+
+template<typename Function>
+void tile_scheduler::run(int num_threads, Function&& render_tile) {
+    const int num_tiles = static_cast<int>(all_tiles.size());
+    num_threads = std::max(1, std::min(num_threads, num_tiles));
+
+    if(num_threads == 1) {
+        for(const tile& t : all_tiles)
+            render_tile(t, 0);
+        return;
+    }
+
+    // 把tile按连续分段的方式初始分配给每个线程.
+    std::vector<std::unique_ptr<worker_queue>> queues;
+    for(int w = 0; w < num_threads; ++w) {
+        queues.emplace_back(new worker_queue);
+        const int begin = static_cast<int>(static_cast<long long>(num_tiles) * w / num_threads);
+        const int end   = static_cast<int>(static_cast<long long>(num_tiles) * (w + 1) / num_threads);
+        for(int id = begin; id < end; ++id)
+            queues[w]->tile_ids.push_back(id);
+    }
+
+    // 所有tile在开始之前已经全部入队, 运行过程中不会再产生新的tile, 因此一个线程自己队列为空并且偷不到tile时就可以退出了.
+    auto worker = [&](const int w) {
+        if(w > 0) trace_thread_name("render thread " + std::to_string(w));
+        int id;
+        while(pop_own(*queues[w], id) || steal(queues, w, id))
+            render_tile(all_tiles[id], w);
+    };
+
+    std::vector<std::thread> threads;
+    for(int w = 1; w < num_threads; ++w)
+        threads.emplace_back(worker, w);
+    worker(0);              // 调用线程自己也作为0号工作线程参与渲染.
+    trace_scope trace("wait for threads");      // 调用线程做完自己的tile之后等待其他线程的空闲时间.
+    for(auto& th : threads)
+        th.join();
+}
+
+#endif
@@ -0,0 +1,192 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+/*
+    时间线profiling(--trace FILE): 记录渲染过程中每个阶段和每个tile在哪个线程上从什么时候执行到什么时候,
+    程序结束时输出Chrome trace-event格式的JSON, 可以直接用chrome://tracing或者Perfetto(ui.perfetto.dev)打开.
+    render_stats.h中的计数器只有总量, 时间线则能看出时间花在哪里: 场景和BVH的构建, 每个线程上的每个tile, 降噪和输出, 以及线程空闲等待的时间.
+
+    用法: 在要计时的作用域开头定义一个trace_scope, 作用域结束时记录一个完整事件(Chrome的"X"事件, 开始时间加持续时间).
+        {
+            trace_scope trace("denoise");
+            ...
+        }
+    每个线程把事件追加到自己的缓冲区(thread_trace)中, 缓冲区只由所属线程写入, 不需要任何锁或者原子操作;
+    只有线程第一次记录事件时向trace_registry登记缓冲区要加锁一次. 缓冲区归registry所有, 线程退出后仍然保留, 程序结束时一起写出.
+    没有开启时trace_scope只读一次原子的开关; 开启时每个事件是两次steady_clock读取和一次vector追加(几十纳秒),
+    而事件只记录在tile和阶段这样的粗粒度上(每个至少几毫秒), 所以可以在正式渲染中一直开着.
+*/
+struct trace_event {
+    const char* name;                       // 字符串字面量, 只保存指针.
+    const char* arg_name;                   // 附加的一个整数参数的名字, 例如"tile". 为nullptr时没有参数.
+    int64_t arg;
+    int64_t start;                          // 相对trace开始时间的纳秒数.
+    int64_t duration;
+    int32_t track;                          // 时间线上的轨道(Chrome trace的tid).
+};
+
+// 一个线程的事件缓冲区.
+struct thread_trace {
+    int32_t track;                          // 这个线程的轨道编号.
+    std::string name;                       // 时间线上显示的线程名字.
+    std::vector<trace_event> events;
+};
+
+class trace_registry {
+    public:
+        // 开启记录, 时间从现在开始计算.
+        void start() {
+            epoch = std::chrono::steady_clock::now();
+            on.store(true, std::memory_order_release);
+        }
+        bool enabled() const { return on.load(std::memory_order_relaxed); }
+
+        int64_t now() const { return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count(); }
+
+        // 为调用线程分配一个缓冲区. 只在每个线程第一次记录事件时调用.
+        thread_trace& add_thread() {
+            std::lock_guard<std::mutex> lock(mtx);
+            threads.emplace_back();
+            thread_trace& t = threads.back();
+            t.track = next_track++;
+            t.name = t.track == 1 ? "main" : "thread " + std::to_string(t.track);
+            t.events.reserve(1024);
+            return t;
+        }
+
+        // 分配一条不属于任何线程的轨道, 例如分布式渲染中的一个worker进程, 它的事件由coordinator记录.
+        int32_t add_track(const std::string& name) {
+            std::lock_guard<std::mutex> lock(mtx);
+            extra_tracks.emplace_back(next_track, name);
+            return next_track++;
+        }
+
+        // 写出Chrome trace-event JSON. 只在没有线程正在记录时调用(程序结束时).
+        bool write(const std::string& path) const;
+
+    private:
+        std::atomic<bool> on{false};
+        std::chrono::steady_clock::time_point epoch;
+        mutable std::mutex mtx;
+        std::deque<thread_trace> threads;       // deque追加元素时已有元素的地址不变.
+        std::vector<std::pair<int32_t, std::string>> extra_tracks;
+        int32_t next_track = 1;
+};
+
+inline trace_registry& global_trace() {
+    static trace_registry registry;
+    return registry;
+}
+
+// 当前线程的缓冲区. 与thread_counters()相同, 常量初始化的thread_local指针.
+inline thread_trace& this_thread_trace() {
+    thread_local thread_trace* buffer = nullptr;
+    if(!buffer) buffer = &global_trace().add_thread();
+    return *buffer;
+}
+
+// 记录一个从start(global_trace().now()的返回值)开始, 持续duration纳秒的事件. track为0时记录在当前线程的轨道上.
+inline void trace_record(const char* name, const int64_t start, const int64_t duration, const char* arg_name = nullptr, const int64_t arg = 0, int32_t track = 0) {
+    thread_trace& buffer = this_thread_trace();
+    if(track == 0) track = buffer.track;
+    buffer.events.push_back({name, arg_name, arg, start, duration, track});
+}
+
+// 设置当前线程在时间线上的名字. 没有开启时什么也不做.
+inline void trace_thread_name(const std::string& name) {
+    if(global_trace().enabled()) this_thread_trace().name = name;
+}
+
+// 作用域计时: 构造时记下开始时间, 析构时记录事件.
+class trace_scope {
+    public:
+        explicit trace_scope(const char* event_name, const char* event_arg_name = nullptr, const int64_t event_arg = 0)
+            : name{event_name}, arg_name{event_arg_name}, arg{event_arg}, start{global_trace().enabled() ? global_trace().now() : -1} {}
+        ~trace_scope() {
+            if(start >= 0) trace_record(name, start, global_trace().now() - start, arg_name, arg);
+        }
+
+        trace_scope(const trace_scope&) = delete;
+        trace_scope& operator=(const trace_scope&) = delete;
+
+    private:
+        const char* name;
+        const char* arg_name;
+        int64_t arg;
+        int64_t start;                          // 没有开启时为-1.
+};
+
+/*
+    trace_session: path不为空时开启记录, 析构(程序从main返回)时把trace写入path.
+    在main开头定义, 任何一个return都会写出已经记录的事件.
+*/
+class trace_session {
+    public:
+        explicit trace_session(const std::string& trace_path) : path{trace_path} {
+            if(path.empty()) return;
+            global_trace().start();
+            this_thread_trace();            // 主线程最先登记, 得到第一条轨道.
+        }
+        ~trace_session();
+
+        trace_session(const trace_session&) = delete;
+        trace_session& operator=(const trace_session&) = delete;
+
+    private:
+        std::string path;
+};
+
+// JSON字符串转义. 线程和worker的名字可能包含引号(例如--worker-command).
+inline std::string trace_json_string(const std::string& s) {
+    std::string out = "\"";
+    for(const char c : s) {
+        if(c == '"' || c == '\\') out += '\\';
+        if(static_cast<unsigned char>(c) >= 0x20) out += c;
+    }
+    return out + '"';
+}
+
+bool trace_registry::write(const std::string& path) const {
+    std::lock_guard<std::mutex> lock(mtx);
+    std::ofstream out(path);
+    out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+    out << "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 0, \"args\": {\"name\": \"rayTracerMain\"}}";
+    auto thread_name = [&out](const int32_t track, const std::string& name) {
+        out << ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << track << ", \"args\": {\"name\": " << trace_json_string(name) << "}}";
+        out << ",\n{\"name\": \"thread_sort_index\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << track << ", \"args\": {\"sort_index\": " << track << "}}";
+    };
+    for(const thread_trace& t : threads) thread_name(t.track, t.name);
+    for(const auto& track : extra_tracks) thread_name(track.first, track.second);
+
+    // 时间以微秒为单位, 保留纳秒精度.
+    auto microseconds = [](const int64_t ns) { return std::to_string(ns / 1000) + '.' + std::to_string(1000 + ns % 1000).substr(1); };
+    for(const thread_trace& t : threads) {
+        for(const trace_event& e : t.events) {
+            out << ",\n{\"name\": \"" << e.name << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << e.track
+                << ", \"ts\": " << microseconds(e.start) << ", \"dur\": " << microseconds(e.duration);
+            if(e.arg_name) out << ", \"args\": {\"" << e.arg_name << "\": " << e.arg << '}';
+            out << '}';
+        }
+    }
+    out << "\n]}\n";
+    return static_cast<bool>(out.flush());
+}
+
+trace_session::~trace_session() {
+    if(path.empty()) return;
+    if(global_trace().write(path)) std::cerr << "Trace written to " << path << ".\n";
+    else std::cerr << "Cannot write trace " << path << ".\n";
+}
+
+#endif
@@ -0,0 +1,132 @@
+#ifndef TRANSFORM_H
+#define TRANSFORM_H
+
+#include "aabb.h"
+#include "utility.h"
+#include "vec3.h"
+
+#include <cmath>
+
+/*
+    affine_transform: 3D仿射变换 p' = A p + b, 以3x4矩阵存放, 第4列是平移量b. 齐次坐标的最后一行固定为(0, 0, 0, 1), 不需要保存.
+
+    点受平移影响, 方向向量不受平移影响. 法向量不能直接用A变换(非均匀缩放之后就不再垂直于表面了), 要用A的逆矩阵的转置变换:
+        切向量t满足dot(n, t) = 0, 变换后 dot((A^-1)^T n, A t) = dot(n, A^-1 A t) = dot(n, t) = 0.
+    所以apply_normal()要在逆变换上调用, 它用自己线性部分的转置去乘法向量.
+*/
+class affine_transform {
+    public:
+        // default constructor: 恒等变换.
+        affine_transform() : m{{1.0, 0.0, 0.0, 0.0}, {0.0, 1.0, 0.0, 0.0}, {0.0, 0.0, 1.0, 0.0}} {}
+
+        static affine_transform translate(const vec3& offset);
+        static affine_transform scale(const vec3& factors);
+        static affine_transform scale(const double factor) { return scale(vec3(factor, factor, factor)); }
+        // 绕经过原点的axis轴逆时针(右手定则)旋转degrees度.
+        static affine_transform rotate(const vec3& axis, const double degrees);
+
+    public:
+        // 复合变换: (A * B)(p) = A(B(p)), 也就是先做B再做A.
+        affine_transform operator*(const affine_transform& other) const;
+        affine_transform inverse() const;
+
+        point3 apply_point(const point3& p) const {
+            return point3(m[0][0]*p.x() + m[0][1]*p.y() + m[0][2]*p.z() + m[0][3],
+                          m[1][0]*p.x() + m[1][1]*p.y() + m[1][2]*p.z() + m[1][3],
+                          m[2][0]*p.x() + m[2][1]*p.y() + m[2][2]*p.z() + m[2][3]);
+        }
+        vec3 apply_vector(const vec3& v) const {
+            return vec3(m[0][0]*v.x() + m[0][1]*v.y() + m[0][2]*v.z(),
+                        m[1][0]*v.x() + m[1][1]*v.y() + m[1][2]*v.z(),
+                        m[2][0]*v.x() + m[2][1]*v.y() + m[2][2]*v.z());
+        }
+        // 用线性部分的转置乘n. 在逆变换上调用, 得到正变换之后的法向量(未单位化).
+        vec3 apply_normal(const vec3& n) const {
+            return vec3(m[0][0]*n.x() + m[1][0]*n.y() + m[2][0]*n.z(),
+                        m[0][1]*n.x() + m[1][1]*n.y() + m[2][1]*n.z(),
+                        m[0][2]*n.x() + m[1][2]*n.y() + m[2][2]*n.z());
+        }
+        // 变换之后的包围盒: 变换包围盒的8个顶点, 再求它们的包围盒.
+        aabb apply_box(const aabb& box) const;
+
+        double operator()(const int row, const int col) const { return m[row][col]; }
+
+    private:
+        double m[3][4];
+};
+
+affine_transform affine_transform::translate(const vec3& offset) {
+    affine_transform t;
+    t.m[0][3] = offset.x();
+    t.m[1][3] = offset.y();
+    t.m[2][3] = offset.z();
+    return t;
+}
+
+affine_transform affine_transform::scale(const vec3& factors) {
+    affine_transform t;
+    t.m[0][0] = factors.x();
+    t.m[1][1] = factors.y();
+    t.m[2][2] = factors.z();
+    return t;
+}
+
+affine_transform affine_transform::rotate(const vec3& axis, const double degrees) {
+    // Rodrigues旋转公式: R = cos I + sin [a]x + (1 - cos) a a^T.
+    const vec3 a = unit_vector(axis);
+    const double theta = degrees_to_radian(degrees);
+    const double c = std::cos(theta), s = std::sin(theta), k = 1.0 - c;
+    affine_transform t;
+    t.m[0][0] = c + k*a.x()*a.x();          t.m[0][1] = k*a.x()*a.y() - s*a.z();    t.m[0][2] = k*a.x()*a.z() + s*a.y();
+    t.m[1][0] = k*a.y()*a.x() + s*a.z();    t.m[1][1] = c + k*a.y()*a.y();          t.m[1][2] = k*a.y()*a.z() - s*a.x();
+    t.m[2][0] = k*a.z()*a.x() - s*a.y();    t.m[2][1] = k*a.z()*a.y() + s*a.x();    t.m[2][2] = c + k*a.z()*a.z();
+    return t;
+}
+
+affine_transform affine_transform::operator*(const affine_transform& other) const {
+    affine_transform t;
+    for(int row = 0; row < 3; ++row) {
+        for(int col = 0; col < 4; ++col) {
+            double sum = col == 3 ? m[row][3] : 0.0;
+            for(int k = 0; k < 3; ++k)
+                sum += m[row][k] * other.m[k][col];
+            t.m[row][col] = sum;
+        }
+    }
+    return t;
+}
+
+affine_transform affine_transform::inverse() const {
+    // 线性部分用伴随矩阵求逆, 平移部分为 -A^-1 b. 退化(不可逆)的变换没有意义, 这里不做检查.
+    const double c00 = m[1][1]*m[2][2] - m[1][2]*m[2][1];
+    const double c01 = m[1][2]*m[2][0] - m[1][0]*m[2][2];
+    const double c02 = m[1][0]*m[2][1] - m[1][1]*m[2][0];
+    const double inv_det = 1.0 / (m[0][0]*c00 + m[0][1]*c01 + m[0][2]*c02);
+
+    affine_transform t;
+    t.m[0][0] = c00 * inv_det;
+    t.m[0][1] = (m[0][2]*m[2][1] - m[0][1]*m[2][2]) * inv_det;
+    t.m[0][2] = (m[0][1]*m[1][2] - m[0][2]*m[1][1]) * inv_det;
+    t.m[1][0] = c01 * inv_det;
+    t.m[1][1] = (m[0][0]*m[2][2] - m[0][2]*m[2][0]) * inv_det;
+    t.m[1][2] = (m[0][2]*m[1][0] - m[0][0]*m[1][2]) * inv_det;
+    t.m[2][0] = c02 * inv_det;
+    t.m[2][1] = (m[0][1]*m[2][0] - m[0][0]*m[2][1]) * inv_det;
+    t.m[2][2] = (m[0][0]*m[1][1] - m[0][1]*m[1][0]) * inv_det;
+    for(int row = 0; row < 3; ++row)
+        t.m[row][3] = -(t.m[row][0]*m[0][3] + t.m[row][1]*m[1][3] + t.m[row][2]*m[2][3]);
+    return t;
+}
+
+aabb affine_transform::apply_box(const aabb& box) const {
+    aabb result;
+    for(int corner = 0; corner < 8; ++corner) {
+        const point3 p((corner & 1) ? box.max().x() : box.min().x(),
+                       (corner & 2) ? box.max().y() : box.min().y(),
+                       (corner & 4) ? box.max().z() : box.min().z());
+        result.expand(apply_point(p));
+    }
+    return result;
+}
+
+#endif
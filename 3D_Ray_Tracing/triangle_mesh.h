@@ -0,0 +1,458 @@
+#ifndef TRIANGLE_MESH_H
+#define TRIANGLE_MESH_H
+
+#include "bvh.h"
+#include "light.h"
+#include "render_stats.h"
+#include "mapped_file.h"
+#include "surface.h"
+
+#include <climits>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#if defined(__AVX2__)
+    #include <immintrin.h>
+#endif
+
+/*
+    triangle_mesh: 一个由三角形组成的网格, 它本身是一个surface, 整个网格使用同一个材质.
+
+    存储方式与OBJ文件相同, 是带索引的共享顶点:
+        positions: 每个顶点3个float;
+        indices:   每个三角形3个uint32_t顶点编号.
+    相邻三角形共享顶点, 每个三角形平均只占约12字节的索引加上6字节的顶点坐标. 如果OBJ文件给出了顶点法向量(vn),
+    还会额外保存normals和每个三角形的3个法向量编号, 求交后用重心坐标插值得到平滑的着色法向量; 否则使用三角形本身的几何法向量.
+
+    网格在加载时构建自己的BVH(见bvh.h), 每个叶子最多8个三角形, 三角形的索引按照叶子顺序重新排列, 所以一个叶子对应indices中连续的一段.
+    射线与三角形求交使用Möller–Trumbore算法. 叶子中的三角形先从共享顶点中取出v0和两条边放进栈上的小SoA数组,
+    再成批测试: 开启AVX2时每条256位指令处理4个三角形, 否则是普通的标量循环.
+
+    用法: 用load_obj()从OBJ文件加载, 或者逐个add_vertex()/add_triangle(), 最后调用一次build(). 之后是只读的, 可以被多个渲染线程同时使用.
+*/
+class triangle_mesh : public surface {
+    public:
+        static const int simd_width = 8;        // 一个叶子最多包含的三角形个数, 也就是一次成批测试的三角形个数.
+
+    public:
+        // parameter constructor.
+        explicit triangle_mesh(const material* m_ptr = nullptr) : mat_ptr{m_ptr} {}
+
+    public:
+        // 从Wavefront OBJ文件加载顶点(v), 顶点法向量(vn)和面(f), 多边形面按扇形拆分成三角形, 其他语句忽略. 加载完成后自动调用build().
+        bool load_obj(const std::string& path, std::string& error);
+
+        void add_vertex(const point3& p);
+        void add_normal(const vec3& n);
+        // 添加一个三角形, a, b, c是顶点编号; 有法向量时na, nb, nc是法向量编号, 否则传入-1.
+        void add_triangle(const uint32_t a, const uint32_t b, const uint32_t c, const int na = -1, const int nb = -1, const int nc = -1);
+        // 构建BVH并按照叶子顺序重排三角形. 所有add_triangle()之后必须调用一次build().
+        void build();
+
+        size_t vertex_count() const { return positions.size() / 3; }
+        size_t triangle_count() const { return indices.size() / 3; }
+        size_t memory_bytes() const;
+
+        virtual bool intersect(const ray& r, double t_min, double t_max, hit_query& q) const override;
+        virtual void finalize(const ray& r, const hit_query& q, hit_record& rec) const override;
+        virtual bool occluded(const ray& r, double t_min, double t_max) const override;
+        virtual bool bounding_box(aabb& output_box) const override;
+        virtual void collect_lights(light_list& lights) const override;
+
+    private:
+        point3 vertex(const uint32_t k) const { return point3(positions[3*k], positions[3*k + 1], positions[3*k + 2]); }
+        vec3 normal(const uint32_t k) const { return vec3(normals[3*k], normals[3*k + 1], normals[3*k + 2]); }
+
+        // 测试从offset开始的count(<= 8)个三角形, 返回最近交点对应的三角形编号并更新t_max和重心坐标(u, v), 没有交点返回-1.
+        int hit_leaf(const ray& r, const int offset, const int count, const double t_min, double& t_max, double& hit_u, double& hit_v) const;
+
+    private:
+        std::vector<float> positions;
+        std::vector<uint32_t> indices;
+        std::vector<float> normals;                 // 可以为空.
+        std::vector<uint32_t> normal_indices;       // 与indices一一对应; 所有三角形都有法向量时才保存, 否则为空.
+        bool all_triangles_have_normals = true;
+        const material* mat_ptr;                    // 材质由场景的材质表持有.
+
+        bvh_tree tree;
+};
+
+void triangle_mesh::add_vertex(const point3& p) {
+    positions.push_back(static_cast<float>(p.x()));
+    positions.push_back(static_cast<float>(p.y()));
+    positions.push_back(static_cast<float>(p.z()));
+}
+
+void triangle_mesh::add_normal(const vec3& n) {
+    normals.push_back(static_cast<float>(n.x()));
+    normals.push_back(static_cast<float>(n.y()));
+    normals.push_back(static_cast<float>(n.z()));
+}
+
+void triangle_mesh::add_triangle(const uint32_t a, const uint32_t b, const uint32_t c, const int na, const int nb, const int nc) {
+    indices.push_back(a);
+    indices.push_back(b);
+    indices.push_back(c);
+    if(na < 0 || nb < 0 || nc < 0) {
+        all_triangles_have_normals = false;
+        return;
+    }
+    normal_indices.push_back(static_cast<uint32_t>(na));
+    normal_indices.push_back(static_cast<uint32_t>(nb));
+    normal_indices.push_back(static_cast<uint32_t>(nc));
+}
+
+void triangle_mesh::build() {
+    // 只有部分三角形有法向量时无法一致地插值, 全部使用几何法向量.
+    if(!all_triangles_have_normals || normals.empty()) {
+        normals.clear();
+        normals.shrink_to_fit();
+        normal_indices.clear();
+        normal_indices.shrink_to_fit();
+    }
+
+    const size_t n = triangle_count();
+    std::vector<aabb> boxes(n);
+    for(size_t k = 0; k < n; ++k) {
+        aabb box;
+        for(int corner = 0; corner < 3; ++corner)
+            box.expand(vertex(indices[3*k + corner]));
+        boxes[k] = box;
+    }
+    tree.build(boxes, simd_width, simd_width);
+
+    // 按照叶子顺序重排三角形(每个三角形3个编号).
+    auto reorder = [&](std::vector<uint32_t>& values) {
+        if(values.empty()) return;
+        std::vector<uint32_t> sorted(values.size());
+        for(size_t k = 0; k < n; ++k) {
+            const size_t from = static_cast<size_t>(tree.primitive_order()[k]);
+            sorted[3*k]     = values[3*from];
+            sorted[3*k + 1] = values[3*from + 1];
+            sorted[3*k + 2] = values[3*from + 2];
+        }
+        values.swap(sorted);
+    };
+    reorder(indices);
+    reorder(normal_indices);
+    tree.release_primitive_order();
+}
+
+size_t triangle_mesh::memory_bytes() const {
+    return positions.size() * sizeof(float) + normals.size() * sizeof(float)
+         + (indices.size() + normal_indices.size()) * sizeof(uint32_t)
+         + tree.nodes().size() * sizeof(bvh_linear_node);
+}
+
+bool triangle_mesh::intersect(const ray& r, double t_min, double t_max, hit_query& q) const {
+    int nearest = -1;
+    double u = 0.0, v = 0.0;
+    uint64_t tests = 0;                     // 测试的图元数, 遍历结束后一次加到线程的计数器上.
+    tree.traverse(r, t_min, t_max, [&](const int offset, const int count, double& closest_so_far) {
+        tests += static_cast<uint64_t>(count);
+        const int k = hit_leaf(r, offset, count, t_min, closest_so_far, u, v);
+        if(k < 0) return false;
+        nearest = k;
+        return true;
+    });
+    thread_counters().triangle_tests += tests;
+    if(nearest < 0) return false;
+
+    q.t = t_max;
+    q.object = this;
+    q.primitive = static_cast<uint32_t>(nearest);
+    q.u = u;
+    q.v = v;
+    q.instance_depth = 0;
+    return true;
+}
+
+void triangle_mesh::finalize(const ray& r, const hit_query& q, hit_record& rec) const {
+    const uint32_t* tri = &indices[3 * static_cast<size_t>(q.primitive)];
+    const point3 v0 = vertex(tri[0]);
+    const vec3 geometric_normal = unit_vector(cross(vertex(tri[1]) - v0, vertex(tri[2]) - v0));
+
+    rec.t = q.t;
+    rec.p = r.at(rec.t);
+    rec.set_face_nomral(r, geometric_normal);       // 射线在哪一侧由几何法向量决定.
+    if(!normal_indices.empty()) {
+        // 插值得到的着色法向量翻转到与rec.normal同一侧, 避免掠射时法向量指向表面背面.
+        const uint32_t* ni = &normal_indices[3 * static_cast<size_t>(q.primitive)];
+        const vec3 shading = unit_vector((1.0 - q.u - q.v) * normal(ni[0]) + q.u * normal(ni[1]) + q.v * normal(ni[2]));
+        rec.normal = dot(shading, rec.normal) < 0 ? -shading : shading;
+    }
+    rec.mat_ptr = mat_ptr;
+}
+
+bool triangle_mesh::occluded(const ray& r, double t_min, double t_max) const {
+    // 不需要重心坐标和法向量, 叶子中任何一个三角形相交就返回.
+    uint64_t tests = 0;
+    const bool hit = tree.any_hit(r, t_min, t_max, [&](const int offset, const int count) {
+        tests += static_cast<uint64_t>(count);
+        double limit = t_max, u, v;
+        return hit_leaf(r, offset, count, t_min, limit, u, v) >= 0;
+    });
+    thread_counters().triangle_tests += tests;
+    return hit;
+}
+
+bool triangle_mesh::bounding_box(aabb& output_box) const {
+    if(tree.empty()) return false;
+    output_box = tree.bounds();
+    return true;
+}
+
+void triangle_mesh::collect_lights(light_list& lights) const {
+    // 整个网格使用同一个材质, 不发光时一个三角形也不会加入.
+    for(size_t k = 0; k < triangle_count(); ++k)
+        lights.add_triangle(vertex(indices[3*k]), vertex(indices[3*k + 1]), vertex(indices[3*k + 2]), mat_ptr);
+}
+
+/*
+    Möller–Trumbore: 把交点写成重心坐标 P = (1-u-v) v0 + u v1 + v v2 = O + t D, 用克莱姆法则解出(t, u, v):
+        e1 = v1 - v0, e2 = v2 - v0, s = O - v0, p = D x e2, q = s x e1, det = e1 . p
+        u = (s . p) / det, v = (D . q) / det, t = (e2 . q) / det
+    u >= 0, v >= 0, u + v <= 1时交点在三角形内. det接近0时射线与三角形平面平行.
+*/
+int triangle_mesh::hit_leaf(const ray& r, const int offset, const int count, const double t_min, double& t_max, double& hit_u, double& hit_v) const {
+    // 从共享顶点中取出叶子里每个三角形的v0和两条边, 按照SoA排列. 末尾不足的lane填0, det = 0不会产生交点.
+    alignas(32) double v0x[simd_width] = {}, v0y[simd_width] = {}, v0z[simd_width] = {};
+    alignas(32) double e1x[simd_width] = {}, e1y[simd_width] = {}, e1z[simd_width] = {};
+    alignas(32) double e2x[simd_width] = {}, e2y[simd_width] = {}, e2z[simd_width] = {};
+    for(int lane = 0; lane < count; ++lane) {
+        const uint32_t* tri = &indices[3 * static_cast<size_t>(offset + lane)];
+        const float* a = &positions[3 * static_cast<size_t>(tri[0])];
+        const float* b = &positions[3 * static_cast<size_t>(tri[1])];
+        const float* c = &positions[3 * static_cast<size_t>(tri[2])];
+        v0x[lane] = a[0];          v0y[lane] = a[1];          v0z[lane] = a[2];
+        e1x[lane] = b[0] - v0x[lane]; e1y[lane] = b[1] - v0y[lane]; e1z[lane] = b[2] - v0z[lane];
+        e2x[lane] = c[0] - v0x[lane]; e2y[lane] = c[1] - v0y[lane]; e2z[lane] = c[2] - v0z[lane];
+    }
+
+    const point3 o = r.origin();
+    const vec3 d = r.direcion();
+    const double det_epsilon = 1e-12;
+    alignas(32) double ts[simd_width], us[simd_width], vs[simd_width];
+
+#if defined(__AVX2__)
+    const __m256d ox = _mm256_set1_pd(o.x()), oy = _mm256_set1_pd(o.y()), oz = _mm256_set1_pd(o.z());
+    const __m256d dx = _mm256_set1_pd(d.x()), dy = _mm256_set1_pd(d.y()), dz = _mm256_set1_pd(d.z());
+    const __m256d vt_min = _mm256_set1_pd(t_min), vt_max = _mm256_set1_pd(t_max);
+    const __m256d vinf = _mm256_set1_pd(infinity), zero = _mm256_setzero_pd(), one = _mm256_set1_pd(1.0);
+    const __m256d veps = _mm256_set1_pd(det_epsilon), sign_mask = _mm256_set1_pd(-0.0);
+    for(int lane = 0; lane < count; lane += 4) {
+        const __m256d ax = _mm256_load_pd(&e1x[lane]), ay = _mm256_load_pd(&e1y[lane]), az = _mm256_load_pd(&e1z[lane]);
+        const __m256d bx = _mm256_load_pd(&e2x[lane]), by = _mm256_load_pd(&e2y[lane]), bz = _mm256_load_pd(&e2z[lane]);
+
+        // p = D x e2, det = e1 . p
+        const __m256d px = _mm256_sub_pd(_mm256_mul_pd(dy, bz), _mm256_mul_pd(dz, by));
+        const __m256d py = _mm256_sub_pd(_mm256_mul_pd(dz, bx), _mm256_mul_pd(dx, bz));
+        const __m256d pz = _mm256_sub_pd(_mm256_mul_pd(dx, by), _mm256_mul_pd(dy, bx));
+        const __m256d det = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(ax, px), _mm256_mul_pd(ay, py)), _mm256_mul_pd(az, pz));
+        const __m256d not_parallel = _mm256_cmp_pd(_mm256_andnot_pd(sign_mask, det), veps, _CMP_GT_OQ);
+        if(_mm256_movemask_pd(not_parallel) == 0) {
+            _mm256_store_pd(&ts[lane], vinf);
+            continue;
+        }
+        const __m256d inv_det = _mm256_div_pd(one, det);
+
+        // s = O - v0, u = (s . p) / det
+        const __m256d sx = _mm256_sub_pd(ox, _mm256_load_pd(&v0x[lane]));
+        const __m256d sy = _mm256_sub_pd(oy, _mm256_load_pd(&v0y[lane]));
+        const __m256d sz = _mm256_sub_pd(oz, _mm256_load_pd(&v0z[lane]));
+        const __m256d u = _mm256_mul_pd(_mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(sx, px), _mm256_mul_pd(sy, py)), _mm256_mul_pd(sz, pz)), inv_det);
+
+        // q = s x e1, v = (D . q) / det, t = (e2 . q) / det
+        const __m256d qx = _mm256_sub_pd(_mm256_mul_pd(sy, az), _mm256_mul_pd(sz, ay));
+        const __m256d qy = _mm256_sub_pd(_mm256_mul_pd(sz, ax), _mm256_mul_pd(sx, az));
+        const __m256d qz = _mm256_sub_pd(_mm256_mul_pd(sx, ay), _mm256_mul_pd(sy, ax));
+        const __m256d v = _mm256_mul_pd(_mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(dx, qx), _mm256_mul_pd(dy, qy)), _mm256_mul_pd(dz, qz)), inv_det);
+        const __m256d t = _mm256_mul_pd(_mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(bx, qx), _mm256_mul_pd(by, qy)), _mm256_mul_pd(bz, qz)), inv_det);
+
+        __m256d ok = _mm256_and_pd(not_parallel, _mm256_cmp_pd(u, zero, _CMP_GE_OQ));
+        ok = _mm256_and_pd(ok, _mm256_cmp_pd(v, zero, _CMP_GE_OQ));
+        ok = _mm256_and_pd(ok, _mm256_cmp_pd(_mm256_add_pd(u, v), one, _CMP_LE_OQ));
+        ok = _mm256_and_pd(ok, _mm256_cmp_pd(t, vt_min, _CMP_GE_OQ));
+        ok = _mm256_and_pd(ok, _mm256_cmp_pd(t, vt_max, _CMP_LE_OQ));
+        _mm256_store_pd(&ts[lane], _mm256_blendv_pd(vinf, t, ok));
+        _mm256_store_pd(&us[lane], u);
+        _mm256_store_pd(&vs[lane], v);
+    }
+#else
+    for(int lane = 0; lane < count; ++lane) {
+        ts[lane] = infinity;
+        const vec3 e1(e1x[lane], e1y[lane], e1z[lane]), e2(e2x[lane], e2y[lane], e2z[lane]);
+        const vec3 p = cross(d, e2);
+        const double det = dot(e1, p);
+        if(std::fabs(det) <= det_epsilon) continue;
+        const double inv_det = 1.0 / det;
+
+        const vec3 s(o.x() - v0x[lane], o.y() - v0y[lane], o.z() - v0z[lane]);
+        const double u = dot(s, p) * inv_det;
+        if(u < 0.0 || u > 1.0) continue;
+        const vec3 q = cross(s, e1);
+        const double v = dot(d, q) * inv_det;
+        if(v < 0.0 || u + v > 1.0) continue;
+        const double t = dot(e2, q) * inv_det;
+        if(t < t_min || t_max < t) continue;
+
+        ts[lane] = t;
+        us[lane] = u;
+        vs[lane] = v;
+    }
+#endif
+
+    int nearest = -1;
+    for(int lane = 0; lane < count; ++lane) {
+        if(ts[lane] < infinity && ts[lane] <= t_max) {
+            t_max = ts[lane];
+            hit_u = us[lane];
+            hit_v = vs[lane];
+            nearest = offset + lane;
+        }
+    }
+    return nearest;
+}
+
+/*
+    OBJ解析. 文件映射到内存后逐行扫描, 数字直接在映射的内存上解析, 不为每一行构造std::string.
+    映射的内存不以'\0'结尾, 所以解析时总是带着行尾指针, 不能直接对它调用strtod.
+*/
+namespace obj_detail {
+
+    inline const char* skip_spaces(const char* p, const char* end) {
+        while(p < end && (*p == ' ' || *p == '\t')) ++p;
+        return p;
+    }
+
+    // 解析一个浮点数. 数字先复制到一个小缓冲区里再交给strtod, 保证不会读到行尾之后.
+    inline bool parse_double(const char*& p, const char* end, double& value) {
+        p = skip_spaces(p, end);
+        char buffer[64];
+        int n = 0;
+        while(p < end && n < 63 && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n')
+            buffer[n++] = *p++;
+        buffer[n] = '\0';
+        char* parsed_end;
+        value = std::strtod(buffer, &parsed_end);
+        return n > 0 && parsed_end == buffer + n;
+    }
+
+    // 解析一个整数, 可以带负号. 没有数字或者绝对值超过INT_MAX时返回false; 超过时仍然跳过剩下的数字, 不会把它们当成下一个编号.
+    inline bool parse_int(const char*& p, const char* end, long& value) {
+        const bool negative = p < end && *p == '-';
+        if(negative) ++p;
+        if(p >= end || *p < '0' || *p > '9') return false;
+        long v = 0;
+        bool overflow = false;
+        for(; p < end && *p >= '0' && *p <= '9'; ++p) {
+            overflow = overflow || v > (INT_MAX - (*p - '0')) / 10;
+            if(!overflow) v = 10*v + (*p - '0');
+        }
+        value = negative ? -v : v;
+        return !overflow;
+    }
+
+    // OBJ的编号从1开始, 负数表示从当前已有元素的末尾往前数.
+    inline bool resolve_index(const long index, const size_t count, uint32_t& resolved) {
+        const long k = index > 0 ? index - 1 : static_cast<long>(count) + index;
+        if(index == 0 || k < 0 || static_cast<size_t>(k) >= count) return false;
+        resolved = static_cast<uint32_t>(k);
+        return true;
+    }
+
+}
+
+bool triangle_mesh::load_obj(const std::string& path, std::string& error) {
+    mapped_file file(path);
+    if(!file.is_open()) {
+        error = "cannot open " + path;
+        return false;
+    }
+
+    const char* p = reinterpret_cast<const char*>(file.data());
+    const char* const file_end = p + file.size();
+    // 粗略预留空间: OBJ中一个顶点或者一个面大约占30字节.
+    positions.reserve(positions.size() + file.size() / 30);
+    indices.reserve(indices.size() + file.size() / 30);
+
+    std::vector<uint32_t> face_vertices, face_normals;
+    const uint32_t first_vertex = static_cast<uint32_t>(vertex_count());
+    const uint32_t first_normal = static_cast<uint32_t>(normals.size() / 3);
+    for(int line_number = 1; p < file_end; ++line_number) {
+        const char* line_end = p;
+        while(line_end < file_end && *line_end != '\n') ++line_end;
+        const char* const line_start = obj_detail::skip_spaces(p, line_end);
+        const char* q = line_start;
+        p = line_end + 1;
+
+        bool ok = true;
+        if(line_end - q >= 2 && q[0] == 'v' && (q[1] == ' ' || q[1] == '\t')) {
+            double x, y, z;
+            q += 2;
+            ok = obj_detail::parse_double(q, line_end, x) && obj_detail::parse_double(q, line_end, y) && obj_detail::parse_double(q, line_end, z);
+            if(ok) add_vertex(point3(x, y, z));
+        }
+        else if(line_end - q >= 3 && q[0] == 'v' && q[1] == 'n' && (q[2] == ' ' || q[2] == '\t')) {
+            double x, y, z;
+            q += 3;
+            ok = obj_detail::parse_double(q, line_end, x) && obj_detail::parse_double(q, line_end, y) && obj_detail::parse_double(q, line_end, z);
+            if(ok) add_normal(vec3(x, y, z));
+        }
+        else if(line_end - q >= 2 && q[0] == 'f' && (q[1] == ' ' || q[1] == '\t')) {
+            // 每个角的格式为 v, v/vt, v//vn 或 v/vt/vn, 纹理坐标忽略.
+            face_vertices.clear();
+            face_normals.clear();
+            const size_t num_vertices = vertex_count() - first_vertex, num_normals = normals.size() / 3 - first_normal;
+            q += 2;
+            while(ok) {
+                q = obj_detail::skip_spaces(q, line_end);
+                if(q >= line_end || *q == '\r') break;
+                long v, vn = 0, vt;
+                uint32_t resolved;
+                ok = obj_detail::parse_int(q, line_end, v) && obj_detail::resolve_index(v, num_vertices, resolved);
+                if(!ok) break;
+                face_vertices.push_back(first_vertex + resolved);
+                if(q < line_end && *q == '/') {
+                    ++q;
+                    obj_detail::parse_int(q, line_end, vt);
+                    if(q < line_end && *q == '/') {
+                        ++q;
+                        ok = obj_detail::parse_int(q, line_end, vn);
+                    }
+                }
+                if(ok && vn != 0) {
+                    ok = obj_detail::resolve_index(vn, num_normals, resolved);
+                    face_normals.push_back(first_normal + resolved);
+                }
+            }
+            ok = ok && face_vertices.size() >= 3;
+            const bool has_normals = face_normals.size() == face_vertices.size();
+            for(size_t k = 1; ok && k + 1 < face_vertices.size(); ++k) {
+                if(has_normals)
+                    add_triangle(face_vertices[0], face_vertices[k], face_vertices[k + 1],
+                                 static_cast<int>(face_normals[0]), static_cast<int>(face_normals[k]), static_cast<int>(face_normals[k + 1]));
+                else
+                    add_triangle(face_vertices[0], face_vertices[k], face_vertices[k + 1]);
+            }
+        }
+        // 其他语句(注释, vt, o, g, s, usemtl, mtllib等)忽略.
+
+        if(!ok) {
+            error = path + ":" + std::to_string(line_number) + ": cannot parse \"" + std::string(line_start, line_end) + "\"";
+            return false;
+        }
+    }
+
+    if(indices.empty()) {
+        error = path + " contains no faces";
+        return false;
+    }
+    build();
+    return true;
+}
+
+#endif
@@ -7,12 +7,12 @@
 #include "ray.h"
 #include "vec3.h"
 #include "hit_record.h"
+#include "sampler.h"
 
 #include <cmath>
-#include <ctime>
+#include <cstdint>
 #include <limits>
 #include <memory>
-#include <random>
 
 // constants.
 const double infinity = std::numeric_limits<double>::infinity();
@@ -29,43 +29,88 @@ inline double radian_to_degrees(double radian) {
 }
 
 /*
-    随机数发生器(随机数引擎+随机数分布函数)应定义为static类型从而使得每次发生器运行都能得到不同的随机数值.
-    如果一个随机数发生器被定义成了普通类型, 即随机数引擎对象和关联的分布函数对象被定义成了普通类型, 那么在每次包含随机数发生器代码的函数被运行时, 它们都会返回相同的数值序列. 
-    序列不变这一事实在调试时非常有用. 但是应用正式投入使用时则必须把随机数发生器定义为staitc静态类型, 这样可保证每次运行随机数发生器时, 都能得到不同的随机数值.
-	
-    设置随机数发生器种子: 把随机数发生器定义为staitc可有效的防止在应用程序运行阶段, 多次运行随机数发生器得到相同的随机数值; 
-                         但是并没有解决应用程序被反复运行带来的随机数发生器得到相同随机数序列的问题.
-                         通常希望每次运行应用程序都会生成不同的随机序列结果, 可以通过提供一个种子(seed)来达到这一目的. 
-                         种子就是一个数值, 随机数引擎可以利用它从序列中一个新位置重新开始生产原始随机数.
-    为引擎设置种子有两种方式:
-		- 在创建随机数引擎对象时显式提供种子.
-		- 调用随机数引擎对象的`seed()`成员函数设置种子.
-	种子最优选择极其困难, 最常用方法调用系统函数time_t time( time_t* second );
-    选择一个好的种子是极其困难的事情, 可能最常用的方法是调用系统函数time(). 这一函数定义在头文件<ctime>中, 它返回一个特定时刻到当前经历了多少秒. 
-    函数time()接受单个指针参数, 它指向用于写入时间的数据结构. 如果此指针为空time(nullptr), 则函数简单的返回以秒为单位的当前时间.
-		- 由于time()返回的是以秒为单位的时间, 所以如果应用程序的启动频繁性比秒级还高的话, 那么使用time()函数作为种子就无效.
+    随机数发生器.
+    最初的实现是函数内的static std::mt19937引擎加上以time(nullptr)为种子, 这在多线程渲染时有两个问题:
+        1. 所有线程共享一个引擎, 同时读写引擎状态是data race;
+        2. 以时间为种子, 每次运行得到的图像都不同, 无法复现. 另外static的分布函数对象只在第一次调用时构造, 之后传入的[vmin, vmax]都被忽略了.
+    现在每个线程各自持有一个轻量的sampler(PCG32引擎, 见sampler.h), 渲染器在每个像素的每个采样开始之前, 
+    都用(全局种子, 像素坐标, 采样编号)重新设置当前线程sampler的状态, 因此渲染结果与线程数目无关, 相同种子得到逐位相同的图像.
+    random_double()等函数从当前线程的sampler取独立的随机数; 渲染路径上的采样(像素抖动, 镜头, 散射方向, 俄罗斯轮盘赌)使用下面的sample_1d()/sample_2d().
 */
-inline double random_double(const double vmin = 0.0, const double vmax = 1.0) {
-    // 随机数发生器需要定义为静态类型, 并且设置良好的种子.
-    // 随机数引擎是函数对象类, 定义了一个不接受参数的调用运算符(), 返回一个随机数引擎对象可以生成的unsigned类型原始整数, 取值范围内的每个整数被生成的概率相同, 服从均匀分布. 
-    // 对于大多数场合, 随机数引擎函数对象的输出是不能直接使用的, 因为通常随机数引擎对象生成的随机数的值返回与需求范围不符合, 这也是为什么被称作原始随机数的原因.
-    static std::mt19937 generator(time(nullptr));                               // 选择随机数引擎类, 并选择良好的种子.
-    // 随机数分布函数对象类: 类似于随机数引擎类, 随机数分布类也是函数对象(模板)类. 
-    // 分布函数对象类型定义了一个接受一个随机数引擎函数对象作为参数的调用运算符, 分布对象使用它的引擎参数生成符合自身概率分布的指定整数或浮点数类型(类模板T)随机数. 
-    // 分布类型都是类模板, 具有单一的模板类型参数, 表示分布生成的随机数的数据类型, 这些分布要么生成随机整数要么生成随机浮点数, 
-    // 每个分布类型都有一个默认模板实参, 生成浮点数的默认是double生成整数的默认是int.
-    static std::uniform_real_distribution<double> distribution(vmin, vmax);       // 选择范围在[vmin,vmax]之间的双精度浮点数均匀分布函数.
+inline sampler& thread_sampler() {
+    thread_local sampler s;
+    return s;
+}
 
-    // 返回一个[vmin,vmax]范围内的随机双精度浮点数.
-    return distribution(generator);
+// 返回一个[vmin,vmax)范围内的随机双精度浮点数.
+inline double random_double(const double vmin = 0.0, const double vmax = 1.0) {
+    return vmin + (vmax - vmin) * thread_sampler().next_double();
 }
 
+// 返回一个[vmin,vmax]范围内的随机整数.
+// 区间长度用无符号数计算, vmax - vmin超过INT_MAX时不会溢出; 区间是整个int范围时长度加一回绕为0, 直接取一个32位的随机数.
 inline int random_int(const int vmin = 0, const int vmax = 1) {
-    static std::mt19937 generator(time(nullptr));                               // 选择随机数引擎类, 并选择良好的种子.
-    static std::uniform_int_distribution<int> distribution(vmin, vmax);       // 选择范围在[vmin,vmax]之间的整数均匀分布函数.
+    const uint32_t span = static_cast<uint32_t>(vmax) - static_cast<uint32_t>(vmin);
+    const uint32_t offset = span == UINT32_MAX ? thread_sampler().next_uint() : thread_sampler().next_uint(span + 1u);
+    return static_cast<int>(static_cast<uint32_t>(vmin) + offset);
+}
+
+// 从当前线程的sampler按顺序取下一个(组)采样维度. 与random_double()不同, sobol采样器下同一像素的各个采样在每个维度上是分层的.
+inline double sample_1d() { return thread_sampler().next_1d(); }
+inline point2 sample_2d() { return thread_sampler().next_2d(); }
 
-    // 返回一个[vmin,vmax]范围内的随机整数.
-    return distribution(generator);
+/*
+    把[0,1)^2上的均匀采样点变换(warp)到其他区域上的闭式(closed-form)映射.
+    最初的random_in_unit_sphere和random_in_unit_disk都是拒绝采样: 在立方体/正方形内取点, 落在球/圆外就重取, 循环次数不确定,
+    而且无法利用分层的采样点(一个分层的点被拒绝之后就丢掉了它的分层性质). 闭式映射每次只用固定个数的随机数, 并且保持分层性质.
+*/
+// Shirley-Chiu同心圆映射(concentric mapping): 把[-1,1]^2的同心正方形映射为同心圆, 面积比例不变, 形变比极坐标映射小.
+inline vec3 sample_unit_disk(const point2& u) {
+    const double a = 2.0*u.x - 1.0;
+    const double b = 2.0*u.y - 1.0;
+    if(a == 0.0 && b == 0.0) return vec3(0.0, 0.0, 0.0);
+    double r, theta;
+    if(std::fabs(a) > std::fabs(b)) {
+        r = a;
+        theta = (pi/4) * (b/a);
+    }
+    else {
+        r = b;
+        theta = (pi/2) - (pi/4) * (a/b);
+    }
+    return vec3(r*std::cos(theta), r*std::sin(theta), 0.0);
+}
+
+// 单位球面上的均匀分布: z在[-1,1]上均匀分布(阿基米德定理), 方位角在[0, 2pi)上均匀分布.
+inline vec3 sample_unit_sphere_surface(const point2& u) {
+    const double z = 1.0 - 2.0*u.x;
+    const double r = std::sqrt(std::fmax(0.0, 1.0 - z*z));
+    const double phi = 2.0*pi*u.y;
+    return vec3(r*std::cos(phi), r*std::sin(phi), z);
+}
+
+// 单位球内的均匀分布: 方向在球面上均匀分布, 半径取 r = cbrt(u), 使得半径r以内的概率与体积r^3成正比.
+inline vec3 sample_unit_ball(const point2& u, const double u_radius) {
+    return std::cbrt(u_radius) * sample_unit_sphere_surface(u);
+}
+
+// 由单位向量n构造一组正交基(b1, b2, n). Duff et al., "Building an Orthonormal Basis, Revisited", JCGT 2017, 无分支无除零.
+inline void orthonormal_basis(const vec3& n, vec3& b1, vec3& b2) {
+    const double sign = std::copysign(1.0, n.z());
+    const double a = -1.0 / (sign + n.z());
+    const double b = n.x() * n.y() * a;
+    b1 = vec3(1.0 + sign * n.x() * n.x() * a, sign * b, -sign * n.x());
+    b2 = vec3(b, sign + n.y() * n.y() * a, -n.y());
+}
+
+// 余弦加权的半球采样, pdf = cos(theta) / pi. Malley方法: 单位圆盘上的均匀点向上投影到半球面上.
+// 返回以单位法向量normal为轴的半球内的单位向量.
+inline vec3 sample_cosine_hemisphere(const vec3& normal, const point2& u) {
+    const vec3 d = sample_unit_disk(u);
+    const double z = std::sqrt(std::fmax(0.0, 1.0 - d.x()*d.x() - d.y()*d.y()));
+    vec3 b1, b2;
+    orthonormal_basis(normal, b1, b2);
+    return d.x()*b1 + d.y()*b2 + z*normal;
 }
 
 // 千万别uitility.h和vec3.h互相include, 把所有utility函数都定义在utility头文件中/
@@ -79,20 +124,14 @@ inline vec3 random_vec3(const double vmin = -1.0, const double vmax = 1.0) {
 
 // 定义一个随机空间点生成函数, 该随机点位于球心为原点半径为1的球的内部.
 inline vec3 random_in_unit_sphere() {
-    vec3 p;
-    while(true) {
-        p = random_vec3(-1.0, 1.0);     // 生成一个随机双精度空间点, 该空间点位于中心在原点边长为2的立方体内.
-        if(p.lenth_squared() < 1)
-            break; 
-    }
-    return p;
+    const double u = random_double();
+    return sample_unit_ball({u, random_double()}, random_double());
 }
 
 // 通过取一个中心在原点的单位球表面的随机点, 定义一个长度为1的随机单位向量.
 inline vec3 random_unit_vector() {
-    vec3 p = random_in_unit_sphere();
-    // 对一个半径为1的球内部点做单位化, 就得到位于球表面的点, 同样也得到一个可以360度指向的长度为1的单位向量.
-    return p / p.length();
+    const double u = random_double();
+    return sample_unit_sphere_surface({u, random_double()});
 }
 
 // 定义一个以等概率(均匀分布)在一个和法向量同方向的半球内返回一个随机方向向量函数.
@@ -105,13 +144,8 @@ inline vec3 random_in_hemisphere(const vec3& normal) {
 
 // 在一个x-y平面或u-v平面的以原点为中心的单位圆上取随机空间点.
 inline vec3 random_in_unit_disk() {
-    vec3 p;
-    while(true) {
-        p = vec3(random_double(-1.0, 1.0), random_double(-1.0, 1.0), 0.0);  // // 在一个x-y平面或u-v平面的以原点为中心的单位圆上取随机点.      
-        if(p.lenth_squared() < 1)
-            break; 
-    }
-    return p;
+    const double u = random_double();
+    return sample_unit_disk({u, random_double()});
 }
 
 // 定义一个clamp函数, 把值框定在一个范围内, 超过范围则就近取边界值.
@@ -4,64 +4,83 @@
 #include <cmath>
 #include <iostream>
 
-class vec3 {
+template<typename T>
+class vec3_t {
     public:
+        using value_type = T;
+
         // parameter and default constructor
-        vec3(const double e1 = 0.0, const double e2 = 0.0, const double e3 = 0.0) : e{e1, e2, e3} {}
+        vec3_t(const T e1 = T(0), const T e2 = T(0), const T e3 = T(0)) : e{e1, e2, e3} {}
+        // 不同精度之间的转换必须显式写出, 例如vec3_t<double>(v), 避免无意中丢失精度.
+        template<typename U>
+        explicit vec3_t(const vec3_t<U>& v) : e{static_cast<T>(v[0]), static_cast<T>(v[1]), static_cast<T>(v[2])} {}
 
         // 我们只显示定义了parameter constructor, 因此Big-five都使用默认合成版本.
     public:
         // 这一pulic区定义运算符重载函数.
 
-        vec3 operator-() const { return {-e[0], -e[1], -e[2]}; }                    // 重载取负运算符.
+        vec3_t operator-() const { return {-e[0], -e[1], -e[2]}; }                    // 重载取负运算符.
         // 对于return type是vec3本身, 并且作用于同一object必须return by reference, 并且函数内部return语句是return *this
-        vec3& operator+=(const vec3& v) {                                    
+        vec3_t& operator+=(const vec3_t& v) {                                    
             e[0] += v[0];
             e[1] += v[1];
             e[2] += v[2];
             return *this;
         }
-        vec3& operator-=(const vec3& v) {                                    
+        vec3_t& operator-=(const vec3_t& v) {                                    
             // return *this += (-v);       // 貌似这样做并不比使用内置类型复合运算符-=快.
             e[0] -= v[0];
             e[1] -= v[1];
             e[2] -= v[2];
             return *this;
         }
-        vec3& operator*=(const double t) {                                    
+        vec3_t& operator*=(const T t) {                                    
             e[0] *= t;
             e[1] *= t;
             e[2] *= t;
             return *this;
         }
-        vec3& operator/=(const double t) { return *this *= 1/t; }       // 解引用运算符*的优先级要大于所有算术运算符, 算术运算符优先级顺序要大于所有复合运算符+=,-=,/=等等.
+        vec3_t& operator/=(const T t) { return *this *= 1/t; }       // 解引用运算符*的优先级要大于所有算术运算符, 算术运算符优先级顺序要大于所有复合运算符+=,-=,/=等等.
 
         // 当调用operator[]函数的vec3 object是常量对象时, 那么编译器自动启用accessor版本, 如果非常量vec3对象那么最佳匹配mutator版本.
-        double& operator[](const int i) { return e[i]; }                      // mutator版本必须要使用return by reference, 这样返回的element的state才能被更改.
-        const double& operator[](const int i) const { return e[i]; }          // accesorr函数内部不能改变vec3 object的state, 返回const vec3 state.
+        T& operator[](const int i) { return e[i]; }                      // mutator版本必须要使用return by reference, 这样返回的element的state才能被更改.
+        const T& operator[](const int i) const { return e[i]; }          // accesorr函数内部不能改变vec3 object的state, 返回const vec3 state.
         //double operator[](const int i) const {return e[i];}                 // accessor版本有两种实现方式, 对于返回值是内置类型而言, 可以直接return by copy.
 
     public:
-        double x() const { return e[0]; }     
-        double y() const { return e[1]; }  
-        double z() const { return e[2]; }
+        T x() const { return e[0]; }     
+        T y() const { return e[1]; }  
+        T z() const { return e[2]; }
 
         // 求长度的平方和求长度具有同样的效果, 任何只是使用长度做判断的地方都可以使用长度平方, 减少求根号所带来的大量计算消耗.
-        double lenth_squared() const { return e[0]*e[0] + e[1]*e[1] + e[2]*e[2]; }
-        double length() const { return std::sqrt(lenth_squared()); }
+        T lenth_squared() const { return e[0]*e[0] + e[1]*e[1] + e[2]*e[2]; }
+        T length() const { return std::sqrt(lenth_squared()); }
 
         // 定义一个函数判断向量是否是零向量, 我们把所有分量值小于1e-8的向量看做是趋近于0的向量, 或者就是数值定义下的零向量.
         bool near_zero() const {
-            const double eps = 1e-8;
-            return (fabs(e[0]) < eps) && (fabs(e[1]) < eps) && (fabs(e[2]) < eps);
+            const T eps = T(1e-8);
+            return (std::fabs(e[0]) < eps) && (std::fabs(e[1]) < eps) && (std::fabs(e[2]) < eps);
         }
 
     private:
-        // 使用一个包含3个元素的array表示vector. We use double here, but some ray tracers use float.
+        // 使用一个包含3个元素的array表示vector. 分量的类型T由模板参数决定, 渲染器使用的精度见下面的real.
         // 从c++ primer一书, 建议用double, 因为现在编译器对double双精度浮点数的优化其运算效率已经不弱于float, 甚至很多时候还有效率更高.
-        double e[3];    
+        // 但是float只占一半的内存带宽, 同样宽度的SIMD寄存器能放下两倍的分量, 精度足够的场合float更快.
+        T e[3];
 };
 
+/*
+    real: 渲染器使用的浮点精度. 默认是double; 编译时定义RT_SINGLE_PRECISION(例如g++ -DRT_SINGLE_PRECISION)则是float.
+    vec3, point3, color和ray(见ray.h)都是这一精度的类型. 参考图像用double渲染, 精度足够的场合用float渲染.
+*/
+#if defined(RT_SINGLE_PRECISION)
+using real = float;
+#else
+using real = double;
+#endif
+
+using vec3 = vec3_t<real>;
+
 // 定义两个类型别名, 用vec3表示color和point. 通常这两个类应该稍有区别于vec3, 但是这里我们为了简单化直接定义类型别名.
 using color = vec3;     // RGB color
 using point3 = vec3;    // 3D point
@@ -84,7 +103,8 @@ using point3 = vec3;    // 3D point
 // 如果utility函数想要使用vec3类的data member的话, 需要声明为友元函数.
 
 // 全部定义为inline函数! 特别注意, 所有向量的utility函数都是返回结果的副本！！！return by copy.
-inline std::ostream& operator<<(std::ostream& out, const vec3& v) {
+template<typename T>
+inline std::ostream& operator<<(std::ostream& out, const vec3_t<T>& v) {
     // vec3只有三个element, 所以直接索引输出, 无需迭代.
     // 重载输入输出运算符绝不会加std::endl/flush/ends, 保持和标准输出std::cout一致.
     // 运算顺序从右往左.
@@ -92,18 +112,28 @@ inline std::ostream& operator<<(std::ostream& out, const vec3& v) {
 }
 
 // 定义向量的算术与运算符.
-inline vec3 operator+(const vec3& u, const vec3& v) { return vec3(u[0]+v[0], u[1]+v[1], u[2]+v[2]); }
-inline vec3 operator-(const vec3& u, const vec3& v) { return vec3(u[0]-v[0], u[1]-v[1], u[2]-v[2]); }
-inline vec3 operator*(const vec3& u, const vec3& v) { return vec3(u[0]*v[0], u[1]*v[1], u[2]*v[2]); }
-inline vec3 operator*(const double t, const vec3& v) { return vec3(t*v[0], t*v[1], t*v[2]); }
-inline vec3 operator*(const vec3& v, const double t) { return vec3(t*v[0], t*v[1], t*v[2]); }
-inline vec3 operator/(const vec3& v, const double t) { return vec3((1/t)*v[0], (1/t)*v[1], (1/t)*v[2]); }
+// 标量参数写成typename vec3_t<T>::value_type, 不参与模板参数推导, T只由向量推导, 这样double的标量也可以乘float的向量, 标量先转换为T.
+template<typename T>
+inline vec3_t<T> operator+(const vec3_t<T>& u, const vec3_t<T>& v) { return vec3_t<T>(u[0]+v[0], u[1]+v[1], u[2]+v[2]); }
+template<typename T>
+inline vec3_t<T> operator-(const vec3_t<T>& u, const vec3_t<T>& v) { return vec3_t<T>(u[0]-v[0], u[1]-v[1], u[2]-v[2]); }
+template<typename T>
+inline vec3_t<T> operator*(const vec3_t<T>& u, const vec3_t<T>& v) { return vec3_t<T>(u[0]*v[0], u[1]*v[1], u[2]*v[2]); }
+template<typename T>
+inline vec3_t<T> operator*(const typename vec3_t<T>::value_type t, const vec3_t<T>& v) { return vec3_t<T>(t*v[0], t*v[1], t*v[2]); }
+template<typename T>
+inline vec3_t<T> operator*(const vec3_t<T>& v, const typename vec3_t<T>::value_type t) { return vec3_t<T>(t*v[0], t*v[1], t*v[2]); }
+template<typename T>
+inline vec3_t<T> operator/(const vec3_t<T>& v, const typename vec3_t<T>::value_type t) { return vec3_t<T>((1/t)*v[0], (1/t)*v[1], (1/t)*v[2]); }
 
 // 定义向量的内积和外积.
-inline double dot(const vec3& u, const vec3& v) { return u[0]*v[0] + u[1]*v[1] + u[2]*v[2]; }
-inline vec3 cross(const vec3& u, const vec3& v) { return vec3(u[1]*v[2] - u[2]*v[1], u[2]*v[0] - u[0]*v[2], u[0]*v[1] - u[1]*v[0]); }
+template<typename T>
+inline T dot(const vec3_t<T>& u, const vec3_t<T>& v) { return u[0]*v[0] + u[1]*v[1] + u[2]*v[2]; }
+template<typename T>
+inline vec3_t<T> cross(const vec3_t<T>& u, const vec3_t<T>& v) { return vec3_t<T>(u[1]*v[2] - u[2]*v[1], u[2]*v[0] - u[0]*v[2], u[0]*v[1] - u[1]*v[0]); }
 
 // 定义向量的标准化, 单位化, 返回的是副本.
-inline vec3 unit_vector(const vec3& v) { return v / v.length(); }
+template<typename T>
+inline vec3_t<T> unit_vector(const vec3_t<T>& v) { return v / v.length(); }
 
 #endif
\ No newline at end of file
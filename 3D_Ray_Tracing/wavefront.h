@@ -0,0 +1,328 @@
+#ifndef WAVEFRONT_H
+#define WAVEFRONT_H
+
+#include "adaptive_sampling.h"
+#include "camera.h"
+#include "framebuffer.h"
+#include "integrator.h"
+#include "light.h"
+#include "render_options.h"
+#include "render_stats.h"
+#include "surface.h"
+#include "tile_scheduler.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+/*
+    wavefront路径追踪器(--wavefront). 计算的是与ray_color()完全相同的路径, 只是换了一种组织方式.
+
+    ray_color()是一个"megakernel": 一条路径从头走到尾, 求交, 光源采样, scatter和俄罗斯轮盘赌交替执行,
+    相邻两次调用的射线方向, 遍历的BVH节点和材质分支都互不相关, 指令和数据的局部性都很差.
+    wavefront把一个tile的全部路径(像素数 * spp条)放进若干个大的路径队列, 逐阶段(stage)处理整个队列:
+        1. camera:    为每条路径生成主射线;
+        2. intersect: 对所有活动路径做两阶段求交的第一阶段(只求t和图元), 再对命中的路径finalize;
+                      没有命中的路径累加背景颜色后结束, 命中的路径按照材质的标签(material_tag)放进各自的着色队列;
+        3. shade:     逐个材质队列处理, 同一种材质的scatter()连续执行, 标签分派的switch每次都走同一个分支. 射中光源的MIS, 光源采样都在这里, shadow ray只放进shadow队列;
+        4. shadow:    一次性测试shadow队列中所有射线的遮挡, 没有被挡住的把贡献加到路径上;
+        5. 压缩(compaction): 被吸收或者被俄罗斯轮盘赌终止的路径移出活动列表, 其余路径带着新的射线进入下一次弹射;
+        6. accumulate: 这一批路径全部结束后, 按照(像素, 采样编号)的顺序把结果加到像素上.
+    每个阶段内部是同一段代码对成千上万条路径的循环, 以后可以在阶段内部对多条射线做SIMD(例如射线包求交), 而不需要改动其他阶段.
+
+    路径的状态按照属性分别存放在数组中(structure of arrays), 数组下标是路径在这一批中的编号(slot).
+    每条路径保存一份自己的sampler: 处理一条路径之前把它复制到当前线程的sampler中, 处理完再复制回去.
+    于是每条路径取到的采样维度序列与ray_color()中完全相同, 结果也按照相同的顺序累加, 输出图像与默认的渲染器逐字节相同.
+    不支持自适应采样: 自适应采样每追加一批采样都要先看前面的结果, 与"先生成整个tile的全部路径"的方式不相容.
+
+    每个渲染线程只构造一个wavefront_integrator, 依次渲染分到的所有tile. 队列只在需要更多路径时才扩大,
+    之后的tile直接覆盖其中的内容(generate()重新初始化每条路径的全部状态), 不会每个tile都重新分配并清零几MB的数组.
+*/
+class wavefront_integrator {
+    public:
+        static const int max_paths = 1 << 15;           // 一批最多同时处理的路径数. 一个16x16的tile在100spp时是25600条.
+
+    public:
+        wavefront_integrator(const surface& scene_world, const light_list& scene_lights, const camera& camera_ref, const render_options& render_opts,
+                             const int width, const int height)
+            : world{scene_world}, lights{scene_lights}, cam{camera_ref}, opts{render_opts}, image_width{width}, image_height{height} {}
+
+        // 渲染一个tile, 每个像素固定采样opts.samples_per_pixel次, 结果写入image. 返回这一tile花费的采样数.
+        // 同一个对象可以依次渲染多个tile, 但不能被多个线程同时使用.
+        long long render_tile(const tile& tl, framebuffer& image);
+
+    private:
+        // 一条路径的状态, 每个属性一个数组.
+        struct path_queue {
+            std::vector<ray> rays;                  // 当前要追踪的射线.
+            std::vector<color> throughput;
+            std::vector<color> radiance;            // 沿路径已经收集到的光, 路径结束后就是这一采样的颜色.
+            std::vector<sampler> samplers;
+            std::vector<hit_query> queries;         // intersect阶段的结果.
+            std::vector<hit_record> hits;           // finalize之后的交点.
+            std::vector<double> scatter_pdf;        // 上一个交点上scatter()选出当前方向的pdf.
+            std::vector<uint8_t> sampled_lights;    // 上一个交点是否做过光源采样.
+            std::vector<path_features> features;    // 第一个非镜面交点的特征, 只在记录特征时才会被累加到像素上.
+            std::vector<feature_recorder> recorders;
+
+            void resize(const size_t n) {
+                rays.resize(n);
+                throughput.resize(n);
+                radiance.resize(n);
+                samplers.resize(n);
+                queries.resize(n);
+                hits.resize(n);
+                scatter_pdf.resize(n);
+                sampled_lights.resize(n);
+                features.resize(n);
+                recorders.resize(n);
+            }
+        };
+
+        // 等待测试遮挡的shadow ray, 以及不被遮挡时要加到路径slot上的贡献.
+        struct shadow_queue {
+            std::vector<int> slots;
+            std::vector<ray> rays;
+            std::vector<double> t_max;
+            std::vector<color> contribution;
+
+            void clear() {
+                slots.clear();
+                rays.clear();
+                t_max.clear();
+                contribution.clear();
+            }
+        };
+
+    private:
+        // 为slot [0, count)生成主射线. first_path是这一批中第一条路径在tile中的编号, 路径编号 = tile内像素编号 * spp + 采样编号.
+        void generate(const tile& tl, const long long first_path, const int count);
+        void intersect();
+        void shade(const int slot, const int depth);
+        void trace_shadows();
+
+    private:
+        const surface& world;
+        const light_list& lights;
+        const camera& cam;
+        const render_options& opts;
+        const int image_width, image_height;
+
+        path_queue paths;
+        shadow_queue shadows;
+        std::vector<int> material_queues[material_tag_count];      // 每种材质的着色队列, 下标是material_tag.
+        std::vector<int> active, next_active;           // 活动路径的slot.
+        std::vector<uint8_t> found;                     // intersect阶段中每条活动路径是否命中, 下标与active相同.
+        std::vector<pixel_estimator> pixels;            // 当前tile每个像素的累加值.
+        std::vector<path_features> feature_sums;        // 当前tile每个像素特征的累加值, 不记录特征时为空.
+        render_counters* counters = nullptr;            // 渲染线程的计数器, render_tile()开始时取得.
+};
+
+long long wavefront_integrator::render_tile(const tile& tl, framebuffer& image) {
+    const int tile_width = tl.x1 - tl.x0;
+    const int spp = opts.samples_per_pixel;
+    const long long total_paths = static_cast<long long>(tile_width) * (tl.y1 - tl.y0) * spp;
+    pixels.assign(static_cast<size_t>(tile_width) * (tl.y1 - tl.y0), pixel_estimator());
+    feature_sums.assign(image.has_features() ? pixels.size() : 0, path_features());
+    const size_t batch = static_cast<size_t>(std::min<long long>(total_paths, max_paths));
+    if(paths.rays.size() < batch) paths.resize(batch);
+    counters = &thread_counters();
+
+    for(long long first = 0; first < total_paths; first += max_paths) {
+        const int count = static_cast<int>(std::min<long long>(max_paths, total_paths - first));
+        generate(tl, first, count);
+        active.resize(count);
+        for(int slot = 0; slot < count; ++slot) active[slot] = slot;
+
+        // 同一批路径同时出发, 所以弹射次数对整批路径都相同.
+        // 统计按队列整批累加, 只有俄罗斯轮盘赌在shade()中逐条计数.
+        for(int depth = 0; depth < opts.max_depth && !active.empty(); ++depth) {
+            (depth == 0 ? counters->primary_rays : counters->secondary_rays) += active.size();
+            {
+                trace_scope trace("intersect", "depth", depth);
+                intersect();
+            }
+            next_active.clear();
+            shadows.clear();
+            {
+                trace_scope trace("shade", "depth", depth);
+                for(int tag = 0; tag < material_tag_count; ++tag) {
+                    counters->scatters[tag] += material_queues[tag].size();
+                    for(const int slot : material_queues[tag]) shade(slot, depth);
+                }
+            }
+            counters->shadow_rays += shadows.slots.size();
+            {
+                trace_scope trace("trace shadows", "depth", depth);
+                trace_shadows();
+            }
+            counters->record_path(depth + 1, active.size() - next_active.size());     // 没有命中, 被吸收或者被轮盘赌终止的路径.
+            active.swap(next_active);
+        }
+        counters->record_path(opts.max_depth, active.size());
+
+        // 一个像素的采样按照编号顺序累加, 与ray_color()逐个采样累加的顺序相同.
+        for(int slot = 0; slot < count; ++slot)
+            pixels[static_cast<size_t>((first + slot) / spp)].add(paths.radiance[slot]);
+        if(!feature_sums.empty()) {
+            for(int slot = 0; slot < count; ++slot) {
+                path_features& sum = feature_sums[static_cast<size_t>((first + slot) / spp)];
+                sum.albedo += paths.features[slot].albedo;
+                sum.normal += paths.features[slot].normal;
+                sum.depth += paths.features[slot].depth;
+            }
+        }
+    }
+
+    for(int j = tl.y0; j < tl.y1; ++j)
+        for(int i = tl.x0; i < tl.x1; ++i) {
+            const pixel_estimator& pixel = pixels[static_cast<size_t>(j - tl.y0) * tile_width + (i - tl.x0)];
+            image.set(i, j, pixel.sum(), pixel.count());
+            if(!feature_sums.empty()) {
+                const path_features& sum = feature_sums[static_cast<size_t>(j - tl.y0) * tile_width + (i - tl.x0)];
+                image.set_features(i, j, sum.albedo, sum.normal, sum.depth, pixel.mean_variance());
+            }
+        }
+    return total_paths;
+}
+
+void wavefront_integrator::generate(const tile& tl, const long long first_path, const int count) {
+    const int tile_width = tl.x1 - tl.x0;
+    const int spp = opts.samples_per_pixel;
+    sampler& rng = thread_sampler();
+    rng.set_type(opts.sampler_kind);
+    for(int slot = 0; slot < count; ++slot) {
+        const long long path = first_path + slot;
+        const int pixel = static_cast<int>(path / spp);
+        const int i = tl.x0 + pixel % tile_width, j = tl.y0 + pixel / tile_width;
+        // 与render_frame()中的主射线完全相同, 见那里的注释.
+        rng.start_pixel_sample(opts.seed, i, j, static_cast<uint64_t>(path % spp));
+        const point2 jitter = sample_2d();
+        const double s = (i + jitter.x) / (image_width - 1);
+        const double t = (j + jitter.y) / (image_height - 1);
+        paths.rays[slot] = cam.get_ray(s, t);
+        paths.samplers[slot] = rng;
+        paths.throughput[slot] = color(1.0, 1.0, 1.0);
+        paths.radiance[slot] = color(0.0, 0.0, 0.0);
+        paths.scatter_pdf[slot] = 0.0;
+        paths.sampled_lights[slot] = 0;
+        paths.features[slot] = path_features();
+        paths.recorders[slot] = feature_recorder{&paths.features[slot]};
+    }
+}
+
+void wavefront_integrator::intersect() {
+    // 第一阶段只求t和图元, 对所有路径连续执行, 遍历代码和BVH节点在cache中保持热.
+    found.resize(active.size());
+    for(size_t k = 0; k < active.size(); ++k) {
+        const int slot = active[k];
+        found[k] = world.intersect(paths.rays[slot], 0.001, infinity, paths.queries[slot]);
+    }
+
+    // finalize命中的路径并按照材质分组; 没有命中的路径看到背景后结束.
+    for(std::vector<int>& queue : material_queues) queue.clear();
+    for(size_t k = 0; k < active.size(); ++k) {
+        const int slot = active[k];
+        const ray& r = paths.rays[slot];
+        if(!found[k]) {
+            paths.recorders[slot].miss(r);
+            paths.radiance[slot] += paths.throughput[slot] * background(r);
+            continue;
+        }
+        const hit_query& q = paths.queries[slot];
+        q.object->finalize(r, q, paths.hits[slot]);
+        material_queues[static_cast<int>(paths.hits[slot].mat_ptr->type_tag())].push_back(slot);
+    }
+}
+
+void wavefront_integrator::shade(const int slot, const int depth) {
+    // 换上这条路径自己的sampler, 下面的计算与ray_color()中一次循环的后半部分完全相同.
+    sampler& rng = thread_sampler();
+    rng = paths.samplers[slot];
+    const ray& r = paths.rays[slot];
+    const hit_record& rec = paths.hits[slot];
+    color& throughput = paths.throughput[slot];
+    color& radiance = paths.radiance[slot];
+
+    const color emitted = material_emitted(*rec.mat_ptr);
+    if(emitted.x() > 0.0 || emitted.y() > 0.0 || emitted.z() > 0.0) {
+        double weight = 1.0;
+        if(paths.sampled_lights[slot]) {
+            const double length = r.direcion().length();
+            weight = power_heuristic(paths.scatter_pdf[slot], lights.pdf(r.origin(), r.direcion() / length, rec.t * length));
+        }
+        radiance += weight * throughput * emitted;
+    }
+
+    // 光源采样. 贡献先算好, shadow ray留到shadow阶段统一测试.
+    const bool diffuse = material_diffuse(*rec.mat_ptr);
+    const bool sample_lights = !lights.empty() && diffuse;
+    if(sample_lights) {
+        const double u_choice = sample_1d();
+        const point2 u_light = sample_2d();
+        light_sample ls;
+        if(lights.sample(rec.p, u_choice, u_light, ls)) {
+            const color f = material_eval(*rec.mat_ptr, rec, ls.direction);
+            if(f.x() > 0.0 || f.y() > 0.0 || f.z() > 0.0) {
+                const double weight = power_heuristic(ls.pdf, material_pdf(*rec.mat_ptr, rec, ls.direction));
+                shadows.slots.push_back(slot);
+                shadows.rays.push_back(ray(rec.p, ls.direction));
+                shadows.t_max.push_back(ls.distance * (1.0 - 1e-4));
+                shadows.contribution.push_back(throughput * f * ls.radiance * (weight / ls.pdf));
+            }
+        }
+    }
+
+    ray scattered;
+    color attenuation;
+    bool alive = material_scatter(*rec.mat_ptr, r, rec, attenuation, scattered);
+    paths.recorders[slot].hit(r, rec, diffuse, alive, attenuation, emitted);
+    if(alive) {
+        paths.sampled_lights[slot] = sample_lights;
+        if(sample_lights) paths.scatter_pdf[slot] = material_pdf(*rec.mat_ptr, rec, unit_vector(scattered.direcion()));
+        throughput = throughput * attenuation;
+        paths.rays[slot] = scattered;
+
+        if(depth + 1 >= opts.rr_depth) {
+            const double p = std::fmax(throughput.x(), std::fmax(throughput.y(), throughput.z()));
+            if(p < 1.0) {
+                if(sample_1d() >= p) {
+                    alive = false;
+                    ++counters->rr_kills;
+                }
+                else throughput /= p;
+            }
+        }
+    }
+    if(alive) next_active.push_back(slot);
+    paths.samplers[slot] = rng;
+}
+
+void wavefront_integrator::trace_shadows() {
+    for(size_t k = 0; k < shadows.slots.size(); ++k)
+        if(!world.occluded(shadows.rays[k], 0.001, shadows.t_max[k]))
+            paths.radiance[shadows.slots[k]] += shadows.contribution[k];
+}
+
+// 与render_frame()相同的tile调度, 每个工作线程用自己的wavefront_integrator按阶段渲染它的所有tile.
+void render_frame_wavefront(const surface& world, const light_list& lights, const camera& cam, const render_options& opts,
+                            framebuffer& image, sampling_stats& stats, const bool show_progress = true) {
+    tile_scheduler scheduler(image.width(), image.height(), opts.tile_size);
+    std::atomic<int> tiles_remaining(static_cast<int>(scheduler.tiles().size()));
+    // 下标是工作线程的编号, 每个线程在第一个tile时构造自己的integrator, 只有它自己访问这一项.
+    std::vector<std::unique_ptr<wavefront_integrator>> integrators(static_cast<size_t>(std::max(1, opts.num_threads)));
+    scheduler.run(opts.num_threads, [&](const tile& tl, const int worker) {
+        trace_scope trace("tile", "tile", tl.index);
+        std::unique_ptr<wavefront_integrator>& integrator = integrators[worker];
+        if(!integrator) integrator.reset(new wavefront_integrator(world, lights, cam, opts, image.width(), image.height()));
+        const long long tile_samples = integrator->render_tile(tl, image);
+        stats.merge(tile_samples, static_cast<long long>(tl.x1 - tl.x0) * (tl.y1 - tl.y0), 0, opts.samples_per_pixel, opts.samples_per_pixel);
+        const int remaining = --tiles_remaining;
+        if(show_progress) print_tiles_remaining(remaining);
+    });
+    if(show_progress) std::cerr << '\n';
+}
+
+#endif